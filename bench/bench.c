@@ -0,0 +1,786 @@
+#ifdef BENCH
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "../include/chunk_reader.h"
+#include "../include/options.h"
+#include "../include/dict.h"
+#include "../include/tree.h"
+#include "../include/build_dict.h"
+#include "../include/print_dict.h"
+#include "../include/serve.h"
+#include "../include/word_filter.h"
+#include "../include/hot_cache.h"
+#include "../include/perf_counters.h"
+#include "bench.h"
+
+
+// Keeps benchmarked reads from being optimized out
+static volatile unsigned long bench_sink;
+
+
+// Drop file's clean pages from the page cache
+static void evict_file(const char* path) {
+    int fd = open(path, O_RDONLY);
+
+    if(fd < 0)
+        return;
+
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+
+// Read whole file through a ChunkReader, returns bytes read
+static size_t read_file(const char* path, IoBackend backend, ReadMode mode, IoBackend* used, ReadMode* used_mode) {
+    int fd = open(path, O_RDONLY);
+
+    if(fd < 0)
+        return 0;
+
+    struct stat st;
+    fstat(fd, &st);
+
+    ChunkReader* reader = chunk_reader_create(fd, 0, st.st_size, backend, mode);
+
+    if(!reader) {
+        close(fd);
+        return 0;
+    }
+
+    const char* data;
+    size_t len;
+    unsigned long checksum = 0;
+
+    while(chunk_reader_next(reader, &data, &len))
+        checksum += (unsigned char)data[len - 1]; // Touch buffer
+
+    size_t bytes = chunk_reader_bytes_read(reader);
+    *used = chunk_reader_backend(reader);
+    *used_mode = chunk_reader_mode(reader);
+
+    chunk_reader_free(reader);
+    close(fd);
+
+    bench_sink = checksum;
+
+    return bytes;
+}
+
+
+// Throughput of each read backend and page cache mode with cold and warm
+// cache, and how much of the file reading leaves cached
+static int bench_read(int argc, char* argv[]) {
+    if(argc < 1) {
+        fprintf(stderr, "read: file argument required\n");
+        return 1;
+    }
+
+    const char* path = argv[0];
+    IoBackend backends[] = {IO_URING, IO_PREAD};
+    ReadMode modes[] = {READ_BUFFERED, READ_DIRECT};
+    const char* caches[] = {"cold", "warm"};
+
+    printf("%-10s %-24s %-6s %14s %14s %14s\n", "backend", "mode", "cache", "read MiB/s", "count MiB/s",
+        "cached MiB");
+
+    for(size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+        for(size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+            for(int warm = 0; warm < 2; warm++) {
+                IoBackend used = backends[b];
+                ReadMode used_mode = modes[m];
+
+                if(warm) // Direct reads leave nothing behind to be warm
+                    read_file(path, backends[b], READ_BUFFERED, &used, &used_mode);
+                else
+                    evict_file(path);
+
+                // Raw read throughput on one thread, and the cache it leaves
+                double start = now_seconds();
+                size_t bytes = read_file(path, backends[b], modes[m], &used, &used_mode);
+                double read_time = now_seconds() - start;
+                long cached = page_cache_resident(path);
+
+                if(!warm)
+                    evict_file(path);
+
+                // End to end counting throughput
+                Options opts;
+                options_init(&opts);
+                opts.io = backends[b];
+                opts.read_mode = modes[m];
+
+                start = now_seconds();
+                count_words((char*)path, &opts);
+                double count_time = now_seconds() - start;
+
+                double mib = bytes / (1024.0 * 1024.0);
+
+                printf("%-10s %-24s %-6s %14.1f %14.1f %14.1f\n", io_backend_name(used), read_mode_name(used_mode),
+                    caches[warm], read_time > 0 ? mib / read_time : 0.0, count_time > 0 ? mib / count_time : 0.0,
+                    cached >= 0 ? cached / (1024.0 * 1024.0) : 0.0);
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+#define LATENCY_RUNS 200
+#define LATENCY_FILE_SIZE 1024
+
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+
+// Fork a process that counts and prints file, returns seconds until it exits
+static double run_forked(const char* path, int threads) {
+    fflush(stdout); // Child must not repeat buffered output
+
+    double start = now_seconds();
+    pid_t pid = fork();
+
+    if(pid == 0) { // Child runs the program's work and exits
+        Options opts;
+        options_init(&opts);
+        opts.threads = threads;
+
+        if(!freopen("/dev/null", "w", stdout))
+            _exit(1);
+
+        count_words((char*)path, &opts);
+        print_dict(opts.dict_path, opts.output);
+        fflush(stdout);
+        _exit(0);
+    }
+
+    waitpid(pid, NULL, 0);
+
+    return now_seconds() - start;
+}
+
+
+// Spawn binary on path, returns seconds until it exits
+static double run_spawned(const char* binary, const char* path) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+    char* args[] = {(char*)binary, (char*)path, NULL};
+    double start = now_seconds();
+    pid_t pid;
+
+    if(posix_spawn(&pid, binary, &actions, NULL, args, NULL)) {
+        posix_spawn_file_actions_destroy(&actions);
+        return -1;
+    }
+
+    waitpid(pid, NULL, 0);
+    posix_spawn_file_actions_destroy(&actions);
+
+    return now_seconds() - start;
+}
+
+
+static void print_latency(const char* label, double* times, int runs) {
+    qsort(times, runs, sizeof(double), compare_double);
+
+    printf("%-24s p50 %8.3f ms   p99 %8.3f ms\n", label,
+        times[runs / 2] * 1e3, times[(runs * 99) / 100] * 1e3);
+}
+
+
+// Startup-to-exit latency for a 1 KB file
+static int bench_latency(int argc, char* argv[]) {
+    char path[] = "/tmp/word_count_latencyXXXXXX";
+    int fd = mkstemp(path);
+
+    if(fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+
+    // Fill file with short words
+    char text[LATENCY_FILE_SIZE];
+
+    for(int i = 0; i < LATENCY_FILE_SIZE; i++)
+        text[i] = (i % 6 == 5) ? ' ' : 'a' + (i / 6) % 26;
+
+    if(write(fd, text, sizeof(text)) != (ssize_t)sizeof(text)) {
+        close(fd);
+        unlink(path);
+        return 1;
+    }
+
+    close(fd);
+
+    double times[LATENCY_RUNS];
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    // Previous behaviour, one thread per core
+    for(int i = 0; i < LATENCY_RUNS; i++)
+        times[i] = run_forked(path, num_cores);
+    print_latency("fork, thread per core", times, LATENCY_RUNS);
+
+    // Threads chosen from file size
+    for(int i = 0; i < LATENCY_RUNS; i++)
+        times[i] = run_forked(path, 0);
+    print_latency("fork, adaptive", times, LATENCY_RUNS);
+
+    if(argc >= 1) { // Full process startup of a built binary
+        for(int i = 0; i < LATENCY_RUNS; i++)
+            times[i] = run_spawned(argv[0], path);
+        print_latency("spawn", times, LATENCY_RUNS);
+    }
+
+    unlink(path);
+
+    return 0;
+}
+
+
+#define URL_TOKENS 2000000
+
+
+// Resident set size of this process in bytes
+static size_t current_rss() {
+    FILE* file = fopen("/proc/self/statm", "r");
+    unsigned long size, resident = 0;
+
+    if(!file)
+        return 0;
+
+    if(fscanf(file, "%lu %lu", &size, &resident) != 2)
+        resident = 0;
+
+    fclose(file);
+
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+
+// Null separated tokens with their start offsets
+typedef struct {
+    char* text;
+    size_t* starts;
+    size_t count;
+} TokenList;
+
+
+static char token_push(TokenList* tokens, size_t* capacity, size_t start) {
+    if(tokens->count == *capacity) { // Grow offsets
+        size_t new_capacity = *capacity ? *capacity * 2 : 1024;
+        size_t* new_starts = realloc(tokens->starts, new_capacity * sizeof(size_t));
+
+        if(!new_starts) // Allocation failed
+            return 0;
+
+        tokens->starts = new_starts;
+        *capacity = new_capacity;
+    }
+
+    tokens->starts[tokens->count++] = start;
+
+    return 1;
+}
+
+
+// Split file on whitespace like the tokenizer
+static char load_tokens(const char* path, TokenList* tokens) {
+    FILE* file = fopen(path, "rb");
+    struct stat st;
+
+    if(!file || fstat(fileno(file), &st)) {
+        perror(path);
+        if(file)
+            fclose(file);
+        return 0;
+    }
+
+    tokens->text = malloc(st.st_size + 1);
+    size_t capacity = 0;
+
+    if(!tokens->text || fread(tokens->text, 1, st.st_size, file) != (size_t)st.st_size) {
+        fclose(file);
+        return 0;
+    }
+
+    fclose(file);
+
+    char in_word = 0;
+
+    for(off_t i = 0; i <= st.st_size; i++) {
+        char c = i < st.st_size ? tokens->text[i] : ' ';
+
+        if(c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f') {
+            tokens->text[i] = '\0';
+            in_word = 0;
+        } else if(!in_word) {
+            in_word = 1;
+
+            if(!token_push(tokens, &capacity, i))
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+// Synthetic URLs sharing scheme, host and path prefixes
+static char make_urls(TokenList* tokens) {
+    static const char* hosts[] = {"www.example.com", "api.example.com", "cdn.example.net", "docs.example.org"};
+    static const char* paths[] = {"/api/v2/users/", "/static/images/", "/docs/reference/", "/blog/2024/posts/"};
+
+    tokens->text = malloc((size_t)URL_TOKENS * 96);
+    size_t capacity = 0;
+    size_t len = 0;
+    unsigned long seed = 88172645463325252UL;
+
+    if(!tokens->text)
+        return 0;
+
+    for(int i = 0; i < URL_TOKENS; i++) {
+        // xorshift, skewed so some URLs repeat often
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+
+        unsigned long id = (seed % 1000) * (seed / 1000 % 1000) % 400000;
+
+        if(!token_push(tokens, &capacity, len))
+            return 0;
+
+        len += sprintf(tokens->text + len, "https://%s%s%lu/item-%lu", hosts[seed >> 60 & 3],
+            paths[seed >> 58 & 3], id / 100, id) + 1;
+    }
+
+    return 1;
+}
+
+
+// Count tokens in a fresh dictionary in a child, reports rate and memory.
+// Timing includes one pass over the result, where the sort engine does its work.
+static void run_engine(const TokenList* tokens, Engine engine, char cached) {
+    fflush(stdout); // Child must not repeat buffered output
+
+    pid_t pid = fork();
+
+    if(pid == 0) {
+        size_t rss_before = current_rss();
+        Dict* dict = dict_create(engine);
+        HotCache* cache = cached ? hot_cache_create(dict) : NULL;
+        double start = now_seconds();
+
+        for(size_t i = 0; i < tokens->count; i++) {
+            const char* word = tokens->text + tokens->starts[i];
+
+            if(cache)
+                hot_cache_add(cache, word, strlen(word) + 1);
+            else
+                dict_add(dict, word, strlen(word) + 1);
+        }
+
+        hot_cache_flush(cache);
+
+        DictIter* iter = dict_iter_create(dict);
+        unsigned long long count;
+
+        while(dict_iter_next(iter, &count))
+            bench_sink += count;
+
+        dict_iter_free(iter);
+
+        double elapsed = now_seconds() - start;
+        size_t rss_after = current_rss();
+
+        printf("%-5s %-3s %10zu distinct %8.2f M tokens/s %8.1f ns/token   rss +%7.1f MiB   dict %7.1f MiB",
+            engine_name(engine), cached ? "+hc" : "", dict_size(dict), tokens->count / elapsed / 1e6,
+            elapsed * 1e9 / tokens->count, (rss_after - rss_before) / (1024.0 * 1024.0),
+            dict_memory_used(dict) / (1024.0 * 1024.0));
+
+        if(cache)
+            printf("   hits %5.1f%%", cache->lookups ? 100.0 * cache->hits / cache->lookups : 0.0);
+
+        printf("\n");
+        hot_cache_free(cache);
+
+        dict_free(dict);
+        fflush(stdout);
+        _exit(0);
+    }
+
+    waitpid(pid, NULL, 0);
+}
+
+
+// Insert rate and memory of each engine on a file's words or synthetic URLs
+static int bench_engines(int argc, char* argv[]) {
+    TokenList tokens = {NULL, NULL, 0};
+    char ok = argc >= 1 ? load_tokens(argv[0], &tokens) : make_urls(&tokens);
+
+    if(!ok) {
+        free(tokens.text);
+        free(tokens.starts);
+        return 1;
+    }
+
+    printf("%zu tokens from %s\n", tokens.count, argc >= 1 ? argv[0] : "synthetic URLs");
+
+    // Every registered engine on the same tokens
+    for(Engine engine = 0; dict_backend(engine); engine++)
+        run_engine(&tokens, engine, 0);
+
+    // Hot-word cache in front of the searching engines
+    run_engine(&tokens, ENGINE_AVL, 1);
+    run_engine(&tokens, ENGINE_CTREE, 1);
+    run_engine(&tokens, ENGINE_ART, 1);
+
+    free(tokens.text);
+    free(tokens.starts);
+
+    return 0;
+}
+
+
+#define LOAD_SAMPLE_WORDS 1000
+
+
+// One load generator connection
+typedef struct {
+    const char* socket_path;
+    char** words; // Words to look up
+    size_t num_words;
+    int requests;
+    unsigned long seed;
+
+    double* times; // Latency of each request
+    int completed;
+} LoadClient;
+
+
+// Mix of 80% lookups, 10% prefix and 10% top-K queries
+static void* load_client(void* arg) {
+    LoadClient* client = (LoadClient*)arg;
+    int fd = serve_connect(client->socket_path);
+    ServeReply reply = {0, 0, NULL, 0, 0};
+
+    if(fd < 0)
+        return NULL;
+
+    for(int i = 0; i < client->requests; i++) {
+        client->seed ^= client->seed << 13;
+        client->seed ^= client->seed >> 7;
+        client->seed ^= client->seed << 17;
+
+        const char* word = client->words[client->seed % client->num_words];
+        size_t len = strlen(word);
+        int kind = (client->seed >> 32) % 10;
+        double start = now_seconds();
+        char ok;
+
+        if(kind < 8)
+            ok = serve_query(fd, SERVE_LOOKUP, 0, word, len, &reply);
+        else if(kind < 9)
+            ok = serve_query(fd, SERVE_PREFIX, 10, word, len < 3 ? len : 3, &reply);
+        else
+            ok = serve_query(fd, SERVE_TOPK, 10, NULL, 0, &reply);
+
+        if(!ok)
+            break;
+
+        client->times[client->completed++] = now_seconds() - start;
+    }
+
+    serve_reply_free(&reply);
+    close(fd);
+
+    return NULL;
+}
+
+
+// Latency of a running word_count serve under concurrent clients
+static int bench_serve(int argc, char* argv[]) {
+    if(argc < 1) {
+        fprintf(stderr, "socket path required\n");
+        return 1;
+    }
+
+    const char* socket_path = argv[0];
+    int num_clients = argc >= 2 ? atoi(argv[1]) : 4;
+    int requests = argc >= 3 ? atoi(argv[2]) : 20000;
+
+    if(num_clients < 1 || requests < 1)
+        return 1;
+
+    // Words to look up, taken from the start of the dictionary
+    int fd = serve_connect(socket_path);
+    ServeReply reply = {0, 0, NULL, 0, 0};
+
+    if(fd < 0 || !serve_query(fd, SERVE_PREFIX, LOAD_SAMPLE_WORDS, NULL, 0, &reply) || reply.num_entries == 0) {
+        fprintf(stderr, "%s: no words served\n", socket_path);
+        if(fd >= 0)
+            close(fd);
+        serve_reply_free(&reply);
+        return 1;
+    }
+
+    close(fd);
+
+    char** words = malloc(reply.num_entries * sizeof(char*));
+    size_t num_words = 0;
+    size_t pos = 0;
+    const char* word;
+    uint32_t word_len;
+
+    while(words && serve_reply_next(&reply, &pos, &word, &word_len, NULL))
+        words[num_words++] = strndup(word, word_len);
+
+    serve_reply_free(&reply);
+
+    LoadClient* clients = calloc(num_clients, sizeof(LoadClient));
+    pthread_t* threads = malloc(num_clients * sizeof(pthread_t));
+    double* times = malloc((size_t)num_clients * requests * sizeof(double));
+
+    if(!words || !clients || !threads || !times)
+        return 1;
+
+    double start = now_seconds();
+
+    for(int i = 0; i < num_clients; i++) {
+        clients[i].socket_path = socket_path;
+        clients[i].words = words;
+        clients[i].num_words = num_words;
+        clients[i].requests = requests;
+        clients[i].seed = 88172645463325252UL + i * 7919;
+        clients[i].times = times + (size_t)i * requests;
+
+        pthread_create(&threads[i], NULL, load_client, &clients[i]);
+    }
+
+    int total = 0;
+
+    for(int i = 0; i < num_clients; i++) {
+        pthread_join(threads[i], NULL);
+
+        // Pack completed latencies together
+        memmove(times + total, clients[i].times, clients[i].completed * sizeof(double));
+        total += clients[i].completed;
+    }
+
+    double elapsed = now_seconds() - start;
+
+    printf("%d clients, %d requests in %.2f s (%.0f req/s)\n", num_clients, total, elapsed, total / elapsed);
+
+    if(total > 0) {
+        qsort(times, total, sizeof(double), compare_double);
+        printf("latency p50 %8.1f us   p99 %8.1f us\n", times[total / 2] * 1e6, times[(total * 99) / 100] * 1e6);
+    }
+
+    for(size_t i = 0; i < num_words; i++)
+        free(words[i]);
+
+    free(words);
+    free(clients);
+    free(threads);
+    free(times);
+
+    return total > 0 ? 0 : 1;
+}
+
+
+#define CURSOR_WORDS 1000000
+#define CURSOR_BATCH 64
+
+
+// Full scans of an AVL tree, one item per call against batches
+static int bench_cursor(int argc, char* argv[]) {
+    (void)argc;
+    (void)argv;
+
+    Tree* tree = tree_create(compare_str);
+    char word[32];
+    unsigned long seed = 88172645463325252UL;
+
+    if(!tree)
+        return 1;
+
+    for(int i = 0; i < CURSOR_WORDS; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+
+        int len = snprintf(word, sizeof(word), "w%lx", seed);
+        tree_set(tree, word, len + 1, set_word_count);
+    }
+
+    for(int round = 0; round < 3; round++) {
+        // One item per call
+        double start = now_seconds();
+        TreeIter* iter = tree_iter_create(tree);
+        void* key;
+        void* val;
+
+        while(tree_iter_next(iter, &key, NULL, &val, NULL))
+            bench_sink += *(unsigned long long*)val + ((char*)key)[1];
+
+        tree_iter_free(iter);
+        double single = now_seconds() - start;
+
+        // Batches with prefetch
+        start = now_seconds();
+        iter = tree_iter_create(tree);
+        TreeEntry entries[CURSOR_BATCH];
+        size_t len;
+
+        while((len = tree_iter_next_batch(iter, entries, CURSOR_BATCH)) > 0) {
+            for(size_t i = 0; i < len; i++)
+                bench_sink += *(const unsigned long long*)entries[i].val + ((const char*)entries[i].key)[1];
+        }
+
+        tree_iter_free(iter);
+        double batched = now_seconds() - start;
+
+        printf("%u keys: next %6.1f ns/key   batch %6.1f ns/key\n", tree_size(tree),
+            single * 1e9 / tree_size(tree), batched * 1e9 / tree_size(tree));
+    }
+
+    tree_free(tree);
+
+    return 0;
+}
+
+
+#define FILTER_WORDS 300
+
+
+// Per-token cost of the word filter and the inserts it saves
+static int bench_filter(int argc, char* argv[]) {
+    TokenList tokens = {NULL, NULL, 0};
+    char ok = argc >= 1 ? load_tokens(argv[0], &tokens) : make_urls(&tokens);
+    size_t num_words = argc >= 2 ? (size_t)atol(argv[1]) : FILTER_WORDS;
+
+    if(!ok || tokens.count == 0 || num_words == 0) {
+        free(tokens.text);
+        free(tokens.starts);
+        return 1;
+    }
+
+    // Exclude words spread over the input, frequent words are likely among them
+    const char** words = malloc(num_words * sizeof(char*));
+    size_t* lens = malloc(tokens.count * sizeof(size_t));
+
+    for(size_t i = 0; words && i < num_words; i++)
+        words[i] = tokens.text + tokens.starts[(i * 7919) % tokens.count];
+
+    double start = now_seconds();
+    WordFilter* filter = words ? word_filter_create(NULL, 0, words, num_words) : NULL;
+    double build_time = now_seconds() - start;
+
+    if(!filter || !lens) {
+        free(words);
+        free(lens);
+        word_filter_free(filter);
+        free(tokens.text);
+        free(tokens.starts);
+        return 1;
+    }
+
+    for(size_t i = 0; i < tokens.count; i++)
+        lens[i] = strlen(tokens.text + tokens.starts[i]);
+
+    printf("%zu tokens from %s, %zu exclude words hashed in %.3f ms\n", tokens.count,
+        argc >= 1 ? argv[0] : "synthetic URLs", perfect_hash_size(filter->exclude), build_time * 1e3);
+
+    // Lookup alone
+    size_t kept = 0;
+    start = now_seconds();
+
+    for(size_t i = 0; i < tokens.count; i++)
+        kept += word_filter_keep(filter, tokens.text + tokens.starts[i], lens[i]);
+
+    double lookup_time = now_seconds() - start;
+    bench_sink += kept;
+
+    printf("lookup           %8.1f ns/token, %.1f%% of tokens dropped\n",
+        lookup_time * 1e9 / tokens.count, 100.0 * (tokens.count - kept) / tokens.count);
+
+    // Inserts with and without the filter in front
+    for(int filtered = 0; filtered < 2; filtered++) {
+        Dict* dict = dict_create(ENGINE_ART);
+        start = now_seconds();
+
+        for(size_t i = 0; i < tokens.count; i++) {
+            const char* word = tokens.text + tokens.starts[i];
+
+            if(!filtered || word_filter_keep(filter, word, lens[i]))
+                dict_add(dict, word, lens[i] + 1);
+        }
+
+        double elapsed = now_seconds() - start;
+
+        printf("%-16s %8.1f ns/token, %zu distinct\n", filtered ? "filter + insert" : "insert",
+            elapsed * 1e9 / tokens.count, dict_size(dict));
+
+        dict_free(dict);
+    }
+
+    free(words);
+    free(lens);
+    word_filter_free(filter);
+    free(tokens.text);
+    free(tokens.starts);
+
+    return 0;
+}
+
+
+typedef struct {
+    const char* name;
+    const char* args;
+    int (*run)(int argc, char* argv[]);
+} Bench;
+
+static const Bench benches[] = {
+    {"read", "<file>", bench_read},
+    {"latency", "[word_count binary]", bench_latency},
+    {"engines", "[file]", bench_engines},
+    {"cursor", "", bench_cursor},
+    {"filter", "[file] [exclude words]", bench_filter},
+    {"serve", "<socket> [clients] [requests per client]", bench_serve},
+};
+
+
+int bench(int argc, char* argv[]) {
+    size_t num_benches = sizeof(benches) / sizeof(benches[0]);
+
+    if(argc >= 2) {
+        for(size_t i = 0; i < num_benches; i++) {
+            if(!strcmp(argv[1], benches[i].name))
+                return benches[i].run(argc - 2, argv + 2);
+        }
+    }
+
+    fprintf(stderr, "usage: %s <benchmark> [args]\n", argv[0]);
+
+    for(size_t i = 0; i < num_benches; i++)
+        fprintf(stderr, "  %s %s\n", benches[i].name, benches[i].args);
+
+    return 1;
+}
+
+#endif
\ No newline at end of file
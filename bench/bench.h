@@ -0,0 +1,6 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+int bench(int argc, char* argv[]);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,20 @@
+#ifndef ART_H
+#define ART_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct ArtTree ArtTree;
+typedef struct ArtIter ArtIter;
+
+ArtTree* art_create();
+uint64_t* art_upsert(ArtTree* tree, const unsigned char* key, size_t key_size);
+size_t art_size(ArtTree* tree);
+size_t art_memory(ArtTree* tree);
+void art_free(ArtTree* tree);
+ArtIter* art_iter_create(ArtTree* tree);
+ArtIter* art_drain_create(ArtTree* tree);
+char art_iter_next(ArtIter* iter, const unsigned char** key, size_t* key_size, uint64_t* count);
+void art_iter_free(ArtIter* iter);
+
+#endif
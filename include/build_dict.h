@@ -1,6 +1,24 @@
 #ifndef BUILD_DICT_H
 #define BUILD_DICT_H
 
-char count_words(char* filepath);
+#include <stddef.h>
+#include "tree.h"
+#include "options.h"
+
+// Totals reported by the reading phase
+typedef struct ReadStats {
+    size_t bytes_read; // Bytes read from input file
+    size_t bytes_decoded; // Bytes of text tokenized
+    IoBackend io; // Backend used by readers
+    ReadMode read_mode; // Page cache use of readers, drop if any could not read direct
+    long parallel_parts; // Compressed ranges decoded in parallel, 0 if pipelined
+    size_t cache_lookups; // Keys passed through hot-word caches, 0 when disabled
+    size_t cache_hits; // Keys counted in a cache without touching the dictionary
+} ReadStats;
+
+int compare_str(const void* a, const void* b);
+int set_word_count(void** val, size_t* val_size);
+int merge_word_count(void** val, size_t* val_size, void* other, size_t other_size);
+char count_words(char* filepath, const Options* opts);
 
 #endif
\ No newline at end of file
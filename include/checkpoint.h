@@ -0,0 +1,40 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stddef.h>
+#include "dict.h"
+#include "result_cache.h"
+
+#define CHECKPOINT_MANIFEST "manifest"
+
+// Byte range of the input counted and saved on its own
+typedef struct Segment {
+    long start;
+    long end;
+    char done; // Dictionary saved and listed in the manifest
+} Segment;
+
+// Segments of one input kept in dir, listed in dir/manifest
+typedef struct Checkpoint {
+    char* dir;
+    char key[CACHE_KEY_SIZE]; // Input identity and settings the segments belong to
+    Segment* segments;
+    size_t num_segments;
+    size_t num_reused; // Segments found done when opened
+
+    long long segment_size; // Bytes per segment, 0 when following
+    char* follow; // Growing input whose new bytes become the last segment, NULL if fixed
+    long processed; // Bytes of the followed input counted by earlier runs
+    unsigned long long tail; // Hash of the bytes before processed
+    unsigned long long next_tail; // Hash of the bytes before the end of the new segment
+} Checkpoint;
+
+Checkpoint* checkpoint_open(const char* dir, const char* key, long file_size, long long segment_size);
+Checkpoint* checkpoint_follow(const char* dir, const char* key, const char* filepath, long file_size);
+char checkpoint_compact(Checkpoint* cp);
+void checkpoint_segment_path(const Checkpoint* cp, size_t index, char* path, size_t size);
+char checkpoint_commit(Checkpoint* cp, size_t index, const char* tmp_path);
+char checkpoint_merge(const Checkpoint* cp, WordSink sink, void* ctx);
+void checkpoint_free(Checkpoint* cp);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef CHUNK_READER_H
+#define CHUNK_READER_H
+
+#include <stddef.h>
+
+// I/O backend used to read file chunks
+typedef enum {
+    IO_AUTO,  // io_uring when available, pread otherwise
+    IO_URING, // Several reads in flight across rotating buffers
+    IO_PREAD  // Synchronous pread into the same buffers
+} IoBackend;
+
+// How chunk reads use the page cache
+typedef enum {
+    READ_BUFFERED, // Through the page cache, pages stay cached
+    READ_DIRECT, // O_DIRECT into aligned buffers, bypassing the cache
+    READ_DROP // Buffered where O_DIRECT is unsupported, pages dropped once consumed
+} ReadMode;
+
+typedef struct ChunkReader ChunkReader;
+
+ChunkReader* chunk_reader_create(int fd, long start, long end, IoBackend backend, ReadMode mode);
+char chunk_reader_next(ChunkReader* reader, const char** data, size_t* len);
+char chunk_reader_error(ChunkReader* reader);
+IoBackend chunk_reader_backend(ChunkReader* reader);
+ReadMode chunk_reader_mode(ChunkReader* reader);
+size_t chunk_reader_bytes_read(ChunkReader* reader);
+void chunk_reader_free(ChunkReader* reader);
+
+const char* io_backend_name(IoBackend backend);
+const char* read_mode_name(ReadMode mode);
+long page_cache_resident(const char* path);
+
+#endif
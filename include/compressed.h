@@ -0,0 +1,20 @@
+#ifndef COMPRESSED_H
+#define COMPRESSED_H
+
+#include "dict.h"
+#include "options.h"
+#include "build_dict.h"
+
+// Input file formats, detected by magic bytes
+typedef enum {
+    FORMAT_PLAIN,
+    FORMAT_GZIP, // One or more gzip members
+    FORMAT_BGZF, // gzip members with block sizes in the header
+    FORMAT_ZSTD // One or more zstd frames
+} InputFormat;
+
+InputFormat detect_format(const char* filepath);
+const char* input_format_name(InputFormat format);
+Dict** count_compressed(char* filepath, InputFormat format, long num_threads, const Options* opts, long* num_dicts, ReadStats* stats);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,16 @@
+#ifndef COUNT_ORDER_H
+#define COUNT_ORDER_H
+
+#include <stdio.h>
+#include "dict.h"
+
+typedef struct CountOrder CountOrder;
+
+CountOrder* count_order_create();
+char count_order_add(void* order, const char* word, unsigned long long count);
+char count_order_sort(CountOrder* order, int num_threads);
+size_t count_order_size(const CountOrder* order);
+char count_order_print(const CountOrder* order, FILE* out);
+void count_order_free(CountOrder* order);
+
+#endif
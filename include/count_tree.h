@@ -0,0 +1,20 @@
+#ifndef COUNT_TREE_H
+#define COUNT_TREE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct CountTree CountTree;
+typedef struct CountTreeIter CountTreeIter;
+
+CountTree* count_tree_create();
+uint64_t* count_tree_upsert(CountTree* tree, const char* key, size_t key_size);
+char count_tree_reserve(CountTree* tree, size_t num_keys, size_t key_size);
+size_t count_tree_size(CountTree* tree);
+size_t count_tree_memory(CountTree* tree);
+void count_tree_free(CountTree* tree);
+CountTreeIter* count_tree_iter_create(CountTree* tree);
+char count_tree_iter_next(CountTreeIter* iter, const char** key, uint64_t* count);
+void count_tree_iter_free(CountTreeIter* iter);
+
+#endif
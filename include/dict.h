@@ -0,0 +1,76 @@
+#ifndef DICT_H
+#define DICT_H
+
+#include <stddef.h>
+#include "interner.h"
+
+// Data structure words are counted in
+typedef enum Engine {
+    ENGINE_AVL, // Balanced tree of whole keys
+    ENGINE_ART, // Adaptive radix tree
+    ENGINE_SORT, // Sorted token array, counted when read
+    ENGINE_CTREE, // Balanced tree specialized for counting strings
+    ENGINE_IDS // Counts by dense word ID from an interner shared between dictionaries
+} Engine;
+
+// Receives merged words in order, returns 0 to stop
+typedef char (*WordSink)(void* ctx, const char* word, unsigned long long count);
+
+// Word and count returned by a batched iterator
+typedef struct DictEntry {
+    const char* word;
+    unsigned long long count;
+} DictEntry;
+
+// Operations of one engine on its own dictionaries and iterators. Words
+// come out of iterators in strcmp order, word sizes include the null.
+typedef struct DictBackend {
+    const char* name; // Given to --engine
+    void* (*create)(void);
+    char (*reserve)(void* impl, size_t num_tokens, size_t num_distinct, size_t key_size); // NULL ignores hints
+    char (*increment)(void* impl, const char* word, size_t word_size, unsigned long long count);
+    void* (*merge)(void* a, void* b); // Moves b into a and frees it, NULL adds b's words one at a time
+    size_t (*size)(void* impl);
+    size_t (*memory_used)(void* impl);
+    void (*free)(void* impl);
+    char (*close_stream)(void* impl); // Finishes a token stream, NULL when the engine writes none
+    char (*write_vocab)(void* impl, const char* path); // Words by ID with totals, NULL without word IDs
+
+    void* (*iter_create)(void* impl);
+    void* (*drain_create)(void* impl); // Frees words as they pass, NULL frees all after the last
+    char (*iter_next)(void* iter, size_t pos, const char** word, unsigned long long* count);
+    size_t (*iter_next_batch)(void* iter, DictEntry* entries, size_t max, char drain); // NULL reads words one by one
+    void (*iter_free)(void* iter); // NULL when iterators read the dictionary in place
+    char reuses_word; // Next word overwrites the one returned before
+} DictBackend;
+
+// Word counts of one reading thread
+typedef struct Dict {
+    Engine engine;
+    const DictBackend* backend;
+    void* impl;
+} Dict;
+
+typedef struct DictIter DictIter;
+
+Dict* dict_create(Engine engine);
+Dict* dict_create_ids(Interner* interner, const char* stream_path);
+char dict_close_stream(Dict* dict);
+char dict_write_vocab(Dict* dict, const char* path);
+char dict_reserve(Dict* dict, size_t num_tokens, size_t num_distinct, size_t key_size);
+char dict_add(Dict* dict, const char* word, size_t word_size);
+char dict_add_count(Dict* dict, const char* word, size_t word_size, unsigned long long count);
+size_t dict_size(Dict* dict);
+size_t dict_memory_used(Dict* dict);
+Dict* dict_merge(Dict* a, Dict* b);
+void dict_free(Dict* dict);
+DictIter* dict_iter_create(Dict* dict);
+DictIter* dict_drain_create(Dict* dict);
+char* dict_iter_next(DictIter* iter, unsigned long long* count);
+size_t dict_iter_next_batch(DictIter* iter, DictEntry* entries, size_t max);
+void dict_iter_free(DictIter* iter);
+const DictBackend* dict_backend(Engine engine);
+const char* engine_name(Engine engine);
+char engine_parse(const char* name, Engine* engine);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef DICT_FILE_H
+#define DICT_FILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// First and last bytes of a block-compressed dictionary
+#define DICT_BLOCK_MAGIC "WCDICTZ1"
+#define DICT_MAGIC_SIZE 8
+
+// Encoded bytes after which the next record starts a new block
+#define DICT_BLOCK_SIZE (64 * 1024)
+
+// Longest encoding of a record beyond its word bytes, three varints
+#define DICT_RECORD_OVERHEAD 30
+
+// Directory entry of one block, records in a block are decoded on their own
+typedef struct DictBlock {
+    uint64_t offset;
+    uint64_t raw_size; // Bytes of its records in the plain format
+    uint32_t size; // Encoded bytes
+    uint32_t num_records;
+} DictBlock;
+
+// Follows the block directory at the end of the file
+typedef struct DictFooter {
+    uint64_t num_blocks;
+    uint64_t directory_offset;
+    char magic[DICT_MAGIC_SIZE];
+} DictFooter;
+
+// Block-compressed dictionary opened for reading
+typedef struct BlockDict {
+    int fd;
+    DictBlock* blocks;
+    size_t num_blocks;
+    uint64_t raw_size; // Bytes of all records in the plain format
+    uint64_t file_size;
+} BlockDict;
+
+// Time and volume of a dictionary read
+typedef struct DictReadStats {
+    uint64_t file_size;
+    uint64_t raw_size;
+    size_t num_blocks; // 0 for the plain format
+    int num_threads;
+    double decode_time;
+} DictReadStats;
+
+size_t dict_block_encode(char* dest, const char* prev, size_t prev_len,
+                         const char* word, size_t len, unsigned long long count);
+char dict_file_blocked(int fd);
+BlockDict* block_dict_open(int fd);
+char block_dict_print(BlockDict* dict, FILE* out, int num_threads);
+char* block_dict_load(BlockDict* dict, int num_threads);
+void block_dict_free(BlockDict* dict);
+char* dict_file_read(int fd, size_t* size);
+
+#endif
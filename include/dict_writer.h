@@ -0,0 +1,25 @@
+#ifndef DICT_WRITER_H
+#define DICT_WRITER_H
+
+#include <stddef.h>
+
+// Buffers rotated between the merge and the writer thread
+#define DICT_WRITER_BUFFERS 3
+#define DICT_WRITER_BUFFER_SIZE (1024 * 1024)
+
+typedef struct DictWriter DictWriter;
+
+// Time each side spent waiting on the other
+typedef struct DictWriterStats {
+    double write_time; // Writer thread in write calls
+    double stall_time; // Merge waiting for a free buffer
+    size_t bytes_written;
+    size_t raw_bytes; // Records in the plain format, equal to bytes_written unless blocked
+} DictWriterStats;
+
+DictWriter* dict_writer_open(const char* path);
+DictWriter* dict_writer_open_blocked(const char* path);
+char dict_writer_add(void* writer, const char* word, unsigned long long count);
+char dict_writer_close(DictWriter* writer, DictWriterStats* stats);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef HOT_CACHE_H
+#define HOT_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "dict.h"
+
+// 2-way set associative, sized to stay in L1 and L2
+#define HOT_CACHE_SETS 256
+#define HOT_CACHE_WAYS 2
+
+// Longest cached key including its null, longer keys go straight to the dictionary
+#define HOT_KEY_SIZE 44
+
+// Cached key with the count not yet added to the dictionary, one cache line
+typedef struct HotEntry {
+    uint64_t hash;
+    uint64_t count; // 0 when empty
+    uint32_t key_size;
+    char key[HOT_KEY_SIZE];
+} HotEntry;
+
+// Absorbs repeated words of one worker before they reach its dictionary
+typedef struct HotCache {
+    Dict* dict;
+    HotEntry entries[HOT_CACHE_SETS][HOT_CACHE_WAYS];
+    uint8_t victim[HOT_CACHE_SETS]; // Way replaced next in each set
+    size_t lookups;
+    size_t hits;
+} HotCache;
+
+char hot_cache_useful(Engine engine);
+HotCache* hot_cache_create(Dict* dict);
+char hot_cache_add(HotCache* cache, const char* word, size_t word_size);
+char hot_cache_flush(HotCache* cache);
+char hot_cache_close(HotCache* cache, size_t* lookups, size_t* hits);
+void hot_cache_free(HotCache* cache);
+
+#endif
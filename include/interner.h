@@ -0,0 +1,30 @@
+#ifndef INTERNER_H
+#define INTERNER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Words are numbered 0, 1, 2, ... in the order any worker first sees them
+typedef struct Interner Interner;
+
+// Counts of one worker indexed by word ID
+typedef struct IdCounter IdCounter;
+
+Interner* interner_create();
+size_t interner_size(Interner* interner);
+size_t interner_memory(Interner* interner);
+void interner_free(Interner* interner);
+
+IdCounter* id_counter_create(Interner* interner, const char* stream_path);
+char id_counter_add(IdCounter* counter, const char* word, size_t word_size);
+char id_counter_add_count(IdCounter* counter, const char* word, size_t word_size, uint64_t count);
+char id_counter_close_stream(IdCounter* counter);
+char id_counter_write_vocab(IdCounter* totals, const char* path);
+char id_counter_finish(IdCounter* counter);
+size_t id_counter_size(IdCounter* counter);
+size_t id_counter_memory(IdCounter* counter);
+char id_counter_get(IdCounter* counter, size_t index, const char** word, uint64_t* count);
+IdCounter* id_counter_merge(IdCounter* a, IdCounter* b);
+void id_counter_free(IdCounter* counter);
+
+#endif
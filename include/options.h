@@ -0,0 +1,53 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include "chunk_reader.h"
+#include "dict.h"
+#include "word_filter.h"
+
+#define DEFAULT_DICT_PATH "data.bin"
+
+// Appended to the ID stream path to name its vocabulary
+#define ID_VOCAB_SUFFIX ".vocab"
+
+// Order of printed words
+typedef enum SortOrder {
+    SORT_WORD, // Lexicographic, through the dictionary file
+    SORT_COUNT // Descending count, ties in word order
+} SortOrder;
+
+// Settings parsed from the command line
+typedef struct Options {
+    char* filepath; // Text file to count
+    IoBackend io; // Backend used to read chunks
+    ReadMode read_mode; // Whether chunk reads go through the page cache
+    char stats; // Report timing and throughput on stderr
+    char perf; // Report hardware counters per thread and phase on stderr
+    int threads; // Reading threads, 0 chooses from file size
+    Engine engine; // Data structure words are counted in
+    char auto_engine; // Pick engine from sampled vocabulary instead
+    int ngram; // Tokens per counted key, 1 counts words
+    char reduce; // Merge dictionaries pairwise in parallel before writing
+    char* cache_dir; // Result cache, NULL when disabled
+    long long cache_size; // Bytes the cache may hold
+    SortOrder sort; // Order words are printed in
+    char stream; // Print words as they are merged instead of through the dictionary
+    char* output; // Printed words, NULL for stdout
+    char* dict_path; // Binary dictionary, NULL when printing directly without one
+    char* include_file; // Only words listed here are counted
+    char* exclude_file; // Words listed here are not counted
+    const WordFilter* filter; // Built by count_words from the word lists
+    char hot_cache; // Count repeated words per thread before the dictionary, on engines it helps
+    char* checkpoint_dir; // Segment dictionaries saved as counted, NULL counts in one piece
+    long long segment_size; // Input bytes per saved segment
+    char* follow_dir; // Counts of a growing input kept between runs, NULL counts it whole
+    char compress_dict; // Write the dictionary as front-coded blocks, see dict_file.c
+    char* id_stream; // Token IDs written here in input order with the ID engine, NULL when not kept
+    Interner* interner; // Created by count_words for the ID engine
+} Options;
+
+void options_init(Options* opts);
+char options_parse(Options* opts, int argc, char* argv[]);
+void options_usage(const char* prog);
+
+#endif
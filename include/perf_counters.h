@@ -0,0 +1,42 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Pipeline phases counted separately
+typedef enum PerfPhase {
+    PERF_DECODE, // Decompressing input for tokenizer threads
+    PERF_COUNT, // Tokenizing and inserting words
+    PERF_MERGE, // Combining dictionaries in word order
+    PERF_SORT, // Ordering merged words by count
+    PERF_WRITE, // Writing the dictionary file
+    PERF_PRINT, // Printing words
+    PERF_PHASES
+} PerfPhase;
+
+// Hardware events opened for every phase
+typedef enum PerfEvent {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_EVENTS
+} PerfEvent;
+
+// Counters of one thread in one phase, all fds -1 when profiling is off
+typedef struct PerfCounters {
+    PerfPhase phase;
+    int fds[PERF_EVENTS];
+    double start;
+} PerfCounters;
+
+double now_seconds();
+void perf_enable(char enable);
+void perf_begin(PerfCounters* counters, PerfPhase phase);
+void perf_end(PerfCounters* counters);
+void perf_set_tokens(unsigned long long num_tokens);
+void perf_report(FILE* out);
+
+#endif
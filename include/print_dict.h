@@ -1,6 +1,12 @@
 #ifndef PRINT_DICT_H
 #define PRINT_DICT_H
 
-char print_dict();
+#include <stdio.h>
+#include "dict_file.h"
+
+FILE* output_open(const char* path);
+char output_close(FILE* out);
+char print_dict(const char* dict_path, const char* out_path);
+char print_dict_stats(const char* dict_path, const char* out_path, DictReadStats* stats);
 
 #endif
\ No newline at end of file
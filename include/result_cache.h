@@ -0,0 +1,14 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+// Room for the hex name of a cache entry
+#define CACHE_KEY_SIZE 96
+
+char cache_key(const char* filepath, const struct stat* st, char* key);
+char cache_fetch(const char* dir, const char* key, const char* dest);
+char cache_store(const char* dir, const char* key, const char* src, long long max_bytes);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SERVE_SOCKET "word_count.sock"
+
+// Request operations
+#define SERVE_LOOKUP 1 // Count of key
+#define SERVE_PREFIX 2 // Words starting with key, in order, at most limit
+#define SERVE_TOPK 3 // limit most frequent words
+
+// Response status
+#define SERVE_OK 0
+#define SERVE_BAD_REQUEST 1
+
+#define SERVE_MAX_KEY 4096
+#define SERVE_MAX_RESULTS 65536
+
+// Request header, followed by key_len key bytes
+typedef struct ServeRequest {
+    uint8_t op;
+    uint8_t reserved[3];
+    uint32_t limit;
+    uint32_t key_len;
+} ServeRequest;
+
+// Response header, followed by length bytes holding num_entries
+// entries of u64 count, u32 word length and the word bytes, packed
+typedef struct ServeResponse {
+    uint32_t status;
+    uint32_t num_entries;
+    uint32_t length;
+} ServeResponse;
+
+// Response as received by a client
+typedef struct ServeReply {
+    uint32_t status;
+    uint32_t num_entries;
+    char* data; // Packed entries
+    size_t len;
+    size_t capacity;
+} ServeReply;
+
+int serve_main(int argc, char* argv[]);
+
+int serve_connect(const char* socket_path);
+char serve_query(int fd, uint8_t op, uint32_t limit, const char* key, size_t key_len, ServeReply* reply);
+char serve_reply_next(const ServeReply* reply, size_t* pos, const char** word, uint32_t* word_len, uint64_t* count);
+void serve_reply_free(ServeReply* reply);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef SORT_DICT_H
+#define SORT_DICT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct SortDict SortDict;
+
+SortDict* sort_dict_create();
+char sort_dict_reserve(SortDict* dict, size_t num_tokens);
+char sort_dict_add(SortDict* dict, const char* word, size_t word_size);
+char sort_dict_add_count(SortDict* dict, const char* word, size_t word_size, uint64_t count);
+char sort_dict_finish(SortDict* dict);
+size_t sort_dict_size(SortDict* dict);
+size_t sort_dict_memory(SortDict* dict);
+char sort_dict_get(SortDict* dict, size_t index, const char** word, uint64_t* count);
+SortDict* sort_dict_merge(SortDict* a, SortDict* b);
+void sort_dict_free(SortDict* dict);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include <stddef.h>
+#include "dict.h"
+#include "hot_cache.h"
+#include "word_filter.h"
+
+#define WORD_BUF_SIZE 256
+
+// Longest n-gram counted, the window holds two full n-grams before compacting
+#define NGRAM_MAX 8
+#define NGRAM_WINDOW_SIZE (2 * NGRAM_MAX * WORD_BUF_SIZE)
+
+// Tracks a word being read across buffer boundaries
+typedef struct WordScanner {
+    Dict* dict; // Dictionary words are counted in
+    const WordFilter* filter; // Words it doesn't keep are skipped, NULL keeps all
+    HotCache* cache; // Absorbs repeated words before dict, NULL adds them directly
+
+    char word[WORD_BUF_SIZE];
+    size_t len;
+    char in_word; // Previous character was part of a word
+    char skip; // Skipping partial word owned by previous section
+    char saw_space; // Any delimiter seen
+    char word_owned; // Current word starts before the section end
+    char error; // A word failed to count or a head to grow, counts are incomplete
+
+    // Last tokens packed with single spaces, counted as n-grams when ngram > 1
+    int ngram;
+    char window[NGRAM_WINDOW_SIZE];
+    size_t window_len;
+    size_t token_start[NGRAM_MAX];
+    char token_owned[NGRAM_MAX];
+    int window_count;
+
+    // Skipped partial word, kept when scanning blocks of a stream
+    char keep_head;
+    char* head;
+    size_t head_len;
+    size_t head_capacity;
+} WordScanner;
+
+void scanner_init(WordScanner* scan, Dict* dict);
+char scanner_feed(WordScanner* scan, const char* data, size_t len, long offset, long end);
+char scanner_finish(WordScanner* scan);
+void scanner_free(WordScanner* scan);
+
+#endif
\ No newline at end of file
@@ -8,15 +8,29 @@
 typedef struct Tree Tree;
 typedef struct TreeIter TreeIter;
 
+// Item returned by a batched iterator, pointers are owned by the tree
+typedef struct TreeEntry {
+    const void* key;
+    size_t key_size;
+    const void* val;
+} TreeEntry;
+
 Tree* tree_create(int (*compare)(const void*, const void*));
 char tree_set(Tree* tree, const void* key, const size_t key_size, int (*set_val)(void**, size_t*));
+void* tree_get(Tree* tree, const void* key);
+void* tree_upsert(Tree* tree, const void* key, const size_t key_size, const size_t val_size);
 uint32_t tree_size(Tree* tree);
+size_t tree_memory(Tree* tree);
+Tree* tree_merge(Tree* a, Tree* b, int (*merge_val)(void**, size_t*, void*, size_t));
 void tree_print(Tree* tree, void (*print)(const void*, const void*, const size_t, const size_t));
 void tree_free(Tree* tree);
 TreeIter* tree_iter_create(Tree* tree);
+TreeIter* tree_drain_create(Tree* tree);
 void tree_free(Tree* tree);
 char tree_iter_has_next(TreeIter* tree_iter);
 char tree_iter_next(TreeIter* tree_iter, void** key, size_t* key_size, void** val, size_t* val_size);
+size_t tree_iter_next_batch(TreeIter* tree_iter, TreeEntry* entries, size_t max);
+char tree_iter_seek(TreeIter* tree_iter, const void* key);
 void tree_iter_free(TreeIter* tree_iter);
 
 #ifdef TEST
@@ -0,0 +1,22 @@
+#ifndef VOCAB_ESTIMATE_H
+#define VOCAB_ESTIMATE_H
+
+#include <stddef.h>
+
+// Vocabulary of a file estimated from sampled chunks
+typedef struct VocabEstimate {
+    size_t num_tokens; // Keys counted in the whole file
+    size_t num_distinct; // Distinct keys in the whole file
+    size_t key_size; // Mean key size, including terminating null
+    double growth; // Exponent of distinct keys over tokens, Heaps' law
+
+    int num_samples;
+    size_t sample_bytes; // Bytes tokenized
+    size_t sample_tokens; // Keys seen in samples
+    size_t sample_distinct; // HyperLogLog count of distinct keys in samples
+} VocabEstimate;
+
+char vocab_estimate(const char* filepath, long file_size, int ngram, VocabEstimate* est);
+size_t vocab_distinct_at(const VocabEstimate* est, size_t num_tokens);
+
+#endif
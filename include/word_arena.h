@@ -0,0 +1,27 @@
+#ifndef WORD_ARENA_H
+#define WORD_ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE (1024 * 1024)
+
+// Block of word bytes
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t used;
+    size_t size;
+    char data[];
+} ArenaBlock;
+
+// Words copied into blocks freed all at once, zero initialized when empty
+typedef struct WordArena {
+    ArenaBlock* blocks; // Most recent block first
+    size_t size; // Bytes of all blocks
+    size_t block_size; // Bytes of a new block, 0 for ARENA_BLOCK_SIZE
+} WordArena;
+
+char* word_arena_copy(WordArena* arena, const char* word, size_t word_size);
+void word_arena_take(WordArena* arena, WordArena* other);
+void word_arena_free(WordArena* arena);
+
+#endif
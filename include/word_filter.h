@@ -0,0 +1,26 @@
+#ifndef WORD_FILTER_H
+#define WORD_FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct PerfectHash PerfectHash;
+
+// Words kept by the tokenizer, checked before they reach the dictionary
+typedef struct WordFilter {
+    PerfectHash* include; // Only these words are counted, NULL counts all
+    PerfectHash* exclude; // These words are never counted, NULL drops none
+    uint64_t id; // Hash of both word sets, identifies the filter in cache keys
+} WordFilter;
+
+PerfectHash* perfect_hash_create(const char** words, size_t num_words);
+size_t perfect_hash_size(const PerfectHash* hash);
+char perfect_hash_contains(const PerfectHash* hash, const char* word, size_t len);
+void perfect_hash_free(PerfectHash* hash);
+
+WordFilter* word_filter_create(const char** include, size_t num_include, const char** exclude, size_t num_exclude);
+WordFilter* word_filter_load(const char* include_path, const char* exclude_path);
+char word_filter_keep(const WordFilter* filter, const char* word, size_t len);
+void word_filter_free(WordFilter* filter);
+
+#endif
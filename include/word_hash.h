@@ -0,0 +1,45 @@
+#ifndef WORD_HASH_H
+#define WORD_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Up to eight leading bytes of word packed little endian
+static inline uint64_t word_prefix(const char* word, size_t len) {
+    uint64_t v = 0;
+
+    if(len >= 8) {
+        memcpy(&v, word, 8);
+        return v;
+    }
+
+    for(size_t i = 0; i < len; i++) // A variable memcpy would be a call
+        v |= (uint64_t)(unsigned char)word[i] << (8 * i);
+
+    return v;
+}
+
+
+// Hash of word, eight bytes at a time, salt picks one of a family of hashes
+static inline uint64_t word_hash(const char* word, size_t len, uint64_t salt) {
+    uint64_t h = salt ^ (len * 0x9e3779b97f4a7c15ULL);
+
+    while(len >= 8) {
+        uint64_t v;
+        memcpy(&v, word, 8);
+        h = (h ^ v) * 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 31;
+        word += 8;
+        len -= 8;
+    }
+
+    h = (h ^ word_prefix(word, len)) * 0x94d049bb133111ebULL;
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 32;
+
+    return h;
+}
+
+#endif
@@ -0,0 +1,697 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "../include/art.h"
+
+// Adaptive radix tree mapping byte strings to counters. Keys must be
+// prefix free, callers pass words with their terminating NUL. Inner
+// nodes store their whole compressed path and leaves only the key bytes
+// below them, so memory follows the distinct suffixes of the keys.
+
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+// Inner node types
+#define NODE4 0
+#define NODE16 1
+#define NODE48 2
+#define NODE256 3
+
+// Leaves are tagged pointers in the child slots
+#define IS_LEAF(p) ((uintptr_t)(p) & 1)
+#define AS_LEAF(p) ((Leaf*)((uintptr_t)(p) & ~(uintptr_t)1))
+#define TAG_LEAF(p) ((void*)((uintptr_t)(p) | 1))
+
+typedef struct {
+    uint64_t count;
+    uint32_t suffix_len; // Key bytes below the leaf's position
+    unsigned char suffix[];
+} Leaf;
+
+// Header shared by inner nodes, the compressed path follows the node
+typedef struct {
+    uint8_t type;
+    uint16_t num_children;
+    uint32_t prefix_len;
+} Node;
+
+typedef struct {
+    Node n;
+    unsigned char keys[4]; // Sorted
+    void* children[4];
+} Node4;
+
+typedef struct {
+    Node n;
+    unsigned char keys[16]; // Sorted
+    void* children[16];
+} Node16;
+
+typedef struct {
+    Node n;
+    unsigned char index[256]; // Child slot + 1, 0 if absent
+    void* children[48];
+} Node48;
+
+typedef struct {
+    Node n;
+    void* children[256];
+} Node256;
+
+static const size_t node_sizes[] = {sizeof(Node4), sizeof(Node16), sizeof(Node48), sizeof(Node256)};
+
+struct ArtTree {
+    void* root;
+    size_t size; // Number of keys
+    size_t memory; // Bytes allocated for nodes and leaves
+};
+
+// Position of the iterator in one inner node
+typedef struct {
+    Node* node;
+    int pos; // Next key byte (Node48, Node256) or slot (Node4, Node16)
+    size_t key_len; // Key bytes up to and including node's prefix
+} IterFrame;
+
+struct ArtIter {
+    void* root;
+    char started;
+    char drain; // Iterator owns the nodes and frees them once passed
+
+    IterFrame* stack;
+    size_t stack_size;
+    size_t stack_capacity;
+
+    unsigned char* key; // Key of current path
+    size_t key_capacity;
+};
+
+
+static unsigned char* node_prefix(Node* node) {
+    return (unsigned char*)node + node_sizes[node->type];
+}
+
+
+static Node* node_create(ArtTree* tree, uint8_t type, const unsigned char* prefix, uint32_t prefix_len) {
+    size_t size = node_sizes[type] + prefix_len;
+    Node* node = calloc(1, size);
+
+    if(!node) // Allocation failed
+        return NULL;
+
+    node->type = type;
+    node->prefix_len = prefix_len;
+    memcpy(node_prefix(node), prefix, prefix_len);
+    tree->memory += size;
+
+    return node;
+}
+
+
+static Leaf* leaf_create(ArtTree* tree, const unsigned char* suffix, size_t suffix_len) {
+    size_t size = sizeof(Leaf) + suffix_len;
+    Leaf* leaf = malloc(size);
+
+    if(!leaf) // Allocation failed
+        return NULL;
+
+    leaf->count = 0;
+    leaf->suffix_len = suffix_len;
+    memcpy(leaf->suffix, suffix, suffix_len);
+    tree->memory += size;
+
+    return leaf;
+}
+
+
+ArtTree* art_create() {
+    ArtTree* tree = malloc(sizeof(ArtTree)); // Allocate memory
+
+    if(!tree) // Allocation failed
+        return NULL;
+
+    // Initialize fields
+    tree->root = NULL;
+    tree->size = 0;
+    tree->memory = sizeof(ArtTree);
+
+    return tree;
+}
+
+
+// Find slot of child under byte c, NULL if absent
+static void** find_child(Node* node, unsigned char c) {
+    switch(node->type) {
+        case NODE4: {
+            Node4* n = (Node4*)node;
+
+            for(int i = 0; i < node->num_children; i++) {
+                if(n->keys[i] == c)
+                    return &n->children[i];
+            }
+
+            return NULL;
+        }
+        case NODE16: {
+            Node16* n = (Node16*)node;
+
+            #ifdef __SSE2__
+            // Compare all keys at once
+            __m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8(c), _mm_loadu_si128((__m128i*)n->keys));
+            int mask = _mm_movemask_epi8(cmp) & ((1 << node->num_children) - 1);
+
+            if(mask)
+                return &n->children[__builtin_ctz(mask)];
+            #else
+            for(int i = 0; i < node->num_children; i++) {
+                if(n->keys[i] == c)
+                    return &n->children[i];
+            }
+            #endif
+
+            return NULL;
+        }
+        case NODE48: {
+            Node48* n = (Node48*)node;
+
+            if(n->index[c])
+                return &n->children[n->index[c] - 1];
+
+            return NULL;
+        }
+        default: {
+            Node256* n = (Node256*)node;
+
+            if(n->children[c])
+                return &n->children[c];
+
+            return NULL;
+        }
+    }
+}
+
+
+// Insert into sorted key and child arrays with room for one more
+static void insert_sorted(unsigned char* keys, void** children, int num_children, unsigned char c, void* child) {
+    int pos = 0;
+
+    while(pos < num_children && keys[pos] < c)
+        pos++;
+
+    memmove(keys + pos + 1, keys + pos, num_children - pos);
+    memmove(children + pos + 1, children + pos, (num_children - pos) * sizeof(void*));
+
+    keys[pos] = c;
+    children[pos] = child;
+}
+
+
+// Replace node with a larger type holding the same children
+static Node* node_grow(ArtTree* tree, Node* node) {
+    Node* grown = node_create(tree, node->type + 1, node_prefix(node), node->prefix_len);
+
+    if(!grown) // Allocation failed
+        return NULL;
+
+    grown->num_children = node->num_children;
+
+    switch(node->type) {
+        case NODE4: {
+            Node4* old = (Node4*)node;
+            Node16* n = (Node16*)grown;
+
+            memcpy(n->keys, old->keys, 4);
+            memcpy(n->children, old->children, 4 * sizeof(void*));
+            break;
+        }
+        case NODE16: {
+            Node16* old = (Node16*)node;
+            Node48* n = (Node48*)grown;
+
+            for(int i = 0; i < 16; i++) {
+                n->index[old->keys[i]] = i + 1;
+                n->children[i] = old->children[i];
+            }
+            break;
+        }
+        default: {
+            Node48* old = (Node48*)node;
+            Node256* n = (Node256*)grown;
+
+            for(int c = 0; c < 256; c++) {
+                if(old->index[c])
+                    n->children[c] = old->children[old->index[c] - 1];
+            }
+            break;
+        }
+    }
+
+    tree->memory -= node_sizes[node->type] + node->prefix_len;
+    free(node);
+
+    return grown;
+}
+
+
+// Add child under byte c, growing node in *ref when full
+static char add_child(ArtTree* tree, void** ref, Node* node, unsigned char c, void* child) {
+    static const int capacity[] = {4, 16, 48, 256};
+
+    if(node->num_children == capacity[node->type]) { // Node full
+        node = node_grow(tree, node);
+
+        if(!node) // Allocation failed
+            return 0;
+
+        *ref = node;
+    }
+
+    switch(node->type) {
+        case NODE4: {
+            Node4* n = (Node4*)node;
+            insert_sorted(n->keys, n->children, node->num_children, c, child);
+            break;
+        }
+        case NODE16: {
+            Node16* n = (Node16*)node;
+            insert_sorted(n->keys, n->children, node->num_children, c, child);
+            break;
+        }
+        case NODE48: {
+            Node48* n = (Node48*)node;
+            n->children[node->num_children] = child; // Nodes never shrink, slots fill in order
+            n->index[c] = node->num_children + 1;
+            break;
+        }
+        default: {
+            Node256* n = (Node256*)node;
+            n->children[c] = child;
+            break;
+        }
+    }
+
+    node->num_children++;
+
+    return 1;
+}
+
+
+// Replace *ref with a Node4 splitting existing bytes and key after common bytes
+static uint64_t* split(ArtTree* tree, void** ref, unsigned char* existing, uint32_t* existing_len,
+                       const unsigned char* key, size_t key_len, size_t common) {
+    Node4* parent = (Node4*)node_create(tree, NODE4, existing, common);
+    Leaf* leaf = leaf_create(tree, key + common + 1, key_len - common - 1);
+
+    if(!parent || !leaf) { // Allocation failed
+        free(parent);
+        free(leaf);
+        return NULL;
+    }
+
+    // Existing node or leaf keeps the bytes after the split
+    unsigned char existing_byte = existing[common];
+    memmove(existing, existing + common + 1, *existing_len - common - 1);
+    *existing_len -= common + 1;
+
+    add_child(tree, NULL, &parent->n, existing_byte, *ref);
+    add_child(tree, NULL, &parent->n, key[common], TAG_LEAF(leaf));
+
+    *ref = parent;
+    tree->size++;
+
+    return &leaf->count;
+}
+
+
+// Find or add key, returns its counter (0 when new)
+uint64_t* art_upsert(ArtTree* tree, const unsigned char* key, size_t key_size) {
+    if(!tree || !key || key_size == 0)
+        return NULL; // Invalid input
+
+    void** ref = &tree->root;
+    size_t depth = 0;
+
+    while(1) {
+        void* slot = *ref;
+
+        if(!slot) { // Empty tree
+            Leaf* leaf = leaf_create(tree, key + depth, key_size - depth);
+
+            if(!leaf) // Allocation failed
+                return NULL;
+
+            *ref = TAG_LEAF(leaf);
+            tree->size++;
+
+            return &leaf->count;
+        }
+
+        size_t rest = key_size - depth;
+
+        if(IS_LEAF(slot)) {
+            Leaf* leaf = AS_LEAF(slot);
+            size_t limit = MIN(leaf->suffix_len, rest);
+            size_t common = 0;
+
+            while(common < limit && leaf->suffix[common] == key[depth + common])
+                common++;
+
+            if(common == rest && common == leaf->suffix_len) // Key found
+                return &leaf->count;
+
+            if(common == limit) // One key is a prefix of the other
+                return NULL;
+
+            return split(tree, ref, leaf->suffix, &leaf->suffix_len, key + depth, rest, common);
+        }
+
+        Node* node = (Node*)slot;
+
+        if(node->prefix_len) { // Match compressed path
+            unsigned char* prefix = node_prefix(node);
+            size_t limit = MIN(node->prefix_len, rest);
+            size_t common = 0;
+
+            while(common < limit && prefix[common] == key[depth + common])
+                common++;
+
+            if(common < node->prefix_len) { // Key leaves the path inside the prefix
+                if(common == rest)
+                    return NULL;
+
+                return split(tree, ref, prefix, &node->prefix_len, key + depth, rest, common);
+            }
+
+            depth += node->prefix_len;
+        }
+
+        if(depth >= key_size) // Key is a prefix of others
+            return NULL;
+
+        void** child = find_child(node, key[depth]);
+
+        if(child) { // Descend
+            ref = child;
+            depth++;
+            continue;
+        }
+
+        // New leaf below node
+        Leaf* leaf = leaf_create(tree, key + depth + 1, key_size - depth - 1);
+
+        if(!leaf || !add_child(tree, ref, node, key[depth], TAG_LEAF(leaf))) {
+            free(leaf);
+            return NULL;
+        }
+
+        tree->size++;
+
+        return &leaf->count;
+    }
+}
+
+
+size_t art_size(ArtTree* tree) {
+    if(!tree)
+        return 0;
+
+    return tree->size;
+}
+
+
+size_t art_memory(ArtTree* tree) {
+    if(!tree)
+        return 0;
+
+    return tree->memory;
+}
+
+
+static void node_free(void* slot) {
+    if(!slot) // Empty slot
+        return;
+
+    if(IS_LEAF(slot)) {
+        free(AS_LEAF(slot));
+        return;
+    }
+
+    Node* node = (Node*)slot;
+
+    switch(node->type) {
+        case NODE4:
+            for(int i = 0; i < node->num_children; i++)
+                node_free(((Node4*)node)->children[i]);
+            break;
+        case NODE16:
+            for(int i = 0; i < node->num_children; i++)
+                node_free(((Node16*)node)->children[i]);
+            break;
+        case NODE48:
+            for(int i = 0; i < node->num_children; i++)
+                node_free(((Node48*)node)->children[i]);
+            break;
+        default:
+            for(int c = 0; c < 256; c++)
+                node_free(((Node256*)node)->children[c]);
+            break;
+    }
+
+    free(node);
+}
+
+
+void art_free(ArtTree* tree) {
+    if(!tree) // Ensure tree is not null
+        return;
+
+    node_free(tree->root);
+    free(tree);
+}
+
+
+ArtIter* art_iter_create(ArtTree* tree) {
+    if(!tree) // Ensure non-null input
+        return NULL;
+
+    ArtIter* iter = calloc(1, sizeof(ArtIter));
+
+    if(!iter) // Allocation failed
+        return NULL;
+
+    iter->root = tree->root;
+
+    return iter;
+}
+
+
+// Iterator that takes the nodes of tree and frees them as it passes
+// them, tree is left empty
+ArtIter* art_drain_create(ArtTree* tree) {
+    ArtIter* iter = art_iter_create(tree);
+
+    if(!iter) // Allocation failed
+        return NULL;
+
+    iter->drain = 1;
+
+    // Nodes now belong to the iterator
+    tree->root = NULL;
+    tree->size = 0;
+    tree->memory = 0;
+
+    return iter;
+}
+
+
+static char iter_reserve_key(ArtIter* iter, size_t len) {
+    if(len <= iter->key_capacity)
+        return 1;
+
+    size_t new_capacity = iter->key_capacity ? iter->key_capacity : 256;
+
+    while(new_capacity < len)
+        new_capacity *= 2;
+
+    unsigned char* new_key = realloc(iter->key, new_capacity);
+
+    if(!new_key) // Allocation failed
+        return 0;
+
+    iter->key = new_key;
+    iter->key_capacity = new_capacity;
+
+    return 1;
+}
+
+
+// Enter inner node whose path starts at key_len
+static char iter_push(ArtIter* iter, Node* node, size_t key_len) {
+    if(iter->stack_size == iter->stack_capacity) { // Grow stack
+        size_t new_capacity = iter->stack_capacity ? iter->stack_capacity * 2 : 32;
+        IterFrame* new_stack = realloc(iter->stack, new_capacity * sizeof(IterFrame));
+
+        if(!new_stack) // Allocation failed
+            return 0;
+
+        iter->stack = new_stack;
+        iter->stack_capacity = new_capacity;
+    }
+
+    if(!iter_reserve_key(iter, key_len + node->prefix_len + 1))
+        return 0;
+
+    memcpy(iter->key + key_len, node_prefix(node), node->prefix_len);
+
+    IterFrame* frame = &iter->stack[iter->stack_size++];
+    frame->node = node;
+    frame->pos = 0;
+    frame->key_len = key_len + node->prefix_len;
+
+    return 1;
+}
+
+
+// Next child of frame in byte order, NULL when done
+static void* iter_next_child(IterFrame* frame, unsigned char* c) {
+    Node* node = frame->node;
+
+    switch(node->type) {
+        case NODE4:
+        case NODE16: {
+            if(frame->pos >= node->num_children)
+                return NULL;
+
+            unsigned char* keys = node->type == NODE4 ? ((Node4*)node)->keys : ((Node16*)node)->keys;
+            void** children = node->type == NODE4 ? ((Node4*)node)->children : ((Node16*)node)->children;
+
+            *c = keys[frame->pos];
+
+            return children[frame->pos++];
+        }
+        case NODE48: {
+            Node48* n = (Node48*)node;
+
+            while(frame->pos < 256 && !n->index[frame->pos])
+                frame->pos++;
+
+            if(frame->pos == 256)
+                return NULL;
+
+            *c = frame->pos;
+
+            return n->children[n->index[frame->pos++] - 1];
+        }
+        default: {
+            Node256* n = (Node256*)node;
+
+            while(frame->pos < 256 && !n->children[frame->pos])
+                frame->pos++;
+
+            if(frame->pos == 256)
+                return NULL;
+
+            *c = frame->pos;
+
+            return n->children[frame->pos++];
+        }
+    }
+}
+
+
+// Emit leaf below key_len bytes of path
+static char iter_leaf(ArtIter* iter, Leaf* leaf, size_t key_len, const unsigned char** key, size_t* key_size, uint64_t* count) {
+    if(!iter_reserve_key(iter, key_len + leaf->suffix_len)) {
+        if(iter->drain) // Passed either way
+            free(leaf);
+        return 0;
+    }
+
+    memcpy(iter->key + key_len, leaf->suffix, leaf->suffix_len);
+
+    *key = iter->key;
+    *key_size = key_len + leaf->suffix_len;
+
+    if(count)
+        *count = leaf->count;
+
+    if(iter->drain) // Key was copied out, leaf is no longer needed
+        free(leaf);
+
+    return 1;
+}
+
+
+// Next key in byte order, key is valid until the next call
+char art_iter_next(ArtIter* iter, const unsigned char** key, size_t* key_size, uint64_t* count) {
+    if(!iter || !key || !key_size) // Ensure non-null inputs
+        return 0;
+
+    if(!iter->started) { // Start at root
+        iter->started = 1;
+
+        if(!iter->root)
+            return 0;
+
+        if(IS_LEAF(iter->root))
+            return iter_leaf(iter, AS_LEAF(iter->root), 0, key, key_size, count);
+
+        if(!iter_push(iter, iter->root, 0))
+            return 0;
+    }
+
+    while(iter->stack_size) {
+        IterFrame* frame = &iter->stack[iter->stack_size - 1];
+        unsigned char c;
+        void* child = iter_next_child(frame, &c);
+
+        if(!child) { // Node done
+            if(iter->drain)
+                free(frame->node);
+
+            iter->stack_size--;
+            continue;
+        }
+
+        size_t key_len = frame->key_len;
+        iter->key[key_len] = c;
+
+        if(IS_LEAF(child))
+            return iter_leaf(iter, AS_LEAF(child), key_len + 1, key, key_size, count);
+
+        if(!iter_push(iter, child, key_len + 1)) {
+            if(iter->drain) // Passed either way
+                node_free(child);
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
+
+void art_iter_free(ArtIter* iter) {
+    if(!iter) // Ensure non-null input
+        return;
+
+    if(iter->drain && !iter->started) { // Nothing was passed
+        node_free(iter->root);
+    } else if(iter->drain) { // Free children not reached yet, then the stacked nodes
+        while(iter->stack_size) {
+            IterFrame* frame = &iter->stack[--iter->stack_size];
+            unsigned char c;
+            void* child;
+
+            while((child = iter_next_child(frame, &c)))
+                node_free(child);
+
+            free(frame->node);
+        }
+    }
+
+    free(iter->stack);
+    free(iter->key);
+    free(iter);
+}
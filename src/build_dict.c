@@ -1,14 +1,26 @@
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <sys/stat.h>
-#include "../include/tree.h"
+#include <sys/resource.h>
+#include "../include/dict.h"
+#include "../include/chunk_reader.h"
+#include "../include/tokenizer.h"
 #include "../include/word_queue.h"
+#include "../include/options.h"
 #include "../include/build_dict.h"
-
-#define FILE_OUT "data.bin"
+#include "../include/compressed.h"
+#include "../include/result_cache.h"
+#include "../include/count_order.h"
+#include "../include/vocab_estimate.h"
+#include "../include/print_dict.h"
+#include "../include/dict_writer.h"
+#include "../include/perf_counters.h"
+#include "../include/hot_cache.h"
+#include "../include/checkpoint.h"
 
 
 // Holds parameters passed to each reading thread
@@ -22,10 +34,66 @@ typedef struct {
 
     // Determine if should read first word
     char read_first;
+
+    // Requested backend, replaced by backend used
+    IoBackend io;
+
+    // Requested page cache use, replaced by the mode reads ended in
+    ReadMode read_mode;
+
+    // Data structure words are counted in
+    Engine engine;
+
+    // Tokens per counted key
+    int ngram;
+
+    // Words skipped before they reach the dictionary, NULL keeps all
+    const WordFilter* filter;
+
+    // Count repeated words in a hot-word cache before the dictionary
+    char hot_cache;
+
+    // Numbers words for the ID engine, NULL for the others
+    Interner* interner;
+
+    // Token IDs of the section written here in input order, NULL when not kept
+    char* id_stream;
+
+    // Expected keys of the section, 0 when unknown
+    size_t reserve_tokens;
+    size_t reserve_distinct;
+    size_t key_size;
+
+    // Bytes read by thread
+    size_t bytes_read;
+
+    // Keys seen and absorbed by the hot-word cache
+    size_t cache_lookups;
+    size_t cache_hits;
 } ThreadArgs;
 
 
-#define WORD_BUF_SIZE 256
+// Words read ahead from each dictionary during the merge
+#define MERGE_BATCH_SIZE 64
+
+// Bytes copied at a time when joining the ID streams of sections
+#define ID_STREAM_COPY_SIZE (256 * 1024)
+
+// Dictionary being merged with its read-ahead words
+typedef struct {
+    DictIter* iter;
+    DictEntry entries[MERGE_BATCH_SIZE];
+    size_t pos;
+    size_t len;
+} MergeSource;
+
+
+// Smallest section worth a thread of its own
+#define MIN_BYTES_PER_THREAD (1024 * 1024)
+#define MIN_TOKENS_PER_THREAD (128 * 1024)
+
+// Share of distinct keys above which sorting tokens beats searching for them
+#define SORT_DISTINCT_RATIO 0.5
 
 
 void print_word(const void* key, const void* val, const size_t key_size, const size_t val_size) {
@@ -41,42 +109,20 @@ int compare_str(const void* a, const void* b) {
 }
 
 
-char word_write(FILE* file, char* word, unsigned long long count) {
-    if(!file || !word)
-        return 0; 
-    // Write word length to file
-    size_t len = strlen(word);
-    size_t len_write = fwrite(&len, sizeof(len), 1, file);
-
-    // Write word and count to file
-    size_t word_write = fwrite(word, sizeof(char), len, file);
-    size_t count_write = fwrite(&count, sizeof(count), 1, file);
+// Next word of a merged dictionary, refilling its batch when empty
+static char* source_next(MergeSource* source, unsigned long long* count) {
+    if(source->pos == source->len) {
+        source->len = dict_iter_next_batch(source->iter, source->entries, MERGE_BATCH_SIZE);
+        source->pos = 0;
 
-    // Ensure correct number of bytes were written
-    if(len_write != 1) // Check word size
-        return 0; //
-    if(word_write != strlen(word)) // Check word
-        return 0;
-    if(count_write != 1) //Check count
-        return 0;
-
-    return 1;
-}
-
-
-char* tree_iter_get(TreeIter* iter, unsigned long long* count) {
-    void* word_ptr;
-    void* count_ptr;
-
-    // Attempt to get the next item
-    if (!tree_iter_next(iter, &word_ptr, NULL, &count_ptr, NULL)) {
-        return NULL;  // No more items
+        if(source->len == 0) // Dictionary exhausted
+            return NULL;
     }
 
-    if(count != NULL) // Assign count
-        *count = *(unsigned long long*)count_ptr;
+    DictEntry* entry = &source->entries[source->pos++];
+    *count = entry->count;
 
-    return (char*)word_ptr;
+    return (char*)entry->word;
 }
 
 
@@ -100,14 +146,47 @@ int set_word_count(void** val, size_t* val_size) {
 }
 
 
-char write_dict(Tree** dicts, int num_cores) {
-    FILE* file = fopen(FILE_OUT, "wb"); // Open file to write
+// Pass to tree merge to add the count of a word found in both trees
+int merge_word_count(void** val, size_t* val_size, void* other, size_t other_size) {
+    (void)val_size;
+    (void)other_size;
+
+    *(unsigned long long*)(*val) += *(unsigned long long*)other;
+
+    return 1;
+}
+
+
+// Destinations of merged words, NULL when unused
+typedef struct {
+    DictWriter* dict; // Binary dictionary, written on its own thread
+    FILE* text; // Words printed as merged
+    CountOrder* order; // Words collected for printing by count
+} OutputSink;
+
+
+// Pass merged word to each destination
+static char output_sink(void* ctx, const char* word, unsigned long long count) {
+    OutputSink* out = (OutputSink*)ctx;
 
-    if(!file) // File failed to open
+    if(out->dict && !dict_writer_add(out->dict, word, count))
         return 0;
 
-    // Create array too hold tree iterators
-    TreeIter** next = malloc(num_cores * sizeof(TreeIter*));
+    if(out->text && fprintf(out->text, "%s: %llu\n", word, count) < 0)
+        return 0;
+
+    if(out->order && !count_order_add(out->order, word, count))
+        return 0;
+
+    return 1;
+}
+
+
+// Merge dictionaries in word order, passing each word and total count to sink.
+// Words are freed as they pass, afterwards dicts may only be freed.
+static char merge_dicts(Dict** dicts, int num_cores, WordSink sink, void* ctx) {
+    // Create array too hold dictionary iterators
+    MergeSource* next = calloc(num_cores, sizeof(MergeSource));
 
     if(!next) // Allocation failed
         return 0;
@@ -116,9 +195,9 @@ char write_dict(Tree** dicts, int num_cores) {
         if(!dicts[i]) // Only write if all tree's non-null
             return 0;
 
-        next[i] = tree_iter_create(dicts[i]); // Create tree iterator
+        next[i].iter = dict_drain_create(dicts[i]); // Create draining dictionary iterator
 
-        if(!next[i]) // Allocation failed
+        if(!next[i].iter) // Allocation failed
             return 0;
     }
 
@@ -130,10 +209,11 @@ char write_dict(Tree** dicts, int num_cores) {
 
     // Populate queue with word from each tree
     for(int i = 0; i < num_cores; i++) {
-        if(tree_iter_has_next(next[i])) {
-            // Get word and count
-            unsigned long long count;
-            char* word = tree_iter_get(next[i], &count);
+        // Get word and count
+        unsigned long long count;
+        char* word = source_next(&next[i], &count);
+
+        if(word) {
             word_queue_insert(word_queue, word, count, i);
 
             #ifdef DBG
@@ -154,11 +234,11 @@ char write_dict(Tree** dicts, int num_cores) {
         #endif
 
         // Add word from tree of next word to queue
-        if(tree_iter_has_next(next[index])) {
-            unsigned long long new_count;           
-            char* new_word = tree_iter_get(next[index], &new_count);
+        unsigned long long new_count;
+        char* new_word = source_next(&next[index], &new_count);
+
+        if(new_word)
             word_queue_insert(word_queue, new_word, new_count, index);
-        }
 
         #ifdef DBG
         char* test_word = word_queue_peak(word_queue);
@@ -184,15 +264,15 @@ char write_dict(Tree** dicts, int num_cores) {
             count += dup_count;
 
             // Add word from tree duplicate words tree to queue
-            if(tree_iter_has_next(next[index])) {
-                char* new_word = tree_iter_get(next[index], &dup_count);
+            char* new_word = source_next(&next[index], &dup_count);
+
+            if(new_word)
                 word_queue_insert(word_queue, new_word, dup_count, index);
-            }
         }
         
 
-        // Write word to file
-        if(!word_write(file, word, count))
+        // Pass word to sink
+        if(!sink(ctx, word, count))
             return 0;
 
         free(word);
@@ -201,16 +281,59 @@ char write_dict(Tree** dicts, int num_cores) {
     word_queue_free(word_queue); // Deallocate queue
 
     for(int i = 0; i < num_cores; i++)
-        tree_iter_free(next[i]); // Deallocate tree iterators
+        dict_iter_free(next[i].iter); // Deallocate dictionary iterators
 
-    free(next); // Deallocate array of tree iterators
-
-    fclose(file); // Close file
+    free(next); // Deallocate array of dictionary iterators
 
     return 1;
 }
 
 
+// Pass words of a single dictionary, already in order, to sink.
+// Words are freed as they pass, afterwards dict may only be freed.
+static char scan_dict(Dict* dict, WordSink sink, void* ctx) {
+    if(!dict) // Thread failed
+        return 0;
+
+    DictIter* iter = dict_drain_create(dict);
+
+    if(!iter) // Allocation failed
+        return 0;
+
+    char res = 1;
+    DictEntry entries[MERGE_BATCH_SIZE];
+    size_t len;
+
+    // Pass words in dictionary order
+    while(res && (len = dict_iter_next_batch(iter, entries, MERGE_BATCH_SIZE)) > 0) {
+        for(size_t i = 0; res && i < len; i++)
+            res = sink(ctx, entries[i].word, entries[i].count);
+    }
+
+    dict_iter_free(iter);
+
+    return res;
+}
+
+
+// Sink passing words on while totalling them
+typedef struct {
+    WordSink sink;
+    void* ctx;
+    size_t num_words;
+    unsigned long long num_tokens;
+} CountingSink;
+
+
+static char counting_sink(void* ctx, const char* word, unsigned long long count) {
+    CountingSink* counter = (CountingSink*)ctx;
+    counter->num_words++;
+    counter->num_tokens += count;
+
+    return counter->sink(counter->ctx, word, count);
+}
+
+
 void lowercase(char* word) {
     char* c = word;
 
@@ -221,195 +344,833 @@ void lowercase(char* word) {
 }
 
 
-// Read subsection of file and return Tree containing word count
+// Read subsection of file and return Dict containing word count
 void* thread_read(void* arg) {
     ThreadArgs* args = (ThreadArgs*)arg;
 
-    FILE* file = fopen(args->filepath, "r");
+    int fd = open(args->filepath, O_RDONLY);
 
-    if(!file)
+    if(fd < 0)
         return NULL;
-    
-    // Move position indicator to start of thread's subsection
-    if(fseek(file, args->start_offset, SEEK_SET)) {
-        fclose(file); // close file
-        return NULL; // fseek failed
-    }
 
     #ifdef DBG
     printf("Thread scanning section from offset %ld to %ld:\n", args->start_offset, args->end_offset);
-    long cur_pos = ftell(file);
-    if (cur_pos == -1) return NULL;
-
-    fseek(file, args->start_offset, SEEK_SET);
 
     char* buffer = malloc(args->end_offset - args->start_offset + 1);
     if (!buffer) return NULL;
 
-    fread(buffer, 1, args->end_offset - args->start_offset, file);
-    buffer[args->end_offset - args->start_offset] = '\0';  // Null-terminate
+    ssize_t section_len = pread(fd, buffer, args->end_offset - args->start_offset, args->start_offset);
+    buffer[section_len > 0 ? section_len : 0] = '\0';  // Null-terminate
 
     printf("Thread section contents:\n%s\n", buffer);
     free(buffer);
+    #endif
 
-    // Return to where we were before printing section
-    fseek(file, cur_pos, SEEK_SET);
+    // Create dictionary to hold words, ID dictionaries share one numbering
+    Dict* dict = args->interner ? dict_create_ids(args->interner, args->id_stream) : dict_create(args->engine);
 
-    // Move position indicator to start of thread's subsection
-    if(fseek(file, args->start_offset, SEEK_SET))
-    return NULL; // fseek failed
-    #endif
-    
+    if(!dict) { // Allocation failed
+        close(fd);
+        return NULL;
+    }
 
-    char word[WORD_BUF_SIZE]; // Buffer for word
-    long pos = args->start_offset;  // Get starting position
-    char c; // hold chars
+    if(args->reserve_tokens) // Size for the estimated vocabulary up front
+        dict_reserve(dict, args->reserve_tokens, args->reserve_distinct, args->key_size);
 
-    if(!args->read_first) { // Dont skip for first thread
-        // Advance file pointer to first delimiter
-        while((c = fgetc(file)) != EOF) {
-            if(isspace(c))
-                break; // Delimiter found
+    WordScanner scan;
+    scanner_init(&scan, dict);
+    scan.ngram = args->ngram;
+    scan.filter = args->filter;
 
-            pos = ftell(file); // Get file pointer position
+    if(args->hot_cache) // Without a cache words go straight to dict
+        scan.cache = hot_cache_create(dict);
 
-            if(pos == -1) { // Error getting file position
-                fclose(file);
-                return NULL;
-            }
-                
-            if(pos > args->end_offset)
-                break; // No full words in section
+    if(!args->read_first) { // Dont skip for first thread
+        char prev;
+
+        // Word running into section belongs to previous thread
+        if(pread(fd, &prev, 1, args->start_offset - 1) != 1) {
+            hot_cache_free(scan.cache);
+            dict_free(dict);
+            close(fd);
+            return NULL;
         }
+
+        if(!isspace((unsigned char)prev))
+            scan.skip = 1;
     }
 
-    // Create tree to hold words
-    Tree* dict = tree_create(compare_str);
+    // Start reads of section
+    ChunkReader* reader = chunk_reader_create(fd, args->start_offset, args->end_offset, args->io, args->read_mode);
 
-    // Add words until end of file or section
-    while(1) {
-        // Get file pointer position
-        long word_start = ftell(file); 
+    if(!reader) {
+        hot_cache_free(scan.cache);
+        dict_free(dict);
+        close(fd);
+        return NULL;
+    }
+
+    const char* data;
+    size_t len;
+    long offset = args->start_offset;
+
+    // Add words until end of file or section, tokenizing while next reads are in flight
+    while(chunk_reader_next(reader, &data, &len)) {
+        if(!scanner_feed(&scan, data, len, offset, args->end_offset))
+            break; // End of section reached or a word failed to count
+
+        offset += len;
+    }
+
+    char counted = scanner_finish(&scan); // Word ended by end of file
+
+    // Cached counts belong to this section's dictionary
+    char flushed = hot_cache_close(scan.cache, &args->cache_lookups, &args->cache_hits);
+
+    // Report reads to caller
+    args->io = chunk_reader_backend(reader);
+    args->read_mode = chunk_reader_mode(reader);
+    args->bytes_read = chunk_reader_bytes_read(reader);
+
+    if(chunk_reader_error(reader) || !counted || !flushed || !dict_close_stream(dict)) { // Read, count or flush failed
+        dict_free(dict);
+        dict = NULL;
+    }
 
-        if(word_start >= args->end_offset)
-            break; // End of section reached
+    // Free reader and file
+    chunk_reader_free(reader);
+    close(fd);
+
+    return dict;
+}
+
+
+// Two dictionaries merged by one reduction thread
+typedef struct {
+    Dict* a;
+    Dict* b;
+    Dict* result;
+} MergePair;
+
+
+static void* merge_pair(void* arg) {
+    MergePair* pair = (MergePair*)arg;
+    pair->result = dict_merge(pair->a, pair->b);
+
+    return NULL;
+}
 
-        if(word_start == -1) {
-            fclose(file);
-            return NULL; // Error detected
+
+// Merge dictionaries pairwise in log2(num_dicts) parallel rounds into dicts[0]
+static char reduce_dicts(Dict** dicts, long num_dicts) {
+    MergePair* pairs = malloc((num_dicts / 2 + 1) * sizeof(MergePair));
+    pthread_t* thread_ids = malloc((num_dicts / 2 + 1) * sizeof(pthread_t));
+    char ok = pairs && thread_ids;
+
+    for(long step = 1; ok && step < num_dicts; step *= 2) {
+        long num_pairs = 0;
+
+        for(long i = 0; i + step < num_dicts; i += 2 * step) {
+            pairs[num_pairs].a = dicts[i];
+            pairs[num_pairs].b = dicts[i + step];
+            pthread_create(&thread_ids[num_pairs], NULL, merge_pair, &pairs[num_pairs]);
+            num_pairs++;
         }
 
-        // Read next word
-        int ret = fscanf(file, "%255s", word);
+        for(long p = 0; p < num_pairs; p++) {
+            pthread_join(thread_ids[p], NULL);
 
-        // End of file reached
-        if(ret == EOF)
-            break;
+            if(!pairs[p].result) { // Merge failed, both inputs are still owned by dicts
+                ok = 0;
+                continue;
+            }
 
-        // Record word in tree
-        tree_set(dict, word, strlen(word) + 1, set_word_count);
+            // Second dictionary was consumed by the merge
+            dicts[2 * step * p + step] = NULL;
+        }
     }
 
+    free(pairs);
+    free(thread_ids);
+
+    return ok;
+}
+
+
+// Choose number of reading threads from estimated tokens, or file size
+// when no estimate exists, unless overridden
+static long choose_threads(long file_size, const VocabEstimate* est, long num_cores, int requested) {
+    if(requested > 0) // User override
+        return requested;
+
+    long num_threads = est ? (long)(est->num_tokens / MIN_TOKENS_PER_THREAD) : file_size / MIN_BYTES_PER_THREAD;
+
+    if(num_threads > num_cores) // One thread per core at most
+        num_threads = num_cores;
+    if(num_threads < 1) // Small input fits in one chunk
+        num_threads = 1;
+
+    return num_threads;
+}
+
+
+// Choose engine from estimated vocabulary, searching engines win while
+// most tokens repeat a known word, sorting wins when most are new
+static Engine choose_engine(const VocabEstimate* est) {
+    if(est->num_tokens && (double)est->num_distinct / est->num_tokens > SORT_DISTINCT_RATIO)
+        return ENGINE_SORT;
+
+    return ENGINE_ART;
+}
+
+
+// Resident memory of the process in MiB, 0 if unknown
+static double resident_mib() {
+    FILE* file = fopen("/proc/self/statm", "r");
+    unsigned long size, resident = 0;
+
+    if(!file)
+        return 0;
+
+    if(fscanf(file, "%lu %lu", &size, &resident) != 2)
+        resident = 0;
 
-    // Free thread argument and file memory
-    free(arg);
     fclose(file);
 
+    return resident * (double)sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+}
+
+
+// Highest resident memory of the process so far in MiB
+static double peak_resident_mib() {
+    struct rusage usage;
+
+    if(getrusage(RUSAGE_SELF, &usage))
+        return 0;
+
+    return usage.ru_maxrss / 1024.0; // Reported in KiB
+}
+
+
+
+// Read section with the calling thread's counters
+static void* thread_count(void* arg) {
+    PerfCounters perf;
+    perf_begin(&perf, PERF_COUNT);
+
+    void* dict = thread_read(arg);
+
+    perf_end(&perf);
+
     return dict;
 }
 
 
+// Append the ID streams of sections after the first to the first, which
+// was written to the stream path itself, and remove them
+static char join_id_streams(ThreadArgs* thread_args, long num_threads) {
+    FILE* stream = fopen(thread_args[0].id_stream, "ab");
+    char* buf = malloc(ID_STREAM_COPY_SIZE);
+    char ok = stream && buf;
 
-char count_words(char* filepath) {
-    // Get number of logical cores available 
-    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    for(long i = 1; i < num_threads; i++) {
+        FILE* part = ok ? fopen(thread_args[i].id_stream, "rb") : NULL;
+        size_t len;
 
-    #ifdef DBG
-    printf("Cores Available: %ld\n", num_cores);
-    #endif
+        ok = part != NULL;
 
-    // System error
-    if(num_cores < 1) {
-        // Terminate program
-        perror("sysconf");
-        exit(1);
+        while(ok && (len = fread(buf, 1, ID_STREAM_COPY_SIZE, part)) > 0)
+            ok = fwrite(buf, 1, len, stream) == len;
+
+        if(part && ferror(part))
+            ok = 0;
+
+        if(part)
+            fclose(part);
+
+        unlink(thread_args[i].id_stream);
     }
 
-    // Get total filesize
-    struct stat st;
-    stat(filepath, &st);
+    if(stream && fclose(stream))
+        ok = 0;
+
+    free(buf);
+
+    return ok;
+}
+
 
+// Count bytes start to end of a plain text file in num_threads sections,
+// returns a Dict per section
+static Dict** count_plain(char* filepath, long file_size, long start, long end, long num_threads,
+                          const Options* opts, const VocabEstimate* est, ReadStats* stats) {
     // Get size of each subsection
-    long subsect_size = st.st_size / num_cores;
+    long subsect_size = (end - start) / num_threads;
 
     // Create array of each thread's ID
-    pthread_t* thread_ids = malloc(num_cores * sizeof(pthread_t));
+    pthread_t* thread_ids = malloc(num_threads * sizeof(pthread_t));
 
     // Create array to hold thread's return value
-    void** thread_results = malloc(num_cores * sizeof(Tree*));
+    void** thread_results = malloc(num_threads * sizeof(Dict*));
 
-    // Create a thread for each core
-    for(int i = 0; i < num_cores; i++) {
+    // Create array of each thread's arguments
+    ThreadArgs* thread_args = malloc(num_threads * sizeof(ThreadArgs));
+
+    if(!thread_ids || !thread_results || !thread_args) // Allocation failed
+        exit(1);
+
+    // Create a thread for each subsection
+    for(int i = 0; i < num_threads; i++) {
         // Define subsection offsets
-        long start_offset = i * subsect_size;
+        long start_offset = start + i * subsect_size;
         long end_offset;
 
         // Calculate end offset
-        if(i == num_cores - 1) // Assign final thread remainder of file
-            end_offset = st.st_size;
+        if(i == num_threads - 1) // Assign final thread remainder of range
+            end_offset = end;
         else // Assign fixed size chunk
-            end_offset = (i + 1) * subsect_size;
+            end_offset = start + (i + 1) * subsect_size;
         
-        // Allocate memory for thread arguments
-        ThreadArgs* args = malloc(sizeof(ThreadArgs));
-
-        if(!args) // Allocation failed
-            exit(1);
+        ThreadArgs* args = &thread_args[i];
 
         // Initialize ThreadArgs fields
         args->filepath = filepath;
         args->start_offset = start_offset;
         args->end_offset = end_offset;
         args->read_first = 0;
+        args->io = opts->io;
+        args->read_mode = opts->read_mode;
+        args->engine = opts->engine;
+        args->filter = opts->filter;
+        args->hot_cache = opts->hot_cache;
+        args->interner = opts->interner;
+        args->id_stream = NULL;
+        args->ngram = opts->ngram;
+        args->bytes_read = 0;
+        args->cache_lookups = 0;
+        args->cache_hits = 0;
+        args->reserve_tokens = 0;
+        args->reserve_distinct = 0;
+        args->key_size = 0;
+
+        if(est && est->num_tokens) { // Expect a share of tokens proportional to the section
+            args->reserve_tokens = est->num_tokens * (end_offset - start_offset) / (file_size ? file_size : 1);
+            args->reserve_distinct = vocab_distinct_at(est, args->reserve_tokens);
+            args->key_size = est->key_size;
+        }
 
-        if(i == 0) // 1st subsection must read first word
+        if(start_offset == 0) // 1st subsection of the file must read first word
             args->read_first = 1;
 
-        // Create thread
-        pthread_create(&thread_ids[i], NULL, thread_read, (void*)args);
+        if(opts->id_stream) { // Later sections are appended to the first once counted
+            args->id_stream = malloc(strlen(opts->id_stream) + 32);
+
+            if(!args->id_stream) // Allocation failed
+                exit(1);
+
+            if(i == 0)
+                strcpy(args->id_stream, opts->id_stream);
+            else
+                sprintf(args->id_stream, "%s.part-%d", opts->id_stream, i);
+        }
+
+        if(num_threads == 1) // Read on calling thread, nothing to overlap
+            thread_results[i] = thread_count((void*)args);
+        else // Create thread
+            pthread_create(&thread_ids[i], NULL, thread_count, (void*)args);
     }
 
-    for(int i = 0; i < num_cores; i++) // Synchronize threads
+    for(int i = 0; i < num_threads && num_threads > 1; i++) // Synchronize threads
         // Collect return value
         pthread_join(thread_ids[i], &thread_results[i]);
-    
-    // Convert output to Tree's
-    Tree** dicts = (Tree**)thread_results;
+
+    // Report reads
+    for(int i = 0; i < num_threads; i++) {
+        stats->bytes_read += thread_args[i].bytes_read;
+        stats->cache_lookups += thread_args[i].cache_lookups;
+        stats->cache_hits += thread_args[i].cache_hits;
+
+        if(thread_args[i].read_mode > stats->read_mode) // Any fallback to dropping pages shows
+            stats->read_mode = thread_args[i].read_mode;
+    }
+
+    stats->bytes_decoded = stats->bytes_read;
+    stats->io = thread_args[0].io;
+
+    if(opts->id_stream && !join_id_streams(thread_args, num_threads)) { // Stream incomplete
+        perror(opts->id_stream);
+
+        for(int i = 0; i < num_threads; i++)
+            dict_free(thread_results[i]);
+
+        free(thread_results);
+        thread_results = NULL;
+    }
+
+    for(int i = 0; i < num_threads; i++)
+        free(thread_args[i].id_stream);
+
+    free(thread_ids);
+    free(thread_args);
+
+    // Convert output to Dict's
+    return (Dict**)thread_results;
+}
+
+
+// Count the segments an earlier run didn't save, saving each one before
+// the next is counted so at most one segment is lost to a crash
+static char count_segments(char* filepath, long file_size, long num_threads, const Options* opts,
+                           const VocabEstimate* est, Checkpoint* cp, ReadStats* stats) {
+    for(size_t i = 0; i < cp->num_segments; i++) {
+        Segment* seg = &cp->segments[i];
+
+        if(seg->done) // Saved by an earlier run
+            continue;
+
+        Dict** dicts = count_plain(filepath, file_size, seg->start, seg->end, num_threads, opts, est, stats);
+
+        if(!dicts) // Reading failed
+            return 0;
+
+        char tmp_path[4096];
+        snprintf(tmp_path, sizeof(tmp_path), "%s/.seg-%zu.tmp", cp->dir, i);
+
+        DictWriter* writer = dict_writer_open(tmp_path);
+        char res = writer != NULL;
+
+        if(res && num_threads > 1 && opts->engine == ENGINE_IDS) // Counts add by ID
+            res = reduce_dicts(dicts, num_threads) && scan_dict(dicts[0], dict_writer_add, writer);
+        else if(res && num_threads == 1)
+            res = scan_dict(dicts[0], dict_writer_add, writer);
+        else if(res)
+            res = merge_dicts(dicts, num_threads, dict_writer_add, writer);
+
+        if(writer && !dict_writer_close(writer, NULL))
+            res = 0;
+
+        for(long t = 0; t < num_threads; t++)
+            dict_free(dicts[t]);
+
+        free(dicts);
+
+        if(!res || !checkpoint_commit(cp, i, tmp_path)) {
+            unlink(tmp_path);
+            return 0;
+        }
+
+        if(opts->stats)
+            fprintf(stderr, "checkpoint: segment %zu of %zu saved, bytes %ld to %ld\n",
+                i + 1, cp->num_segments, seg->start, seg->end);
+    }
+
+    return 1;
+}
+
+
+char count_words(char* filepath, const Options* opts) {
+    Options defaults;
+
+    if(!opts) { // Use default settings
+        options_init(&defaults);
+        opts = &defaults;
+    }
+
+    // Get number of logical cores available 
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    #ifdef DBG
+    printf("Cores Available: %ld\n", num_cores);
+    #endif
+
+    // System error
+    if(num_cores < 1) {
+        // Terminate program
+        perror("sysconf");
+        exit(1);
+    }
+
+    // Get total filesize
+    struct stat st;
+
+    if(stat(filepath, &st)) { // File can't be read
+        perror(filepath);
+        return 0;
+    }
+
+    // Words to skip while tokenizing, looked up by perfect hash
+    WordFilter* filter = NULL;
+    double filter_start = now_seconds();
+
+    if(opts->include_file || opts->exclude_file) {
+        filter = word_filter_load(opts->include_file, opts->exclude_file);
+
+        if(!filter) { // List unreadable or hash failed to build
+            fprintf(stderr, "word lists failed to load\n");
+            return 0;
+        }
+    }
+
+    double filter_time = now_seconds() - filter_start;
+
+    // Input identity and the settings its counts depend on, names result
+    // cache entries and checkpoints
+    char key[CACHE_KEY_SIZE];
+    // Only a dictionary in word order can be cached
+    char want_cache = opts->cache_dir && opts->dict_path && opts->sort == SORT_WORD;
+    char keyed = (want_cache || opts->checkpoint_dir) && cache_key(filepath, &st, key);
+
+    // A followed input keeps its identity as it grows
+    if(opts->follow_dir)
+        keyed = snprintf(key, CACHE_KEY_SIZE, "follow-%llx-%llx",
+            (unsigned long long)st.st_dev, (unsigned long long)st.st_ino) > 0;
+
+    if(keyed && opts->ngram > 1) // N-gram counts are separate entries
+        snprintf(key + strlen(key), CACHE_KEY_SIZE - strlen(key), "-%dg", opts->ngram);
+
+    if(keyed && filter) // Filtered counts depend on the word lists
+        snprintf(key + strlen(key), CACHE_KEY_SIZE - strlen(key), "-f%016llx", (unsigned long long)filter->id);
+
+    if(want_cache && keyed && opts->compress_dict) // Cached file is the dictionary in its format
+        snprintf(key + strlen(key), CACHE_KEY_SIZE - strlen(key), "-z");
+
+    // Unchanged input counted before, reuse its dictionary
+    char use_cache = want_cache && keyed;
+
+    if(use_cache && cache_fetch(opts->cache_dir, key, opts->dict_path)) {
+        if(opts->stats)
+            fprintf(stderr, "cache: hit %s\n", key);
+
+        word_filter_free(filter);
+
+        if(opts->stream) // Nothing was merged to stream, print the cached copy
+            return print_dict(opts->dict_path, opts->output);
+
+        return 1;
+    }
+
+    // Compressed input is decoded by the reading threads
+    InputFormat format = detect_format(filepath);
+
+    if(opts->id_stream && format != FORMAT_PLAIN) { // Sections of a stream are decoded out of order
+        fprintf(stderr, "%s: ID streams need plain text input\n", filepath);
+        word_filter_free(filter);
+        return 0;
+    }
+
+    // Segments saved by an earlier run are not counted again
+    Checkpoint* checkpoint = NULL;
+
+    if(opts->checkpoint_dir || opts->follow_dir) {
+        if(format != FORMAT_PLAIN) // Compressed streams can't be entered at a byte offset
+            fprintf(stderr, "%s: checkpoints need plain text input\n", filepath);
+        else if(!keyed)
+            perror(filepath);
+        else if(opts->follow_dir) // Only bytes appended since the last run are counted
+            checkpoint = checkpoint_follow(opts->follow_dir, key, filepath, st.st_size);
+        else
+            checkpoint = checkpoint_open(opts->checkpoint_dir, key, st.st_size, opts->segment_size);
+
+        if(!checkpoint) {
+            word_filter_free(filter);
+            return 0;
+        }
+    }
+
+    // Sample plain input to size dictionaries and pick engine and threads
+    VocabEstimate estimate;
+    double estimate_start = now_seconds();
+    char estimated = format == FORMAT_PLAIN && vocab_estimate(filepath, st.st_size, opts->ngram, &estimate);
+    double estimate_time = now_seconds() - estimate_start;
+
+    Options run = *opts;
+
+    run.filter = filter;
+
+    if(opts->auto_engine && estimated)
+        run.engine = choose_engine(&estimate);
+
+    run.hot_cache = opts->hot_cache && hot_cache_useful(run.engine);
+
+    // Plain text workers number words through one interner
+    if(run.engine == ENGINE_IDS && format == FORMAT_PLAIN && !(run.interner = interner_create())) {
+        checkpoint_free(checkpoint);
+        word_filter_free(filter);
+        return 0;
+    }
+
+    // Bytes this run counts, a followed input only its appended bytes
+    long count_size = st.st_size;
+    long follow_start = checkpoint ? checkpoint->processed : 0;
+
+    if(checkpoint && checkpoint->follow) {
+        Segment* last = checkpoint->num_segments ? &checkpoint->segments[checkpoint->num_segments - 1] : NULL;
+        count_size = last && !last->done ? last->end - last->start : 0;
+    }
+
+    // Use fewer threads than cores when chunks would be small, sampled
+    // tokens describe the whole input rather than an appended part
+    long num_threads = choose_threads(count_size, estimated && count_size == st.st_size ? &estimate : NULL,
+                                      num_cores, opts->threads);
+    opts = &run;
+
+    #ifdef DBG
+    printf("Threads Used: %ld\n", num_threads);
+    #endif
+
+    ReadStats read_stats;
+    memset(&read_stats, 0, sizeof(ReadStats));
+
+    Dict** dicts = NULL;
+    long num_dicts = num_threads;
+    long cached_before = opts->stats ? page_cache_resident(filepath) : -1;
+    double read_start = now_seconds();
+    char counted;
+
+    if(checkpoint) { // Words are merged from the saved segments instead
+        counted = count_segments(filepath, st.st_size, num_threads, opts, estimated ? &estimate : NULL,
+                                 checkpoint, &read_stats);
+        num_dicts = 0;
+
+        // Fold small updates together, a failure leaves them apart
+        if(counted && !checkpoint_compact(checkpoint))
+            fprintf(stderr, "checkpoint: segments in %s left unmerged\n", checkpoint->dir);
+    } else {
+        if(format == FORMAT_PLAIN)
+            dicts = count_plain(filepath, st.st_size, 0, st.st_size, num_threads, opts,
+                                estimated ? &estimate : NULL, &read_stats);
+        else
+            dicts = count_compressed(filepath, format, num_threads, opts, &num_dicts, &read_stats);
+
+        counted = dicts != NULL;
+    }
+
+    double read_end = now_seconds();
+    double counted_mib = opts->stats ? resident_mib() : 0;
+    long cached_after = opts->stats ? page_cache_resident(filepath) : -1;
+
+    // Bytes the engines report holding, a shared interner counted once
+    size_t dict_bytes = opts->interner ? interner_memory(opts->interner) : 0;
+
+    for(long i = 0; opts->stats && counted && dicts && i < num_dicts; i++)
+        dict_bytes += dict_memory_used(dicts[i]);
+
+    if(!counted) { // Reading failed
+        printf("Dictionary failed to save\n");
+        checkpoint_free(checkpoint);
+        interner_free(run.interner);
+        word_filter_free(filter);
+        return 0;
+    }
 
     #ifdef DBG
     printf("\n\nResults\n");
-    for(int i = 0; i < num_cores; i++) {
+    for(int i = 0; i < num_dicts; i++) {
         printf("\n\nThread %d:\n", i);
-        tree_print(dicts[i], print_word);
+        DictIter* iter = dict_iter_create(dicts[i]);
+        unsigned long long count;
+        char* word;
+
+        while((word = dict_iter_next(iter, &count)))
+            print_word(word, &count, 0, 0);
+
+        dict_iter_free(iter);
     }
     #endif
 
 
-    // Merge and write results to file
-    char res = write_dict(dicts, num_cores);
+    // Merge results into the dictionary file, printed output or count order
+    OutputSink sink = {NULL, NULL, NULL};
+    char res = 1;
+
+    if(opts->dict_path) // Persist dictionary
+        res = (sink.dict = opts->compress_dict ? dict_writer_open_blocked(opts->dict_path)
+                                               : dict_writer_open(opts->dict_path)) != NULL;
+
+    if(res && opts->sort == SORT_COUNT) // Print once sorted by count
+        res = (sink.order = count_order_create()) != NULL;
+    else if(res && opts->stream) // Print as merged
+        res = (sink.text = output_open(opts->output)) != NULL;
+
+    CountingSink out = {output_sink, &sink, 0, 0};
+    double reduce_time = 0;
+    double sort_time = 0;
+
+    PerfCounters perf;
+    perf_begin(&perf, PERF_MERGE);
+
+    // ID counts are combined by adding them, not by comparing words
+    char reduce = num_dicts > 1 && (opts->reduce || opts->engine == ENGINE_IDS);
+    char* vocab_path = NULL;
+
+    if(res && checkpoint) { // Every segment is saved in word order
+        res = checkpoint_merge(checkpoint, counting_sink, &out);
+    } else if(res && (reduce || opts->id_stream)) { // Combine in parallel, then pass on in order
+        res = !reduce || reduce_dicts(dicts, num_dicts);
+        reduce_time = now_seconds() - read_end;
+
+        if(res && opts->id_stream) { // Totals by ID, before the output drains them
+            vocab_path = malloc(strlen(opts->id_stream) + sizeof(ID_VOCAB_SUFFIX));
+            res = vocab_path && sprintf(vocab_path, "%s%s", opts->id_stream, ID_VOCAB_SUFFIX) > 0 &&
+                  dict_write_vocab(dicts[0], vocab_path);
+        }
+
+        res = res && scan_dict(dicts[0], counting_sink, &out);
+    } else if(res && num_dicts == 1) { // Single dictionary needs no merge
+        res = scan_dict(dicts[0], counting_sink, &out);
+    } else if(res) {
+        res = merge_dicts(dicts, num_dicts, counting_sink, &out);
+    }
+
+    perf_end(&perf);
+    perf_set_tokens(out.num_tokens);
+
+    DictWriterStats write_stats = {0, 0, 0, 0};
+
+    if(sink.dict && !dict_writer_close(sink.dict, &write_stats)) // Flush failed
+        res = 0;
+
+    if(sink.text && !output_close(sink.text))
+        res = 0;
+
+    if(sink.order) { // Sort by count and print
+        double sort_start = now_seconds();
+        perf_begin(&perf, PERF_SORT);
+        res = res && count_order_sort(sink.order, num_threads);
+        perf_end(&perf);
+        sort_time = now_seconds() - sort_start;
+
+        FILE* text = res ? output_open(opts->output) : NULL;
+        perf_begin(&perf, PERF_PRINT);
+        res = res && text && count_order_print(sink.order, text);
+        perf_end(&perf);
+
+        if(text && !output_close(text))
+            res = 0;
+
+        count_order_free(sink.order);
+    }
 
     if(!res) // Check for write failure
         printf("Dictionary failed to save\n");
 
+    double write_end = now_seconds();
+    double output_mib = opts->stats ? resident_mib() : 0;
+
+    // Store result unless the input changed while it was counted
+    struct stat after;
+    char stored = 0;
+
+    if(res && use_cache && !stat(filepath, &after) && after.st_size == st.st_size &&
+       after.st_mtim.tv_sec == st.st_mtim.tv_sec && after.st_mtim.tv_nsec == st.st_mtim.tv_nsec)
+        stored = cache_store(opts->cache_dir, key, opts->dict_path, opts->cache_size);
+
+    if(opts->stats) { // Report phase timing
+        if(estimated)
+            fprintf(stderr, "estimate: %zu tokens, %zu distinct from %d samples of %.2f MiB in %.3f s\n",
+                estimate.num_tokens, estimate.num_distinct, estimate.num_samples,
+                estimate.sample_bytes / (1024.0 * 1024.0), estimate_time);
+
+        if(filter)
+            fprintf(stderr, "filter: %zu include, %zu exclude words hashed in %.3f s\n",
+                perfect_hash_size(filter->include), perfect_hash_size(filter->exclude), filter_time);
+
+        fprintf(stderr, "plan: %s engine (%s), %ld threads (%s)\n", engine_name(opts->engine),
+            opts->auto_engine ? (estimated ? "sampled" : "default") : "given", num_threads,
+            opts->threads > 0 ? "given" : (estimated ? "sampled" : "file size"));
+
+        double read_time = read_end - read_start;
+        double mib = read_stats.bytes_read / (1024.0 * 1024.0);
+
+        fprintf(stderr, "read: %.2f MiB in %.3f s (%.1f MiB/s) via %s, %ld threads\n",
+            mib, read_time, read_time > 0 ? mib / read_time : 0.0,
+            io_backend_name(read_stats.io), num_threads);
+
+        // What reading left in the page cache, for comparing direct and buffered reads
+        if(cached_before >= 0 && cached_after >= 0)
+            fprintf(stderr, "page cache: %s reads, input %.2f MiB cached before, %.2f MiB after\n",
+                read_mode_name(read_stats.read_mode), cached_before / (1024.0 * 1024.0),
+                cached_after / (1024.0 * 1024.0));
+        else
+            fprintf(stderr, "page cache: %s reads\n", read_mode_name(read_stats.read_mode));
+
+        if(format != FORMAT_PLAIN) {
+            double text_mib = read_stats.bytes_decoded / (1024.0 * 1024.0);
+
+            fprintf(stderr, "decode: %s, %.2f MiB of text (%.1f MiB/s), ", input_format_name(format),
+                text_mib, read_time > 0 ? text_mib / read_time : 0.0);
+
+            if(read_stats.parallel_parts)
+                fprintf(stderr, "%ld ranges in parallel\n", read_stats.parallel_parts);
+            else
+                fprintf(stderr, "pipelined\n");
+        }
+
+        if(read_stats.cache_lookups)
+            fprintf(stderr, "hot cache: %.1f%% of %zu keys counted without the dictionary\n",
+                100.0 * read_stats.cache_hits / read_stats.cache_lookups, read_stats.cache_lookups);
+
+        fprintf(stderr, "merge+write: %.3f s\n", write_end - read_end);
+
+        if(sink.dict)
+            fprintf(stderr, "write: %.2f MiB in %.3f s on writer thread, merge waited %.3f s\n",
+                write_stats.bytes_written / (1024.0 * 1024.0), write_stats.write_time, write_stats.stall_time);
+
+        if(sink.dict && opts->compress_dict)
+            fprintf(stderr, "compress: %.2f MiB of records in %.2f MiB of blocks (%.2f:1)\n",
+                write_stats.raw_bytes / (1024.0 * 1024.0), write_stats.bytes_written / (1024.0 * 1024.0),
+                write_stats.bytes_written ? (double)write_stats.raw_bytes / write_stats.bytes_written : 0.0);
+
+        if(opts->sort == SORT_COUNT)
+            fprintf(stderr, "sort: %.3f s by count\n", sort_time);
+
+        // Dictionaries drain during the merge, so output allocations reuse their memory
+        fprintf(stderr, "memory: %.1f MiB resident after counting, %.1f MiB after output, peak %.1f MiB\n",
+            counted_mib, output_mib, peak_resident_mib());
+
+        if(dicts)
+            fprintf(stderr, "engine: %.1f MiB held by %ld %s dictionaries after counting\n",
+                dict_bytes / (1024.0 * 1024.0), num_dicts, engine_name(opts->engine));
+
+        if(reduce)
+            fprintf(stderr, "reduce: %.3f s in %d rounds\n", reduce_time, 64 - __builtin_clzl(num_dicts - 1));
+
+        if(opts->interner)
+            fprintf(stderr, "ids: %zu words numbered", interner_size(opts->interner));
+
+        if(opts->interner && vocab_path)
+            fprintf(stderr, ", %llu token IDs in %s, vocabulary in %s\n", out.num_tokens, opts->id_stream, vocab_path);
+        else if(opts->interner)
+            fprintf(stderr, "\n");
+
+        if(estimated && res && !filter) // Compare estimate with counted result, estimates ignore filters
+            fprintf(stderr, "estimate error: tokens %+.1f%%, distinct %+.1f%%\n",
+                out.num_tokens ? 100.0 * ((double)estimate.num_tokens - out.num_tokens) / out.num_tokens : 0.0,
+                out.num_words ? 100.0 * ((double)estimate.num_distinct - out.num_words) / out.num_words : 0.0);
+
+        if(checkpoint && checkpoint->follow)
+            fprintf(stderr, "follow: counted bytes %ld to %ld (%.2f MiB appended), %zu segments in %s\n",
+                follow_start, follow_start + count_size, count_size / (1024.0 * 1024.0),
+                checkpoint->num_segments, checkpoint->dir);
+        else if(checkpoint)
+            fprintf(stderr, "checkpoint: %zu of %zu segments reused from %s\n",
+                checkpoint->num_reused, checkpoint->num_segments, checkpoint->dir);
+
+        if(use_cache)
+            fprintf(stderr, "cache: miss %s, %s\n", key, stored ? "stored" : "not stored");
+    }
+
     // Free Allocated Memory
-    for(int i = 0; i < num_cores; i++) {
+    for(int i = 0; i < num_dicts; i++) {
         if(dicts[i])
-            tree_free(dicts[i]);
+            dict_free(dicts[i]);
     }
 
-    free(thread_ids);
-    free(thread_results);
-    
+    free(dicts);
+    free(vocab_path);
+    checkpoint_free(checkpoint);
+    interner_free(run.interner);
+    word_filter_free(filter);
 
     return res;
 } 
\ No newline at end of file
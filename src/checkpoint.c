@@ -0,0 +1,575 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../include/word_queue.h"
+#include "../include/dict_writer.h"
+#include "../include/checkpoint.h"
+#include "../include/fnv_hash.h"
+
+// Long counts saved in pieces. Each segment's dictionary is made durable
+// and renamed into place before the manifest lists it, and the manifest
+// itself is replaced by rename, so a run killed at any point leaves only
+// complete segments behind. The manifest names the input and settings
+// the segments were counted with; a mismatch starts over.
+//
+// A followed input is split where earlier runs stopped instead: each run
+// counts only the bytes appended since, up to the last delimiter, as one
+// more segment. The manifest also hashes the bytes before that point, so
+// an input rewritten or truncated in place is counted again from the start.
+
+#define MANIFEST_VERSION 1
+#define SEGMENT_READ_BUF_SIZE (256 * 1024)
+#define FOLLOW_TAIL_SIZE 4096 // Bytes before the counted end hashed into the manifest
+#define BOUNDARY_BUF_SIZE (64 * 1024)
+
+// Saved segment read back during the final merge
+typedef struct {
+    FILE* file;
+    char* word;
+    size_t capacity;
+    unsigned long long count;
+} SegmentReader;
+
+
+void checkpoint_segment_path(const Checkpoint* cp, size_t index, char* path, size_t size) {
+    const Segment* seg = &cp->segments[index];
+    snprintf(path, size, "%s/seg-%ld-%ld.dict", cp->dir, seg->start, seg->end);
+}
+
+
+// Remove segments listed by a manifest of another input
+static void remove_listed(Checkpoint* cp, FILE* manifest) {
+    long start, end;
+    char line[4096];
+    char path[4096];
+
+    while(fgets(line, sizeof(line), manifest)) { // Header lines don't start with a number
+        if(sscanf(line, "%ld %ld", &start, &end) != 2)
+            continue;
+
+        snprintf(path, sizeof(path), "%s/seg-%ld-%ld.dict", cp->dir, start, end);
+        unlink(path);
+    }
+}
+
+
+// Mark segments listed in the manifest whose files are still present
+static void read_manifest(Checkpoint* cp, long file_size, long long segment_size) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", cp->dir, CHECKPOINT_MANIFEST);
+
+    FILE* manifest = fopen(path, "r");
+
+    if(!manifest) // First run
+        return;
+
+    int version;
+    char key[CACHE_KEY_SIZE];
+    long long saved_segment_size;
+    long saved_file_size;
+
+    char same = fscanf(manifest, "word_count checkpoint %d key %95s segment_size %lld file_size %ld",
+        &version, key, &saved_segment_size, &saved_file_size) == 4 &&
+        version == MANIFEST_VERSION && !strcmp(key, cp->key) &&
+        saved_segment_size == segment_size && saved_file_size == file_size;
+
+    if(!same) {
+        fprintf(stderr, "checkpoint: %s was saved for another input or settings, starting over\n", cp->dir);
+        remove_listed(cp, manifest);
+        fclose(manifest);
+        return;
+    }
+
+    long start, end;
+
+    while(fscanf(manifest, "%ld %ld", &start, &end) == 2) {
+        size_t index = start / segment_size;
+
+        if(start < 0 || index >= cp->num_segments)
+            continue;
+
+        Segment* seg = &cp->segments[index];
+        checkpoint_segment_path(cp, index, path, sizeof(path));
+
+        if(seg->start == start && seg->end == end && !seg->done && !access(path, R_OK)) {
+            seg->done = 1;
+            cp->num_reused++;
+        }
+    }
+
+    fclose(manifest);
+}
+
+
+// Open checkpoint in dir for an input of file_size bytes identified by
+// key, split into segments of segment_size bytes
+Checkpoint* checkpoint_open(const char* dir, const char* key, long file_size, long long segment_size) {
+    if(!dir || !key || file_size < 0 || segment_size < 1)
+        return NULL; // Invalid input
+
+    if(mkdir(dir, 0755) && access(dir, W_OK)) { // Create directory on first use
+        perror(dir);
+        return NULL;
+    }
+
+    Checkpoint* cp = calloc(1, sizeof(Checkpoint));
+
+    if(!cp) // Allocation failed
+        return NULL;
+
+    cp->num_segments = file_size ? (file_size + segment_size - 1) / segment_size : 1;
+    cp->segments = calloc(cp->num_segments, sizeof(Segment));
+    cp->dir = strdup(dir);
+
+    if(!cp->segments || !cp->dir) { // Allocation failed
+        checkpoint_free(cp);
+        return NULL;
+    }
+
+    snprintf(cp->key, CACHE_KEY_SIZE, "%s", key);
+    cp->segment_size = segment_size;
+
+    for(size_t i = 0; i < cp->num_segments; i++) {
+        cp->segments[i].start = i * segment_size;
+        cp->segments[i].end = i + 1 < cp->num_segments ? (long)((i + 1) * segment_size) : file_size;
+    }
+
+    read_manifest(cp, file_size, segment_size);
+
+    return cp;
+}
+
+
+// Hash the bytes just before end, the first to differ when an input is
+// rewritten rather than appended to
+static char tail_hash(int fd, long end, unsigned long long* hash) {
+    char tail[FOLLOW_TAIL_SIZE];
+    long len = end < FOLLOW_TAIL_SIZE ? end : FOLLOW_TAIL_SIZE;
+
+    if(pread(fd, tail, len, end - len) != len) // Input shorter than counted
+        return 0;
+
+    *hash = fnv_update(fnv_update(FNV_OFFSET, &end, sizeof(end)), tail, len);
+
+    return 1;
+}
+
+
+// Offset just past the last delimiter between start and file_size, start
+// when a word is still being written there. Returns -1 on a read failure
+static long word_boundary(int fd, long start, long file_size) {
+    char buf[BOUNDARY_BUF_SIZE];
+    long end = file_size;
+
+    while(end > start) { // Search back from the end of the input
+        long len = end - start < BOUNDARY_BUF_SIZE ? end - start : BOUNDARY_BUF_SIZE;
+
+        if(pread(fd, buf, len, end - len) != len)
+            return -1;
+
+        for(long i = len - 1; i >= 0; i--) {
+            if(isspace((unsigned char)buf[i]))
+                return end - len + i + 1;
+        }
+
+        end -= len;
+    }
+
+    return start;
+}
+
+
+// Append segment start to end, not yet counted
+static char add_segment(Checkpoint* cp, long start, long end) {
+    Segment* new_segments = realloc(cp->segments, (cp->num_segments + 1) * sizeof(Segment));
+
+    if(!new_segments) // Allocation failed
+        return 0;
+
+    cp->segments = new_segments;
+    cp->segments[cp->num_segments++] = (Segment){start, end, 0};
+
+    return 1;
+}
+
+
+// Read the segments saved for the followed input, all of them when the
+// input still starts with the bytes they were counted from, else none
+static char read_follow_manifest(Checkpoint* cp, int fd, long file_size) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", cp->dir, CHECKPOINT_MANIFEST);
+
+    FILE* manifest = fopen(path, "r");
+
+    if(!manifest) // First run
+        return 1;
+
+    int version;
+    char key[CACHE_KEY_SIZE];
+
+    char same = fscanf(manifest, "word_count follow %d key %95s tail %llx",
+        &version, key, &cp->tail) == 3 &&
+        version == MANIFEST_VERSION && !strcmp(key, cp->key);
+
+    if(!same) {
+        fprintf(stderr, "checkpoint: %s was saved for another input or settings, starting over\n", cp->dir);
+        remove_listed(cp, manifest);
+        fclose(manifest);
+        return 1;
+    }
+
+    long start, end;
+    char ok = 1;
+
+    while(ok && fscanf(manifest, "%ld %ld", &start, &end) == 2) {
+        ok = add_segment(cp, start, end);
+
+        if(ok) // Listed segments were saved before the manifest was written
+            cp->segments[cp->num_segments - 1].done = 1;
+    }
+
+    fclose(manifest);
+
+    if(!ok) // Allocation failed
+        return 0;
+
+    // Segments must cover the input from its start without gaps
+    long counted = 0;
+    char valid = 1;
+
+    for(size_t i = 0; valid && i < cp->num_segments; i++) {
+        checkpoint_segment_path(cp, i, path, sizeof(path));
+        valid = cp->segments[i].start == counted && cp->segments[i].end > counted && !access(path, R_OK);
+        counted = cp->segments[i].end;
+    }
+
+    unsigned long long hash;
+
+    if(valid && (counted > file_size || !tail_hash(fd, counted, &hash) || hash != cp->tail))
+        valid = 0;
+
+    if(!valid) { // Input was replaced, truncated or rewritten
+        fprintf(stderr, "checkpoint: %s no longer matches the start of %s, starting over\n",
+            cp->dir, cp->follow);
+
+        for(size_t i = 0; i < cp->num_segments; i++) {
+            checkpoint_segment_path(cp, i, path, sizeof(path));
+            unlink(path);
+        }
+
+        cp->num_segments = 0;
+        counted = 0;
+    }
+
+    cp->processed = counted;
+    cp->num_reused = cp->num_segments;
+
+    return 1;
+}
+
+
+// Open checkpoint in dir following filepath as it grows, identified by
+// key. Segments saved by earlier runs are reused, the bytes appended since
+// up to the last delimiter become one more segment to count
+Checkpoint* checkpoint_follow(const char* dir, const char* key, const char* filepath, long file_size) {
+    if(!dir || !key || !filepath || file_size < 0)
+        return NULL; // Invalid input
+
+    if(mkdir(dir, 0755) && access(dir, W_OK)) { // Create directory on first use
+        perror(dir);
+        return NULL;
+    }
+
+    int fd = open(filepath, O_RDONLY);
+
+    if(fd < 0) {
+        perror(filepath);
+        return NULL;
+    }
+
+    Checkpoint* cp = calloc(1, sizeof(Checkpoint));
+    char ok = cp != NULL;
+
+    if(ok) {
+        cp->dir = strdup(dir);
+        cp->follow = strdup(filepath);
+        snprintf(cp->key, CACHE_KEY_SIZE, "%s", key);
+
+        ok = cp->dir && cp->follow && read_follow_manifest(cp, fd, file_size);
+    }
+
+    // Word still being written is counted by a later run
+    long cut = ok ? word_boundary(fd, cp->processed, file_size) : -1;
+
+    ok = cut >= 0 && tail_hash(fd, cut, &cp->next_tail);
+
+    if(ok && cut > cp->processed)
+        ok = add_segment(cp, cp->processed, cut);
+
+    close(fd);
+
+    if(!ok) {
+        checkpoint_free(cp);
+        return NULL;
+    }
+
+    return cp;
+}
+
+
+// Flush file at path to disk
+static char sync_path(const char* path) {
+    int fd = open(path, O_RDONLY);
+
+    if(fd < 0)
+        return 0;
+
+    char ok = !fsync(fd);
+    close(fd);
+
+    return ok;
+}
+
+
+// Replace the manifest with one listing every saved segment
+static char write_manifest(const Checkpoint* cp) {
+    char path[4096];
+    char tmp_path[4096];
+    snprintf(path, sizeof(path), "%s/%s", cp->dir, CHECKPOINT_MANIFEST);
+    snprintf(tmp_path, sizeof(tmp_path), "%s/.%s.tmp", cp->dir, CHECKPOINT_MANIFEST);
+
+    FILE* manifest = fopen(tmp_path, "w");
+
+    if(!manifest)
+        return 0;
+
+    if(cp->follow) { // Counted bytes end where the last saved segment does
+        char counted = cp->num_segments && cp->segments[cp->num_segments - 1].done;
+
+        fprintf(manifest, "word_count follow %d\nkey %s\ntail %016llx\n",
+            MANIFEST_VERSION, cp->key, counted ? cp->next_tail : cp->tail);
+    } else {
+        fprintf(manifest, "word_count checkpoint %d\nkey %s\nsegment_size %lld\nfile_size %ld\n",
+            MANIFEST_VERSION, cp->key, cp->segment_size, cp->segments[cp->num_segments - 1].end);
+    }
+
+    for(size_t i = 0; i < cp->num_segments; i++) {
+        if(cp->segments[i].done)
+            fprintf(manifest, "%ld %ld\n", cp->segments[i].start, cp->segments[i].end);
+    }
+
+    char ok = !fflush(manifest) && !fsync(fileno(manifest));
+
+    if(fclose(manifest))
+        ok = 0;
+
+    if(ok)
+        ok = !rename(tmp_path, path);
+
+    if(!ok)
+        unlink(tmp_path);
+
+    return ok && sync_path(cp->dir); // Make the renames durable
+}
+
+
+// Move the dictionary written to tmp_path into place as segment index
+// and list it in the manifest
+char checkpoint_commit(Checkpoint* cp, size_t index, const char* tmp_path) {
+    if(!cp || index >= cp->num_segments || !tmp_path)
+        return 0;
+
+    char path[4096];
+    checkpoint_segment_path(cp, index, path, sizeof(path));
+
+    // Segment must be durable before the manifest lists it
+    if(!sync_path(tmp_path) || rename(tmp_path, path)) {
+        unlink(tmp_path);
+        return 0;
+    }
+
+    cp->segments[index].done = 1;
+
+    if(!write_manifest(cp)) { // Counted again by the next run
+        cp->segments[index].done = 0;
+        return 0;
+    }
+
+    return 1;
+}
+
+
+// Read next record, returns 1 on success, 0 at end and -1 on failure
+static int reader_next(SegmentReader* reader) {
+    size_t len;
+
+    if(fread(&len, sizeof(len), 1, reader->file) != 1)
+        return feof(reader->file) ? 0 : -1;
+
+    if(len + 1 > reader->capacity) { // Grow word buffer
+        char* new_word = realloc(reader->word, len + 1);
+
+        if(!new_word) // Allocation failed
+            return -1;
+
+        reader->word = new_word;
+        reader->capacity = len + 1;
+    }
+
+    if(fread(reader->word, 1, len, reader->file) != len ||
+       fread(&reader->count, sizeof(reader->count), 1, reader->file) != 1)
+        return -1; // Truncated record
+
+    reader->word[len] = '\0';
+
+    return 1;
+}
+
+
+// Queue the next word of reader, returns 0 on a read failure
+static char reader_queue(WordQueue* queue, SegmentReader* reader, int index) {
+    int res = reader_next(reader);
+
+    if(res == 1)
+        return word_queue_insert(queue, reader->word, reader->count, index);
+
+    return res == 0;
+}
+
+
+// Merge num_readers saved segments from first in word order, passing
+// each word and its total count to sink
+static char merge_segments(const Checkpoint* cp, size_t first, int num_readers, WordSink sink, void* ctx) {
+    if(!num_readers) // Nothing counted yet
+        return 1;
+
+    SegmentReader* readers = calloc(num_readers, sizeof(SegmentReader));
+    WordQueue* queue = word_queue_create(num_readers);
+    char ok = readers && queue;
+
+    for(int i = 0; ok && i < num_readers; i++) {
+        char path[4096];
+        checkpoint_segment_path(cp, first + i, path, sizeof(path));
+
+        if(!cp->segments[first + i].done || !(readers[i].file = fopen(path, "rb"))) { // Segment missing
+            ok = 0;
+            break;
+        }
+
+        setvbuf(readers[i].file, NULL, _IOFBF, SEGMENT_READ_BUF_SIZE);
+        ok = reader_queue(queue, &readers[i], i);
+    }
+
+    while(ok && !word_queue_is_empty(queue)) {
+        unsigned long long count;
+        int index;
+        char* word = word_queue_get_min(queue, &count, &index);
+
+        ok = reader_queue(queue, &readers[index], index);
+
+        // Same word saved by other segments
+        while(ok && !word_queue_is_empty(queue) && !strcmp(word, word_queue_peak(queue))) {
+            unsigned long long dup_count;
+            free(word_queue_get_min(queue, &dup_count, &index));
+
+            count += dup_count;
+            ok = reader_queue(queue, &readers[index], index);
+        }
+
+        ok = ok && sink(ctx, word, count);
+        free(word);
+    }
+
+    word_queue_free(queue); // Frees words left after a failure
+
+    for(int i = 0; readers && i < num_readers; i++) {
+        if(readers[i].file)
+            fclose(readers[i].file);
+
+        free(readers[i].word);
+    }
+
+    free(readers);
+
+    return ok;
+}
+
+
+// Merge all saved segments in word order, passing each word and its
+// total count to sink
+char checkpoint_merge(const Checkpoint* cp, WordSink sink, void* ctx) {
+    if(!cp || !sink)
+        return 0;
+
+    return merge_segments(cp, 0, cp->num_segments, sink, ctx);
+}
+
+
+// Merge the newest two segments of a followed input while the newer
+// covers at least half the bytes of the older, like carries in a binary
+// counter, so n updates leave O(log n) segments and each byte is merged
+// O(log n) times
+char checkpoint_compact(Checkpoint* cp) {
+    if(!cp || !cp->follow)
+        return 1; // Fixed segments are never merged
+
+    while(cp->num_segments > 1) {
+        size_t older = cp->num_segments - 2;
+        Segment* prev = &cp->segments[older];
+        Segment* last = &cp->segments[older + 1];
+
+        if(!prev->done || !last->done || 2 * (last->end - last->start) < prev->end - prev->start)
+            break;
+
+        char tmp_path[4096];
+        char prev_path[4096];
+        char last_path[4096];
+        snprintf(tmp_path, sizeof(tmp_path), "%s/.compact.tmp", cp->dir);
+        checkpoint_segment_path(cp, older, prev_path, sizeof(prev_path));
+        checkpoint_segment_path(cp, older + 1, last_path, sizeof(last_path));
+
+        DictWriter* writer = dict_writer_open(tmp_path);
+        char ok = writer && merge_segments(cp, older, 2, dict_writer_add, writer);
+
+        if(writer && !dict_writer_close(writer, NULL))
+            ok = 0;
+
+        Segment merged = {prev->start, last->end, 1};
+        cp->segments[older] = merged;
+        cp->num_segments--;
+
+        char path[4096];
+        checkpoint_segment_path(cp, older, path, sizeof(path));
+
+        // Merged segment must be durable before the manifest lists it
+        if(!ok || !sync_path(tmp_path) || rename(tmp_path, path) || !write_manifest(cp)) {
+            unlink(tmp_path);
+
+            // Keep the two segments, the manifest still lists them
+            cp->segments[older] = (Segment){merged.start, last->start, 1};
+            cp->segments[cp->num_segments++].done = 1;
+
+            return 0;
+        }
+
+        unlink(prev_path);
+        unlink(last_path);
+    }
+
+    return 1;
+}
+
+
+void checkpoint_free(Checkpoint* cp) {
+    if(!cp) // Ensure non-null input
+        return;
+
+    free(cp->segments);
+    free(cp->dir);
+    free(cp->follow);
+    free(cp);
+}
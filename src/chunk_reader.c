@@ -0,0 +1,595 @@
+#define _GNU_SOURCE // O_DIRECT
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "../include/chunk_reader.h"
+
+#define READ_BUF_SIZE (256 * 1024) // Size of each rotating buffer
+#define READ_QUEUE_DEPTH 4 // Number of buffers, and of reads kept in flight
+#define READ_TAIL_SIZE 4096 // Read size used past the end of the chunk
+
+// Offset, length and buffer alignment of direct reads, a multiple of the
+// logical block size of common devices
+#define DIRECT_ALIGN 4096
+
+// Buffer of each slot, direct reads widen a range by up to one block
+#define READ_SLOT_SIZE (READ_BUF_SIZE + DIRECT_ALIGN)
+
+// File bytes checked per mapping when measuring the page cache
+#define RESIDENT_WINDOW (1L << 30)
+
+// States of a rotating buffer
+enum {
+    SLOT_FREE,
+    SLOT_PENDING,
+    SLOT_READY
+};
+
+typedef struct {
+    char* data; // Buffer memory
+    struct iovec iov; // Vector passed to io_uring
+    long offset; // File offset of buffer
+    size_t len; // Bytes requested
+    ssize_t result; // Bytes read, negative errno on failure
+    char state;
+
+    // Read issued for the request, whole aligned blocks around it when direct
+    int fd;
+    long io_offset;
+    size_t io_len;
+    size_t skip; // Bytes read before offset
+} ReadSlot;
+
+// Mapped io_uring submission and completion queues
+typedef struct {
+    int fd;
+
+    // Submission queue
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned to_submit;
+
+    // Completion queue
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    // Ring mappings
+    void* sq_ptr;
+    size_t sq_size;
+    void* cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+} Ring;
+
+struct ChunkReader {
+    int fd; // File being read
+    IoBackend backend; // Backend in use (never IO_AUTO)
+    Ring ring;
+
+    ReadMode mode; // Drop once direct reads are found unsupported
+    int direct_fd; // Same file opened with O_DIRECT, -1 when not direct
+
+    ReadSlot slots[READ_QUEUE_DEPTH];
+    char* memory; // Memory backing all slots
+
+    // Slot sequence numbers, slot = seq % READ_QUEUE_DEPTH
+    unsigned long submitted;
+    unsigned long consumed;
+    char holding; // Consumer holds slot of consumed
+
+    long next_offset; // Next file offset to request
+    long limit; // End of chunk, prefetching stops here
+    long file_size;
+
+    size_t bytes_read;
+    char error;
+};
+
+
+const char* read_mode_name(ReadMode mode) {
+    switch(mode) {
+        case READ_DIRECT:
+            return "direct";
+        case READ_DROP:
+            return "drop-behind";
+        default:
+            return "buffered";
+    }
+}
+
+
+const char* io_backend_name(IoBackend backend) {
+    switch(backend) {
+        case IO_URING:
+            return "io_uring";
+        case IO_PREAD:
+            return "pread";
+        default:
+            return "auto";
+    }
+}
+
+
+static void ring_free(Ring* ring) {
+    if(ring->fd < 0) // Ring never created
+        return;
+
+    if(ring->sqes)
+        munmap(ring->sqes, ring->sqes_size);
+    if(ring->cq_ptr && ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_size);
+    if(ring->sq_ptr)
+        munmap(ring->sq_ptr, ring->sq_size);
+
+    close(ring->fd);
+    ring->fd = -1;
+}
+
+
+static char ring_setup(Ring* ring, unsigned entries) {
+    memset(ring, 0, sizeof(Ring));
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+
+    if(ring->fd < 0) // io_uring unavailable (old kernel, seccomp, ...)
+        return 0;
+
+    // Size queue mappings
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if(params.features & IORING_FEAT_SINGLE_MMAP) { // Both queues share one mapping
+        if(ring->cq_size > ring->sq_size)
+            ring->sq_size = ring->cq_size;
+        ring->cq_size = ring->sq_size;
+    }
+
+    // Map submission queue
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+
+    if(ring->sq_ptr == MAP_FAILED) {
+        ring->sq_ptr = NULL;
+        ring_free(ring);
+        return 0;
+    }
+
+    // Map completion queue
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+
+        if(ring->cq_ptr == MAP_FAILED) {
+            ring->cq_ptr = NULL;
+            ring_free(ring);
+            return 0;
+        }
+    }
+
+    // Map submission queue entries
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+    if(ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        ring_free(ring);
+        return 0;
+    }
+
+    // Locate queue fields
+    char* sq = ring->sq_ptr;
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+
+    char* cq = ring->cq_ptr;
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    return 1;
+}
+
+
+// Submit queued entries and optionally wait for completions
+static char ring_enter(Ring* ring, unsigned min_complete) {
+    unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+
+    while(1) {
+        int ret = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, min_complete, flags, NULL, 0);
+
+        if(ret >= 0) {
+            ring->to_submit -= ret;
+            return 1;
+        }
+
+        if(errno != EINTR) // Interrupted calls are retried
+            return 0;
+    }
+}
+
+
+static void ring_queue_read(Ring* ring, ReadSlot* slot, unsigned long user_data) {
+    unsigned tail = *ring->sq_tail; // Only this thread writes the tail
+    unsigned index = tail & *ring->sq_mask;
+
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+    // Vectored read keeps compatibility with kernels before IORING_OP_READ
+    slot->iov.iov_base = slot->data;
+    slot->iov.iov_len = slot->io_len;
+
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = slot->fd;
+    sqe->addr = (unsigned long)&slot->iov;
+    sqe->len = 1;
+    sqe->off = slot->io_offset;
+    sqe->user_data = user_data;
+
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+}
+
+
+// Move finished reads from the completion queue to their slots
+static void reader_reap(ChunkReader* reader) {
+    Ring* ring = &reader->ring;
+    unsigned head = *ring->cq_head;
+
+    while(head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+        ReadSlot* slot = &reader->slots[cqe->user_data];
+
+        if(cqe->res == -EINTR || cqe->res == -EAGAIN) { // Retry transient failures
+            ring_queue_read(ring, slot, cqe->user_data);
+        } else { // Bytes read or negative errno, checked when consumed
+            slot->result = cqe->res;
+            slot->state = SLOT_READY;
+        }
+
+        head++;
+    }
+
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+
+// Request the next len bytes of the file into the next free slot
+static void reader_submit(ChunkReader* reader, size_t len) {
+    unsigned long index = reader->submitted % READ_QUEUE_DEPTH;
+    ReadSlot* slot = &reader->slots[index];
+
+    slot->offset = reader->next_offset;
+    slot->len = len;
+    slot->result = 0;
+    slot->state = SLOT_PENDING;
+
+    slot->fd = reader->fd;
+    slot->io_offset = slot->offset;
+    slot->io_len = len;
+    slot->skip = 0;
+
+    if(reader->mode == READ_DIRECT) { // Widen to whole blocks, the consumer sees only the request
+        slot->fd = reader->direct_fd;
+        slot->io_offset = slot->offset & ~(long)(DIRECT_ALIGN - 1);
+        slot->skip = slot->offset - slot->io_offset;
+        slot->io_len = (slot->skip + len + DIRECT_ALIGN - 1) & ~(size_t)(DIRECT_ALIGN - 1);
+    }
+
+    if(reader->backend == IO_URING) { // Completes asynchronously
+        ring_queue_read(&reader->ring, slot, index);
+    } else { // Complete read now
+        slot->result = pread(slot->fd, slot->data, slot->io_len, slot->io_offset);
+        slot->state = SLOT_READY;
+
+        if(slot->result < 0)
+            slot->result = -errno;
+    }
+
+    reader->next_offset += len;
+    reader->submitted++;
+}
+
+
+// Keep every free slot busy with a read inside the chunk
+static void reader_fill(ChunkReader* reader) {
+    while(reader->submitted - reader->consumed < READ_QUEUE_DEPTH && reader->next_offset < reader->limit) {
+        size_t len = READ_BUF_SIZE;
+
+        if(reader->mode == READ_DIRECT) // Later direct reads start on a block
+            len -= reader->next_offset % DIRECT_ALIGN;
+
+        if(reader->limit - reader->next_offset < (long)len) // Don't prefetch past the chunk
+            len = reader->limit - reader->next_offset;
+
+        reader_submit(reader, len);
+    }
+}
+
+
+// Reader of the bytes from start to end of fd and on past end as asked.
+// Direct mode reads through its own O_DIRECT descriptor so the input
+// doesn't fill the page cache, and drops pages behind it on filesystems
+// that refuse direct I/O.
+ChunkReader* chunk_reader_create(int fd, long start, long end, IoBackend backend, ReadMode mode) {
+    if(fd < 0 || start < 0 || end < start) // Invalid input
+        return NULL;
+
+    struct stat st;
+
+    if(fstat(fd, &st)) // Can't size file
+        return NULL;
+
+    // Allocate memory for reader
+    ChunkReader* reader = calloc(1, sizeof(ChunkReader));
+
+    if(!reader) // Allocation failed
+        return NULL;
+
+    // Allocate memory for rotating buffers, aligned for direct reads
+    void* memory;
+
+    if(posix_memalign(&memory, DIRECT_ALIGN, (size_t)READ_QUEUE_DEPTH * READ_SLOT_SIZE)) { // Allocation failed
+        free(reader);
+        return NULL;
+    }
+
+    reader->memory = memory;
+
+    for(int i = 0; i < READ_QUEUE_DEPTH; i++)
+        reader->slots[i].data = reader->memory + (size_t)i * READ_SLOT_SIZE;
+
+    // Initialize fields
+    reader->fd = fd;
+    reader->next_offset = start;
+    reader->file_size = st.st_size;
+    reader->limit = end < st.st_size ? end : st.st_size;
+    reader->ring.fd = -1;
+    reader->mode = mode;
+    reader->direct_fd = -1;
+
+    if(mode == READ_DIRECT) { // Own descriptor, fd stays buffered for partial reads
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+        reader->direct_fd = open(path, O_RDONLY | O_DIRECT);
+
+        if(reader->direct_fd < 0) // Filesystem without direct I/O, such as tmpfs
+            reader->mode = READ_DROP;
+    }
+
+    // Use io_uring if requested and supported, fall back to pread otherwise
+    if(backend != IO_PREAD && ring_setup(&reader->ring, READ_QUEUE_DEPTH))
+        reader->backend = IO_URING;
+    else
+        reader->backend = IO_PREAD;
+
+    if(reader->backend == IO_PREAD && reader->mode != READ_DIRECT) // Let kernel readahead cover the chunk
+        posix_fadvise(fd, start, reader->limit - start, POSIX_FADV_SEQUENTIAL);
+
+    return reader;
+}
+
+
+// Hand the next buffer of the file to the consumer, in file order
+char chunk_reader_next(ChunkReader* reader, const char** data, size_t* len) {
+    if(!reader || !data || !len || reader->error)
+        return 0;
+
+    if(reader->holding) { // Consumer is done with previous buffer
+        ReadSlot* done = &reader->slots[reader->consumed % READ_QUEUE_DEPTH];
+
+        if(reader->mode == READ_DROP) // Evict what the buffered read cached
+            posix_fadvise(reader->fd, done->offset, done->result, POSIX_FADV_DONTNEED);
+
+        done->state = SLOT_FREE;
+        reader->consumed++;
+        reader->holding = 0;
+    }
+
+    reader_fill(reader);
+
+    if(reader->submitted == reader->consumed) { // Past the chunk, read on demand
+        if(reader->next_offset >= reader->file_size)
+            return 0; // End of file reached
+
+        size_t tail_len = READ_TAIL_SIZE;
+
+        if(reader->file_size - reader->next_offset < (long)tail_len)
+            tail_len = reader->file_size - reader->next_offset;
+
+        reader_submit(reader, tail_len);
+    }
+
+    ReadSlot* slot = &reader->slots[reader->consumed % READ_QUEUE_DEPTH];
+
+    if(reader->backend == IO_URING) {
+        // Start queued reads without waiting
+        if(reader->ring.to_submit && !ring_enter(&reader->ring, 0)) {
+            reader->error = 1;
+            return 0;
+        }
+
+        reader_reap(reader);
+
+        while(slot->state == SLOT_PENDING) { // Wait for the oldest read
+            if(!ring_enter(&reader->ring, 1)) {
+                reader->error = 1;
+                return 0;
+            }
+
+            reader_reap(reader);
+        }
+    }
+
+    if(slot->result == -EINVAL && slot->fd == reader->direct_fd) { // Direct reads refused, read buffered from now on
+        reader->mode = READ_DROP;
+        slot->skip = 0;
+        slot->result = 0;
+    } else if(slot->result == -EINTR) { // Read again below
+        slot->result = 0;
+    } else if(slot->result < 0) { // Read failed
+        reader->error = 1;
+        return 0;
+    } else { // Bytes of the request, a direct read also covers bytes around it
+        slot->result = (size_t)slot->result > slot->skip ? slot->result - (ssize_t)slot->skip : 0;
+
+        if((size_t)slot->result > slot->len)
+            slot->result = slot->len;
+    }
+
+    // Complete short reads synchronously, later slots depend on the offset
+    while((size_t)slot->result < slot->len) {
+        char* dest = slot->data + slot->skip + slot->result;
+        ssize_t ret = pread(reader->fd, dest, slot->len - slot->result, slot->offset + slot->result);
+
+        if(ret < 0 && errno == EINTR)
+            continue;
+
+        if(ret < 0) { // Read failed
+            reader->error = 1;
+            return 0;
+        }
+
+        if(ret == 0) // File shrank
+            break;
+
+        slot->result += ret;
+    }
+
+    if(slot->result == 0) // Nothing left to read
+        return 0;
+
+    // Hand buffer to consumer
+    *data = slot->data + slot->skip;
+    *len = slot->result;
+    reader->holding = 1;
+    reader->bytes_read += slot->result;
+
+    return 1;
+}
+
+
+char chunk_reader_error(ChunkReader* reader) {
+    if(!reader)
+        return 1;
+
+    return reader->error;
+}
+
+
+IoBackend chunk_reader_backend(ChunkReader* reader) {
+    if(!reader)
+        return IO_AUTO;
+
+    return reader->backend;
+}
+
+
+// Mode reads ended up in, drop when direct was asked for but refused
+ReadMode chunk_reader_mode(ChunkReader* reader) {
+    if(!reader)
+        return READ_BUFFERED;
+
+    return reader->mode;
+}
+
+
+size_t chunk_reader_bytes_read(ChunkReader* reader) {
+    if(!reader)
+        return 0;
+
+    return reader->bytes_read;
+}
+
+
+void chunk_reader_free(ChunkReader* reader) {
+    if(!reader) // Ensure input is non-null
+        return;
+
+    if(reader->backend == IO_URING) {
+        // Kernel may still write to buffers, wait for reads in flight
+        if(reader->ring.to_submit)
+            ring_enter(&reader->ring, 0);
+
+        reader_reap(reader);
+
+        for(unsigned long seq = reader->consumed; seq < reader->submitted; seq++) {
+            while(reader->slots[seq % READ_QUEUE_DEPTH].state == SLOT_PENDING) {
+                if(!ring_enter(&reader->ring, 1))
+                    break;
+
+                reader_reap(reader);
+            }
+        }
+
+        ring_free(&reader->ring);
+    }
+
+    if(reader->direct_fd >= 0) // Closed once no read can use it
+        close(reader->direct_fd);
+
+    free(reader->memory);
+    free(reader);
+}
+
+
+// Bytes of the file at path in the page cache, -1 when they can't be
+// counted. Only files the user owns or may write report their cache.
+long page_cache_resident(const char* path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if(fd < 0)
+        return -1;
+
+    if(fstat(fd, &st)) {
+        close(fd);
+        return -1;
+    }
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    unsigned char* pages = malloc(RESIDENT_WINDOW / page_size);
+    long resident = pages ? 0 : -1;
+
+    // Map a window at a time, mapping alone brings no page in
+    for(off_t offset = 0; resident >= 0 && offset < st.st_size; offset += RESIDENT_WINDOW) {
+        size_t len = st.st_size - offset < RESIDENT_WINDOW ? st.st_size - offset : RESIDENT_WINDOW;
+        void* map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, offset);
+
+        if(map == MAP_FAILED || mincore(map, len, pages)) {
+            resident = -1;
+        } else {
+            for(size_t i = 0; i < (len + page_size - 1) / page_size; i++)
+                resident += pages[i] & 1;
+        }
+
+        if(map != MAP_FAILED)
+            munmap(map, len);
+    }
+
+    free(pages);
+    close(fd);
+
+    if(resident < 0)
+        return -1;
+
+    return resident * page_size < st.st_size ? resident * page_size : st.st_size;
+}
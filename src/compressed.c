@@ -0,0 +1,1054 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "../include/dict.h"
+#include "../include/chunk_reader.h"
+#include "../include/tokenizer.h"
+#include "../include/hot_cache.h"
+#include "../include/build_dict.h"
+#include "../include/compressed.h"
+#include "../include/perf_counters.h"
+
+#define DECODE_BUF_SIZE (256 * 1024) // Decompressed bytes tokenized at once
+#define PIPE_BLOCK_SIZE (1024 * 1024) // Block size of the pipelined decompressor
+#define SCAN_BUF_SIZE (1024 * 1024) // Read size when scanning for gzip headers
+#define GZIP_HEADER_SIZE 10
+
+#define ZSTD_FRAME_MAGIC 0xFD2FB528U
+#define ZSTD_SKIPPABLE_MAGIC 0x184D2A50U
+#define ZSTD_SKIPPABLE_MASK 0xFFFFFFF0U
+
+
+// Growable list of file offsets
+typedef struct {
+    long* items;
+    long len;
+    long capacity;
+} OffsetList;
+
+// Partial words at the edges of a decompressed range
+typedef struct {
+    char* head; // Bytes before the first delimiter
+    size_t head_len;
+    char tail[WORD_BUF_SIZE]; // Unfinished word at the end
+    size_t tail_len;
+    char saw_space; // Range contained a delimiter
+} BlockEdges;
+
+// Streaming decompressor over a range of the file
+typedef struct {
+    InputFormat format;
+    ChunkReader* reader;
+    long end; // Stop at the first member boundary at or after end
+
+    // Compressed input buffer
+    const unsigned char* in;
+    size_t in_len;
+    size_t in_pos;
+    long in_offset; // File offset of in[0]
+    long next_offset;
+
+    z_stream zs;
+    #ifdef HAVE_ZSTD
+    ZSTD_DStream* zds;
+    #endif
+
+    char member_open; // Inside a member or frame
+    char magic_left; // Gzip magic bytes still to match before the next member
+    char done;
+    char error;
+} Decoder;
+
+// Range of members decompressed by one thread
+typedef struct {
+    const char* filepath;
+    InputFormat format;
+    IoBackend io;
+    ReadMode read_mode;
+    Engine engine;
+    int ngram;
+    const WordFilter* filter;
+    char hot_cache;
+    long start;
+    long end;
+
+    Dict* dict;
+    BlockEdges edges;
+    long actual_end; // Where decoding stopped
+    size_t bytes_read;
+    size_t bytes_decoded;
+    size_t cache_lookups;
+    size_t cache_hits;
+    char error;
+} MemberArgs;
+
+// Block of decompressed text passed from decompressor to tokenizers
+typedef struct {
+    char* data;
+    size_t len;
+    size_t seq; // Position of block in the stream
+} Block;
+
+// Queue between the decompressor thread and tokenizer threads
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t ready_cond;
+    pthread_cond_t free_cond;
+
+    Block* blocks;
+    Block** ready; // Filled blocks, FIFO ring
+    size_t ready_head;
+    size_t ready_count;
+    Block** free_blocks;
+    size_t free_count;
+    size_t num_blocks;
+
+    BlockEdges* edges; // Edges of each block, by seq
+    size_t edges_capacity;
+    size_t seq; // Blocks produced
+    size_t bytes_decoded;
+
+    Decoder decoder;
+    char finished;
+    char error;
+} Pipeline;
+
+// Tokenizer thread of the pipeline
+typedef struct {
+    Pipeline* pipe;
+    Engine engine;
+    const WordFilter* filter;
+    char hot_cache;
+    Dict* dict;
+    size_t cache_lookups;
+    size_t cache_hits;
+    char error;
+} PipeWorker;
+
+
+const char* input_format_name(InputFormat format) {
+    switch(format) {
+        case FORMAT_GZIP:
+            return "gzip";
+        case FORMAT_BGZF:
+            return "bgzf";
+        case FORMAT_ZSTD:
+            return "zstd";
+        default:
+            return "plain";
+    }
+}
+
+
+static unsigned read_le16(const unsigned char* p) {
+    return p[0] | (p[1] << 8);
+}
+
+
+static unsigned read_le32(const unsigned char* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+
+static char offsets_push(OffsetList* list, long offset) {
+    if(list->len == list->capacity) { // Grow list
+        long new_capacity = list->capacity ? list->capacity * 2 : 64;
+        long* new_items = realloc(list->items, new_capacity * sizeof(long));
+
+        if(!new_items) // Allocation failed
+            return 0;
+
+        list->items = new_items;
+        list->capacity = new_capacity;
+    }
+
+    list->items[list->len++] = offset;
+
+    return 1;
+}
+
+
+// Find BGZF block size in a gzip header's extra field, returns 0 if absent
+static long bgzf_block_size(const unsigned char* extra, unsigned xlen) {
+    unsigned pos = 0;
+
+    while(pos + 4 <= xlen) { // Walk subfields
+        unsigned slen = read_le16(extra + pos + 2);
+
+        if(extra[pos] == 'B' && extra[pos + 1] == 'C' && slen == 2 && pos + 6 <= xlen)
+            return read_le16(extra + pos + 4) + 1;
+
+        pos += 4 + slen;
+    }
+
+    return 0;
+}
+
+
+static char is_gzip_header(const unsigned char* h) {
+    return h[0] == 0x1f && h[1] == 0x8b && h[2] == 8 && !(h[3] & 0xe0);
+}
+
+
+InputFormat detect_format(const char* filepath) {
+    int fd = open(filepath, O_RDONLY);
+
+    if(fd < 0) // Let the plain reader report the error
+        return FORMAT_PLAIN;
+
+    unsigned char header[GZIP_HEADER_SIZE + 2 + 64];
+    ssize_t len = pread(fd, header, sizeof(header), 0);
+    close(fd);
+
+    if(len >= 4 && read_le32(header) == ZSTD_FRAME_MAGIC)
+        return FORMAT_ZSTD;
+
+    if(len < GZIP_HEADER_SIZE || !is_gzip_header(header))
+        return FORMAT_PLAIN;
+
+    // BGZF stores each block's size in a 'BC' extra subfield
+    if((header[3] & 0x04) && len >= GZIP_HEADER_SIZE + 2) {
+        unsigned xlen = read_le16(header + GZIP_HEADER_SIZE);
+
+        if(xlen <= len - GZIP_HEADER_SIZE - 2 && bgzf_block_size(header + GZIP_HEADER_SIZE + 2, xlen))
+            return FORMAT_BGZF;
+    }
+
+    return FORMAT_GZIP;
+}
+
+
+// Walk BGZF block headers, returns 0 if a block isn't BGZF
+static char bgzf_members(int fd, long file_size, OffsetList* members) {
+    unsigned char header[GZIP_HEADER_SIZE + 2];
+    unsigned char extra[UINT16_MAX];
+    long offset = 0;
+
+    while(offset < file_size) {
+        if(pread(fd, header, sizeof(header), offset) != sizeof(header))
+            return 0;
+
+        if(!is_gzip_header(header) || !(header[3] & 0x04))
+            return 0;
+
+        unsigned xlen = read_le16(header + GZIP_HEADER_SIZE);
+
+        if(pread(fd, extra, xlen, offset + sizeof(header)) != (ssize_t)xlen)
+            return 0;
+
+        long block_size = bgzf_block_size(extra, xlen);
+
+        if(!block_size || !offsets_push(members, offset))
+            return 0;
+
+        offset += block_size;
+    }
+
+    return 1;
+}
+
+
+// Find offsets that look like gzip member headers, checked after decoding
+static char gzip_candidates(int fd, long file_size, OffsetList* members) {
+    unsigned char* buf = malloc(SCAN_BUF_SIZE + GZIP_HEADER_SIZE);
+
+    if(!buf || !offsets_push(members, 0)) {
+        free(buf);
+        return 0;
+    }
+
+    for(long base = 0; base < file_size; base += SCAN_BUF_SIZE) {
+        // Read overlaps next window so headers across windows are seen
+        ssize_t len = pread(fd, buf, SCAN_BUF_SIZE + GZIP_HEADER_SIZE, base);
+
+        if(len < 0) {
+            free(buf);
+            return 0;
+        }
+
+        long limit = len < SCAN_BUF_SIZE ? len : SCAN_BUF_SIZE;
+        unsigned char* p = buf + (base == 0); // First member already listed
+
+        while((p = memchr(p, 0x1f, buf + limit - p))) {
+            long i = p - buf;
+
+            if(i + GZIP_HEADER_SIZE <= len && is_gzip_header(p) &&
+               (p[8] == 0 || p[8] == 2 || p[8] == 4) && (p[9] <= 13 || p[9] == 255)) {
+                if(!offsets_push(members, base + i)) {
+                    free(buf);
+                    return 0;
+                }
+            }
+
+            p++;
+        }
+    }
+
+    free(buf);
+
+    return 1;
+}
+
+
+// Walk zstd frame and block headers to find frame offsets
+static char zstd_frames(int fd, long file_size, OffsetList* members) {
+    unsigned char header[14];
+    long offset = 0;
+
+    while(offset < file_size) {
+        if(pread(fd, header, 8, offset) != 8)
+            return 0;
+
+        unsigned magic = read_le32(header);
+
+        if((magic & ZSTD_SKIPPABLE_MASK) == ZSTD_SKIPPABLE_MAGIC) { // Skip user data
+            offset += 8 + (long)read_le32(header + 4);
+            continue;
+        }
+
+        if(magic != ZSTD_FRAME_MAGIC || !offsets_push(members, offset))
+            return 0;
+
+        // Frame header size from its descriptor
+        unsigned char fhd = header[4];
+        int single_segment = (fhd >> 5) & 1;
+        static const int did_sizes[] = {0, 1, 2, 4};
+        static const int fcs_sizes[] = {0, 2, 4, 8};
+        int fcs_size = fcs_sizes[fhd >> 6];
+
+        if(fcs_size == 0 && single_segment)
+            fcs_size = 1;
+
+        long pos = offset + 5 + !single_segment + did_sizes[fhd & 3] + fcs_size;
+
+        // Walk blocks to the last one
+        while(1) {
+            unsigned char block[3];
+
+            if(pread(fd, block, 3, pos) != 3)
+                return 0;
+
+            unsigned block_header = block[0] | (block[1] << 8) | (block[2] << 16);
+            unsigned block_type = (block_header >> 1) & 3;
+            long block_size = block_header >> 3;
+
+            if(block_type == 3) // Reserved type
+                return 0;
+
+            pos += 3 + (block_type == 1 ? 1 : block_size); // RLE blocks store one byte
+
+            if(block_header & 1) // Last block
+                break;
+        }
+
+        if(fhd & 0x04) // Content checksum
+            pos += 4;
+
+        offset = pos;
+    }
+
+    return 1;
+}
+
+
+static char decoder_init(Decoder* d, int fd, InputFormat format, long start, long end, IoBackend io, ReadMode mode) {
+    memset(d, 0, sizeof(Decoder));
+
+    d->format = format;
+    d->end = end;
+    d->in_offset = start;
+    d->next_offset = start;
+
+    // Input continues past end until the member there ends
+    d->reader = chunk_reader_create(fd, start, end, io, mode);
+
+    if(!d->reader)
+        return 0;
+
+    if(format == FORMAT_ZSTD) {
+        #ifdef HAVE_ZSTD
+        d->zds = ZSTD_createDStream();
+
+        if(!d->zds || ZSTD_isError(ZSTD_initDStream(d->zds))) {
+            ZSTD_freeDStream(d->zds);
+            chunk_reader_free(d->reader);
+            return 0;
+        }
+        #else
+        chunk_reader_free(d->reader);
+        return 0;
+        #endif
+    } else if(inflateInit2(&d->zs, 15 + 16) != Z_OK) { // Decode gzip wrapper
+        chunk_reader_free(d->reader);
+        return 0;
+    }
+
+    return 1;
+}
+
+
+static void decoder_free(Decoder* d) {
+    if(d->format == FORMAT_ZSTD) {
+        #ifdef HAVE_ZSTD
+        ZSTD_freeDStream(d->zds);
+        #endif
+    } else {
+        inflateEnd(&d->zs);
+    }
+
+    chunk_reader_free(d->reader);
+}
+
+
+// File offset of the next compressed byte to decode
+static long decoder_position(Decoder* d) {
+    return d->in_offset + d->in_pos;
+}
+
+
+static char decoder_refill(Decoder* d) {
+    const char* data;
+    size_t len;
+
+    if(!chunk_reader_next(d->reader, &data, &len)) {
+        if(chunk_reader_error(d->reader))
+            d->error = 1;
+
+        return 0;
+    }
+
+    d->in = (const unsigned char*)data;
+    d->in_len = len;
+    d->in_pos = 0;
+    d->in_offset = d->next_offset;
+    d->next_offset += len;
+
+    return 1;
+}
+
+
+// Member or frame ended, stop if the range is done
+static void decoder_member_end(Decoder* d) {
+    d->member_open = 0;
+
+    if(decoder_position(d) >= d->end)
+        d->done = 1;
+    else if(d->format != FORMAT_ZSTD) { // Next member gets a fresh stream
+        inflateReset(&d->zs);
+        d->magic_left = 2;
+    }
+}
+
+
+// Like gzip, bytes after a member that do not start another one are
+// trailing padding and end the stream, returns 0 once they are seen
+static char decoder_next_member(Decoder* d) {
+    static const unsigned char magic[2] = {0x1f, 0x8b};
+
+    // Looked at ahead of inflate, which consumes them with the header
+    for(size_t pos = d->in_pos; d->magic_left && pos < d->in_len; pos++) {
+        if(d->in[pos] != magic[2 - d->magic_left])
+            return 0;
+
+        d->magic_left--;
+    }
+
+    return 1;
+}
+
+
+// Decompress up to cap bytes into out, returns 0 at end of range
+static size_t decoder_read(Decoder* d, char* out, size_t cap) {
+    size_t produced = 0;
+
+    while(produced < cap && !d->done && !d->error) {
+        if(d->in_pos == d->in_len && !decoder_refill(d)) { // Input exhausted
+            if(d->member_open) // Truncated member
+                d->error = 1;
+
+            d->done = 1;
+            break;
+        }
+
+        if(!decoder_next_member(d)) { // Trailing padding, not a member
+            d->done = 1;
+            break;
+        }
+
+        d->member_open = 1;
+
+        if(d->format == FORMAT_ZSTD) {
+            #ifdef HAVE_ZSTD
+            ZSTD_inBuffer in = {d->in, d->in_len, d->in_pos};
+            ZSTD_outBuffer o = {out, cap, produced};
+            size_t ret = ZSTD_decompressStream(d->zds, &o, &in);
+
+            d->in_pos = in.pos;
+            produced = o.pos;
+
+            if(ZSTD_isError(ret))
+                d->error = 1;
+            else if(ret == 0) // Frame decoded and flushed
+                decoder_member_end(d);
+            #else
+            d->error = 1;
+            #endif
+        } else {
+            d->zs.next_in = (Bytef*)(d->in + d->in_pos);
+            d->zs.avail_in = d->in_len - d->in_pos;
+            d->zs.next_out = (Bytef*)(out + produced);
+            d->zs.avail_out = cap - produced;
+
+            int ret = inflate(&d->zs, Z_NO_FLUSH);
+
+            d->in_pos = d->in_len - d->zs.avail_in;
+            produced = cap - d->zs.avail_out;
+
+            if(ret == Z_STREAM_END)
+                decoder_member_end(d);
+            else if(ret != Z_OK && ret != Z_BUF_ERROR)
+                d->error = 1;
+        }
+    }
+
+    return produced;
+}
+
+
+// Move a block scanner's partial words into edges
+static void edges_take(BlockEdges* edges, WordScanner* scan) {
+    edges->head = scan->head;
+    edges->head_len = scan->head_len;
+    memcpy(edges->tail, scan->word, scan->len);
+    edges->tail_len = scan->len;
+    edges->saw_space = scan->saw_space;
+
+    scan->head = NULL; // Edges own head now
+    scan->head_len = 0;
+}
+
+
+// Start a scanner for a block, blocks after the first keep their leading partial word
+static void block_scanner_init(WordScanner* scan, Dict* dict, const WordFilter* filter, char first) {
+    scanner_init(scan, dict);
+    scan->filter = filter;
+
+    if(!first) {
+        scan->skip = 1;
+        scan->keep_head = 1;
+    }
+}
+
+
+// Count words cut by block boundaries, edges in stream order, returns 0 if one failed to count
+static char stitch_edges(Dict* dict, const WordFilter* filter, BlockEdges* edges, size_t count) {
+    WordScanner scan;
+    scanner_init(&scan, dict);
+    scan.filter = filter;
+
+    for(size_t i = 0; i < count; i++) {
+        scanner_feed(&scan, edges[i].head, edges[i].head_len, 0, LONG_MAX);
+
+        if(edges[i].saw_space) // Head was a full word
+            scanner_feed(&scan, " ", 1, 0, LONG_MAX);
+
+        scanner_feed(&scan, edges[i].tail, edges[i].tail_len, 0, LONG_MAX);
+    }
+
+    char ok = scanner_finish(&scan);
+    scanner_free(&scan);
+
+    return ok;
+}
+
+
+// Decompress and tokenize a range of whole members
+static void* member_read(void* arg) {
+    MemberArgs* args = (MemberArgs*)arg;
+    args->error = 1;
+    args->dict = dict_create(args->engine);
+
+    int fd = open(args->filepath, O_RDONLY);
+    char* out = malloc(DECODE_BUF_SIZE);
+    Decoder d;
+
+    if(fd < 0 || !out || !args->dict || !decoder_init(&d, fd, args->format, args->start, args->end, args->io, args->read_mode)) {
+        free(out);
+        if(fd >= 0)
+            close(fd);
+        return NULL;
+    }
+
+    WordScanner scan;
+    block_scanner_init(&scan, args->dict, args->filter, args->start == 0);
+    scan.ngram = args->ngram;
+
+    if(args->hot_cache)
+        scan.cache = hot_cache_create(args->dict);
+
+    size_t len;
+    char ok = 1;
+
+    while(ok && (len = decoder_read(&d, out, DECODE_BUF_SIZE)) > 0) {
+        ok = scanner_feed(&scan, out, len, 0, LONG_MAX);
+        args->bytes_decoded += len;
+    }
+
+    if(scan.ngram > 1) // N-grams are only counted over the whole stream
+        scanner_finish(&scan);
+
+    if(scan.error) // A word failed to count
+        ok = 0;
+
+    if(!hot_cache_close(scan.cache, &args->cache_lookups, &args->cache_hits))
+        ok = 0;
+
+    edges_take(&args->edges, &scan);
+    args->actual_end = decoder_position(&d);
+    args->bytes_read = chunk_reader_bytes_read(d.reader);
+    args->io = chunk_reader_backend(d.reader);
+    args->read_mode = chunk_reader_mode(d.reader);
+    args->error = !ok || d.error;
+
+    scanner_free(&scan);
+    decoder_free(&d);
+    free(out);
+    close(fd);
+
+    return NULL;
+}
+
+
+// Read member range with the calling thread's counters
+static void* member_worker(void* arg) {
+    PerfCounters perf;
+    perf_begin(&perf, PERF_COUNT);
+
+    member_read(arg);
+
+    perf_end(&perf);
+
+    return NULL;
+}
+
+
+// Decompress member ranges in parallel, returns NULL if ranges don't line up
+static Dict** count_members(char* filepath, InputFormat format, const long* starts, long num_parts, const Options* opts, ReadStats* stats) {
+    pthread_t* thread_ids = malloc(num_parts * sizeof(pthread_t));
+    MemberArgs* args = calloc(num_parts, sizeof(MemberArgs));
+
+    if(!thread_ids || !args) { // Allocation failed
+        free(thread_ids);
+        free(args);
+        return NULL;
+    }
+
+    for(long i = 0; i < num_parts; i++) {
+        args[i].filepath = filepath;
+        args[i].format = format;
+        args[i].io = opts->io;
+        args[i].read_mode = opts->read_mode;
+        args[i].engine = opts->engine;
+        args[i].filter = opts->filter;
+        args[i].hot_cache = opts->hot_cache;
+        args[i].ngram = opts->ngram;
+        args[i].start = starts[i];
+        args[i].end = starts[i + 1];
+
+        pthread_create(&thread_ids[i], NULL, member_worker, &args[i]);
+    }
+
+    for(long i = 0; i < num_parts; i++)
+        pthread_join(thread_ids[i], NULL);
+
+    // Each range must end exactly where the next one starts
+    char ok = 1;
+
+    for(long i = 0; i < num_parts; i++) {
+        if(args[i].error || (i + 1 < num_parts && args[i].actual_end != starts[i + 1]))
+            ok = 0;
+    }
+
+    Dict** dicts = ok ? calloc(num_parts, sizeof(Dict*)) : NULL;
+    BlockEdges* edges = ok ? malloc(num_parts * sizeof(BlockEdges)) : NULL;
+
+    if(dicts && edges) {
+        for(long i = 0; i < num_parts; i++) {
+            dicts[i] = args[i].dict;
+            edges[i] = args[i].edges;
+            stats->bytes_read += args[i].bytes_read;
+            stats->bytes_decoded += args[i].bytes_decoded;
+            stats->cache_lookups += args[i].cache_lookups;
+            stats->cache_hits += args[i].cache_hits;
+
+            if(args[i].read_mode > stats->read_mode)
+                stats->read_mode = args[i].read_mode;
+        }
+
+        ok = stitch_edges(dicts[0], opts->filter, edges, num_parts);
+        stats->io = args[0].io;
+        stats->parallel_parts = num_parts;
+    }
+
+    if(!ok || !dicts || !edges) { // Misdetected member header or failure, caller decodes as one stream
+        for(long i = 0; i < num_parts; i++)
+            dict_free(args[i].dict);
+
+        free(dicts);
+        dicts = NULL;
+    }
+
+    for(long i = 0; i < num_parts; i++)
+        free(args[i].edges.head);
+
+    free(edges);
+    free(args);
+    free(thread_ids);
+
+    return dicts;
+}
+
+
+// Decompress stream into blocks for the tokenizer threads
+static void* pipe_decompress(void* arg) {
+    Pipeline* pipe = (Pipeline*)arg;
+
+    PerfCounters perf;
+    perf_begin(&perf, PERF_DECODE);
+
+    while(1) {
+        pthread_mutex_lock(&pipe->lock);
+
+        while(pipe->free_count == 0)
+            pthread_cond_wait(&pipe->free_cond, &pipe->lock);
+
+        Block* block = pipe->free_blocks[--pipe->free_count];
+        pthread_mutex_unlock(&pipe->lock);
+
+        // Fill block outside the lock while tokenizers work
+        block->len = decoder_read(&pipe->decoder, block->data, PIPE_BLOCK_SIZE);
+
+        pthread_mutex_lock(&pipe->lock);
+
+        if(block->len == 0) { // End of stream
+            pipe->free_blocks[pipe->free_count++] = block;
+            pipe->error = pipe->decoder.error;
+            pipe->finished = 1;
+            pthread_cond_broadcast(&pipe->ready_cond);
+            pthread_mutex_unlock(&pipe->lock);
+            break;
+        }
+
+        block->seq = pipe->seq++;
+        pipe->bytes_decoded += block->len;
+        pipe->ready[(pipe->ready_head + pipe->ready_count++) % pipe->num_blocks] = block;
+        pthread_cond_signal(&pipe->ready_cond);
+        pthread_mutex_unlock(&pipe->lock);
+    }
+
+    perf_end(&perf);
+
+    return NULL;
+}
+
+
+// Store edges of block seq, growing the table as needed
+static char pipe_store_edges(Pipeline* pipe, size_t seq, BlockEdges* edges) {
+    if(seq >= pipe->edges_capacity) {
+        size_t new_capacity = pipe->edges_capacity ? pipe->edges_capacity * 2 : 64;
+
+        while(new_capacity <= seq)
+            new_capacity *= 2;
+
+        BlockEdges* new_edges = realloc(pipe->edges, new_capacity * sizeof(BlockEdges));
+
+        if(!new_edges) // Allocation failed
+            return 0;
+
+        // Blocks stored out of order leave gaps, freed at the end as empty edges
+        memset(new_edges + pipe->edges_capacity, 0, (new_capacity - pipe->edges_capacity) * sizeof(BlockEdges));
+        pipe->edges = new_edges;
+        pipe->edges_capacity = new_capacity;
+    }
+
+    pipe->edges[seq] = *edges;
+
+    return 1;
+}
+
+
+// Tokenize blocks from the decompressor
+static void* pipe_tokenize(void* arg) {
+    PipeWorker* worker = (PipeWorker*)arg;
+    Pipeline* pipe = worker->pipe;
+
+    PerfCounters perf;
+    perf_begin(&perf, PERF_COUNT);
+
+    worker->dict = dict_create(worker->engine);
+    worker->error = !worker->dict;
+
+    // One cache for all blocks of the worker, flushed once the stream ends
+    HotCache* cache = worker->hot_cache && worker->dict ? hot_cache_create(worker->dict) : NULL;
+
+    while(1) {
+        pthread_mutex_lock(&pipe->lock);
+
+        while(pipe->ready_count == 0 && !pipe->finished)
+            pthread_cond_wait(&pipe->ready_cond, &pipe->lock);
+
+        if(pipe->ready_count == 0) { // Stream finished
+            pthread_mutex_unlock(&pipe->lock);
+            break;
+        }
+
+        Block* block = pipe->ready[pipe->ready_head];
+        pipe->ready_head = (pipe->ready_head + 1) % pipe->num_blocks;
+        pipe->ready_count--;
+        pthread_mutex_unlock(&pipe->lock);
+
+        WordScanner scan;
+        BlockEdges edges;
+        memset(&edges, 0, sizeof(BlockEdges));
+
+        if(!worker->error) { // After a failure blocks are only drained
+            block_scanner_init(&scan, worker->dict, worker->filter, block->seq == 0);
+            scan.cache = cache;
+            worker->error = !scanner_feed(&scan, block->data, block->len, 0, LONG_MAX);
+            edges_take(&edges, &scan);
+            scanner_free(&scan);
+        }
+
+        pthread_mutex_lock(&pipe->lock);
+
+        if(!pipe_store_edges(pipe, block->seq, &edges)) {
+            free(edges.head);
+            worker->error = 1;
+        }
+
+        pipe->free_blocks[pipe->free_count++] = block;
+        pthread_cond_signal(&pipe->free_cond);
+        pthread_mutex_unlock(&pipe->lock);
+    }
+
+    if(!hot_cache_close(cache, &worker->cache_lookups, &worker->cache_hits))
+        worker->error = 1;
+
+    if(worker->error) { // Report failure
+        pthread_mutex_lock(&pipe->lock);
+        pipe->error = 1;
+        pthread_mutex_unlock(&pipe->lock);
+    }
+
+    perf_end(&perf);
+
+    return NULL;
+}
+
+
+// Decompress on one thread while num_threads threads tokenize its blocks
+static Dict** count_pipeline(char* filepath, InputFormat format, long num_threads, const Options* opts, ReadStats* stats) {
+    int fd = open(filepath, O_RDONLY);
+
+    if(fd < 0)
+        return NULL;
+
+    Pipeline pipe;
+    memset(&pipe, 0, sizeof(Pipeline));
+
+    if(!decoder_init(&pipe.decoder, fd, format, 0, LONG_MAX, opts->io, opts->read_mode)) {
+        close(fd);
+        return NULL;
+    }
+
+    // Two blocks per tokenizer keep them busy while the next is decoded
+    pipe.num_blocks = 2 * num_threads + 1;
+    pipe.blocks = calloc(pipe.num_blocks, sizeof(Block));
+    pipe.ready = malloc(pipe.num_blocks * sizeof(Block*));
+    pipe.free_blocks = malloc(pipe.num_blocks * sizeof(Block*));
+    PipeWorker* workers = calloc(num_threads, sizeof(PipeWorker));
+    pthread_t* thread_ids = malloc(num_threads * sizeof(pthread_t));
+    Dict** dicts = malloc(num_threads * sizeof(Dict*));
+    char ok = pipe.blocks && pipe.ready && pipe.free_blocks && workers && thread_ids && dicts;
+
+    for(size_t i = 0; ok && i < pipe.num_blocks; i++) {
+        pipe.blocks[i].data = malloc(PIPE_BLOCK_SIZE);
+        ok = pipe.blocks[i].data != NULL;
+        pipe.free_blocks[pipe.free_count++] = &pipe.blocks[i];
+    }
+
+    if(ok) {
+        pthread_mutex_init(&pipe.lock, NULL);
+        pthread_cond_init(&pipe.ready_cond, NULL);
+        pthread_cond_init(&pipe.free_cond, NULL);
+
+        pthread_t decompressor;
+        pthread_create(&decompressor, NULL, pipe_decompress, &pipe);
+
+        for(long i = 0; i < num_threads; i++) {
+            workers[i].pipe = &pipe;
+            workers[i].engine = opts->engine;
+            workers[i].filter = opts->filter;
+            workers[i].hot_cache = opts->hot_cache;
+            pthread_create(&thread_ids[i], NULL, pipe_tokenize, &workers[i]);
+        }
+
+        pthread_join(decompressor, NULL);
+
+        for(long i = 0; i < num_threads; i++) {
+            pthread_join(thread_ids[i], NULL);
+            dicts[i] = workers[i].dict;
+        }
+
+        pthread_mutex_destroy(&pipe.lock);
+        pthread_cond_destroy(&pipe.ready_cond);
+        pthread_cond_destroy(&pipe.free_cond);
+
+        ok = !pipe.error;
+
+        if(ok) // Count words split between blocks
+            ok = stitch_edges(dicts[0], opts->filter, pipe.edges, pipe.seq);
+
+        if(ok) {
+
+            stats->bytes_decoded = pipe.bytes_decoded;
+            stats->bytes_read = chunk_reader_bytes_read(pipe.decoder.reader);
+            stats->io = chunk_reader_backend(pipe.decoder.reader);
+            stats->read_mode = chunk_reader_mode(pipe.decoder.reader);
+            stats->parallel_parts = 0;
+
+            for(long i = 0; i < num_threads; i++) {
+                stats->cache_lookups += workers[i].cache_lookups;
+                stats->cache_hits += workers[i].cache_hits;
+            }
+        } else {
+            for(long i = 0; i < num_threads; i++)
+                dict_free(dicts[i]);
+        }
+    }
+
+    // Free pipeline memory, after a failure not every block stored its edges
+    size_t stored = pipe.seq < pipe.edges_capacity ? pipe.seq : pipe.edges_capacity;
+
+    for(size_t i = 0; i < stored; i++)
+        free(pipe.edges[i].head);
+
+    for(size_t i = 0; pipe.blocks && i < pipe.num_blocks; i++)
+        free(pipe.blocks[i].data);
+
+    free(pipe.edges);
+    free(pipe.blocks);
+    free(pipe.ready);
+    free(pipe.free_blocks);
+    free(workers);
+    free(thread_ids);
+    decoder_free(&pipe.decoder);
+    close(fd);
+
+    if(!ok) {
+        free(dicts);
+        return NULL;
+    }
+
+    return dicts;
+}
+
+
+// Split members into at most num_parts ranges of similar compressed size
+static long partition_members(const OffsetList* members, long file_size, long num_parts, long* starts) {
+    long count = 0;
+    long m = 0;
+
+    for(long i = 0; i < num_parts; i++) {
+        long target = file_size / num_parts * i;
+
+        while(m < members->len && members->items[m] < target)
+            m++;
+
+        if(m == members->len)
+            break;
+
+        if(count == 0 || members->items[m] != starts[count - 1])
+            starts[count++] = members->items[m];
+    }
+
+    starts[count] = file_size;
+
+    return count;
+}
+
+
+Dict** count_compressed(char* filepath, InputFormat format, long num_threads, const Options* opts, long* num_dicts, ReadStats* stats) {
+    #ifndef HAVE_ZSTD
+    if(format == FORMAT_ZSTD) {
+        fprintf(stderr, "%s: zstd input not supported by this build\n", filepath);
+        return NULL;
+    }
+    #endif
+
+    int fd = open(filepath, O_RDONLY);
+    struct stat st;
+
+    if(fd < 0 || fstat(fd, &st)) {
+        perror(filepath);
+        if(fd >= 0)
+            close(fd);
+        return NULL;
+    }
+
+    // Find member or frame boundaries to decode in parallel
+    OffsetList members = {NULL, 0, 0};
+    char found = 0;
+
+    if(num_threads > 1 && opts->ngram < 2) {
+        if(format == FORMAT_BGZF)
+            found = bgzf_members(fd, st.st_size, &members);
+
+        if(format == FORMAT_GZIP || (format == FORMAT_BGZF && !found)) {
+            members.len = 0;
+            found = gzip_candidates(fd, st.st_size, &members);
+        }
+
+        if(format == FORMAT_ZSTD)
+            found = zstd_frames(fd, st.st_size, &members);
+    }
+
+    close(fd);
+
+    Dict** dicts = NULL;
+    long* starts = malloc((num_threads + 1) * sizeof(long));
+
+    if(opts->ngram > 1 && starts) { // N-grams span blocks, decode and count as one range
+        starts[0] = 0;
+        starts[1] = st.st_size;
+
+        if((dicts = count_members(filepath, format, starts, 1, opts, stats)))
+            *num_dicts = 1;
+    } else if(found && starts && members.len > 1) {
+        long num_parts = partition_members(&members, st.st_size, num_threads, starts);
+
+        if(num_parts > 1 && (dicts = count_members(filepath, format, starts, num_parts, opts, stats)))
+            *num_dicts = num_parts;
+    }
+
+    free(starts);
+    free(members.items);
+
+    if(!dicts && opts->ngram < 2) { // Single stream, pipelined decompressor
+        memset(stats, 0, sizeof(ReadStats));
+
+        if((dicts = count_pipeline(filepath, format, num_threads, opts, stats)))
+            *num_dicts = num_threads;
+    }
+
+    return dicts;
+}
@@ -0,0 +1,226 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "../include/count_order.h"
+#include "../include/word_arena.h"
+
+// Merged words collected for count-ordered output. Words are copied into
+// an arena since merge cursors only lend them until the next word, then
+// sorted by descending count with ties in word order.
+
+// Fewer entries than this per thread are sorted by a single thread
+#define MIN_ENTRIES_PER_THREAD 16384
+
+struct CountOrder {
+    WordArena arena; // Copies of merged words
+
+    DictEntry* entries;
+    size_t num_entries;
+    size_t capacity;
+};
+
+
+CountOrder* count_order_create() {
+    return calloc(1, sizeof(CountOrder));
+}
+
+
+// Word sink collecting merged words
+char count_order_add(void* ctx, const char* word, unsigned long long count) {
+    CountOrder* order = (CountOrder*)ctx;
+
+    if(!order || !word)
+        return 0; // Invalid input
+
+    if(order->num_entries == order->capacity) { // Grow entry array
+        size_t new_capacity = order->capacity ? order->capacity * 2 : 4096;
+        DictEntry* new_entries = realloc(order->entries, new_capacity * sizeof(DictEntry));
+
+        if(!new_entries) // Allocation failed
+            return 0;
+
+        order->entries = new_entries;
+        order->capacity = new_capacity;
+    }
+
+    const char* copy = word_arena_copy(&order->arena, word, strlen(word) + 1);
+
+    if(!copy) // Allocation failed
+        return 0;
+
+    order->entries[order->num_entries].word = copy;
+    order->entries[order->num_entries].count = count;
+    order->num_entries++;
+
+    return 1;
+}
+
+
+// Higher count first, equal counts in word order
+static int compare_entry(const DictEntry* a, const DictEntry* b) {
+    if(a->count != b->count)
+        return a->count > b->count ? -1 : 1;
+
+    return strcmp(a->word, b->word);
+}
+
+
+static int compare_entry_qsort(const void* a, const void* b) {
+    return compare_entry((const DictEntry*)a, (const DictEntry*)b);
+}
+
+
+// Range of entries handled by one sorting thread
+typedef struct {
+    DictEntry* src;
+    DictEntry* dest;
+    size_t start;
+    size_t mid; // End of first sorted run when merging
+    size_t end;
+} SortRange;
+
+
+static void* sort_range(void* arg) {
+    SortRange* range = (SortRange*)arg;
+    qsort(range->src + range->start, range->end - range->start, sizeof(DictEntry), compare_entry_qsort);
+
+    return NULL;
+}
+
+
+// Merge sorted runs [start, mid) and [mid, end) of src into dest
+static void* merge_range(void* arg) {
+    SortRange* range = (SortRange*)arg;
+    size_t i = range->start, j = range->mid, k = range->start;
+
+    while(i < range->mid && j < range->end) {
+        if(compare_entry(&range->src[j], &range->src[i]) < 0)
+            range->dest[k++] = range->src[j++];
+        else
+            range->dest[k++] = range->src[i++];
+    }
+
+    memcpy(range->dest + k, range->src + i, (range->mid - i) * sizeof(DictEntry));
+    k += range->mid - i;
+    memcpy(range->dest + k, range->src + j, (range->end - j) * sizeof(DictEntry));
+
+    return NULL;
+}
+
+
+// Sort runs in parallel, then merge neighbouring runs pairwise in log2(runs) rounds
+char count_order_sort(CountOrder* order, int num_threads) {
+    if(!order)
+        return 0; // Invalid input
+
+    size_t n = order->num_entries;
+
+    if(num_threads < 1)
+        num_threads = 1;
+    if((size_t)num_threads > n / MIN_ENTRIES_PER_THREAD) // Small inputs sort faster on one thread
+        num_threads = n / MIN_ENTRIES_PER_THREAD > 0 ? n / MIN_ENTRIES_PER_THREAD : 1;
+
+    if(num_threads == 1) {
+        qsort(order->entries, n, sizeof(DictEntry), compare_entry_qsort);
+        return 1;
+    }
+
+    // Run boundaries, run r holds [bounds[r], bounds[r + 1])
+    size_t* bounds = malloc((num_threads + 1) * sizeof(size_t));
+    SortRange* ranges = malloc(num_threads * sizeof(SortRange));
+    pthread_t* thread_ids = malloc(num_threads * sizeof(pthread_t));
+    DictEntry* buffer = malloc(n * sizeof(DictEntry));
+
+    if(!bounds || !ranges || !thread_ids || !buffer) { // Allocation failed
+        free(bounds);
+        free(ranges);
+        free(thread_ids);
+        free(buffer);
+        return 0;
+    }
+
+    for(int r = 0; r <= num_threads; r++)
+        bounds[r] = n * r / num_threads;
+
+    for(int r = 0; r < num_threads; r++) {
+        ranges[r].src = order->entries;
+        ranges[r].start = bounds[r];
+        ranges[r].end = bounds[r + 1];
+        pthread_create(&thread_ids[r], NULL, sort_range, &ranges[r]);
+    }
+
+    for(int r = 0; r < num_threads; r++)
+        pthread_join(thread_ids[r], NULL);
+
+    // Merge rounds alternate between the entries and the buffer
+    DictEntry* src = order->entries;
+    DictEntry* dest = buffer;
+
+    for(int step = 1; step < num_threads; step *= 2) {
+        int num_ranges = 0;
+
+        for(int r = 0; r < num_threads; r += 2 * step) {
+            SortRange* range = &ranges[num_ranges];
+            int mid = r + step < num_threads ? r + step : num_threads;
+            int end = r + 2 * step < num_threads ? r + 2 * step : num_threads;
+
+            range->src = src;
+            range->dest = dest;
+            range->start = bounds[r];
+            range->mid = bounds[mid];
+            range->end = bounds[end];
+            pthread_create(&thread_ids[num_ranges], NULL, merge_range, range);
+            num_ranges++;
+        }
+
+        for(int r = 0; r < num_ranges; r++)
+            pthread_join(thread_ids[r], NULL);
+
+        DictEntry* swap = src;
+        src = dest;
+        dest = swap;
+    }
+
+    if(src != order->entries) { // Sorted entries ended in the buffer
+        free(order->entries);
+        order->entries = src;
+        order->capacity = n;
+    } else {
+        free(buffer);
+    }
+
+    free(bounds);
+    free(ranges);
+    free(thread_ids);
+
+    return 1;
+}
+
+
+size_t count_order_size(const CountOrder* order) {
+    return order ? order->num_entries : 0;
+}
+
+
+// Print entries in their current order, in the format of print_dict
+char count_order_print(const CountOrder* order, FILE* out) {
+    if(!order || !out)
+        return 0; // Invalid input
+
+    for(size_t i = 0; i < order->num_entries; i++) {
+        if(fprintf(out, "%s: %llu\n", order->entries[i].word, order->entries[i].count) < 0)
+            return 0;
+    }
+
+    return fflush(out) == 0;
+}
+
+
+void count_order_free(CountOrder* order) {
+    if(!order) // Ensure non-null input
+        return;
+
+    word_arena_free(&order->arena);
+    free(order->entries);
+    free(order);
+}
@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "../include/count_tree.h"
+
+// AVL tree from strings to counters. Same balancing as Tree, but keys
+// are compared inline, the counter lives in the node and nodes are
+// carved from large blocks instead of allocated one at a time.
+
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+
+// AVL height bound for any tree that fits in memory
+#define MAX_HEIGHT 96
+
+// Node block size when no reservation covers the next node
+#define NODE_BLOCK_SIZE (256 * 1024)
+
+typedef struct CountNode CountNode;
+
+struct CountNode {
+    CountNode* left;
+    CountNode* right;
+    uint64_t count;
+    uint32_t key_size; // Includes terminating null
+    uint8_t height;
+    char key[];
+};
+
+// Block nodes are carved from
+typedef struct NodeBlock {
+    struct NodeBlock* next;
+    size_t used;
+    size_t size;
+    char data[];
+} NodeBlock;
+
+struct CountTree {
+    CountNode* root;
+    size_t size; // Number of keys
+    NodeBlock* blocks; // Most recent block first
+    size_t memory; // Bytes of the tree and its blocks
+};
+
+struct CountTreeIter {
+    CountNode* stack[MAX_HEIGHT];
+    int stack_size;
+};
+
+
+static inline uint8_t height(const CountNode* node) {
+    return node ? node->height : 0;
+}
+
+
+static inline void update_height(CountNode* node) {
+    node->height = 1 + MAX(height(node->left), height(node->right));
+}
+
+
+static CountNode* rotate_left(CountNode* node) {
+    CountNode* r = node->right;
+
+    node->right = r->left;
+    r->left = node;
+
+    update_height(node);
+    update_height(r);
+
+    return r;
+}
+
+
+static CountNode* rotate_right(CountNode* node) {
+    CountNode* l = node->left;
+
+    node->left = l->right;
+    l->right = node;
+
+    update_height(node);
+    update_height(l);
+
+    return l;
+}
+
+
+static CountNode* balance(CountNode* node) {
+    update_height(node);
+
+    int balance_factor = (int)height(node->left) - (int)height(node->right);
+
+    if(balance_factor > 1) { // Left heavy
+        if(height(node->left->left) < height(node->left->right)) // LR case
+            node->left = rotate_left(node->left);
+
+        return rotate_right(node);
+    }
+
+    if(balance_factor < -1) { // Right heavy
+        if(height(node->right->right) < height(node->right->left)) // RL case
+            node->right = rotate_right(node->right);
+
+        return rotate_left(node);
+    }
+
+    return node; // Already balanced
+}
+
+
+// Keys carry their null, so comparing through the shorter null orders like strcmp
+static inline int key_compare(const char* key, size_t key_size, const CountNode* node) {
+    if((unsigned char)key[0] != (unsigned char)node->key[0]) // Most comparisons end here
+        return (unsigned char)key[0] - (unsigned char)node->key[0];
+
+    return memcmp(key, node->key, key_size < node->key_size ? key_size : node->key_size);
+}
+
+
+CountTree* count_tree_create() {
+    CountTree* tree = malloc(sizeof(CountTree)); // Allocate memory
+
+    if(!tree) // Allocation failed
+        return NULL;
+
+    tree->root = NULL;
+    tree->size = 0;
+    tree->blocks = NULL;
+    tree->memory = sizeof(CountTree);
+
+    return tree;
+}
+
+
+// Start a node block of at least size bytes
+static char block_add(CountTree* tree, size_t size) {
+    NodeBlock* block = malloc(sizeof(NodeBlock) + size);
+
+    if(!block) // Allocation failed
+        return 0;
+
+    block->next = tree->blocks;
+    block->used = 0;
+    block->size = size;
+    tree->blocks = block;
+    tree->memory += sizeof(NodeBlock) + size;
+
+    return 1;
+}
+
+
+// Space for a node holding key_size key bytes
+static CountNode* node_alloc(CountTree* tree, size_t key_size) {
+    size_t size = (sizeof(CountNode) + key_size + 7) & ~(size_t)7; // Keep nodes aligned
+    NodeBlock* block = tree->blocks;
+
+    if(!block || block->used + size > block->size) { // Start new block
+        if(!block_add(tree, size > NODE_BLOCK_SIZE ? size : NODE_BLOCK_SIZE))
+            return NULL;
+
+        block = tree->blocks;
+    }
+
+    CountNode* node = (CountNode*)(block->data + block->used);
+    block->used += size;
+
+    return node;
+}
+
+
+// Allocate space for num_keys keys of about key_size bytes up front
+char count_tree_reserve(CountTree* tree, size_t num_keys, size_t key_size) {
+    if(!tree)
+        return 0; // Invalid input
+
+    size_t size = num_keys * ((sizeof(CountNode) + key_size + 7) & ~(size_t)7);
+
+    if(size <= NODE_BLOCK_SIZE) // Regular blocks suffice
+        return 1;
+
+    return block_add(tree, size);
+}
+
+
+// Find or add key, returns its counter (0 when new)
+uint64_t* count_tree_upsert(CountTree* tree, const char* key, size_t key_size) {
+    if(!tree || !key || key_size == 0 || key_size > UINT32_MAX)
+        return NULL; // Invalid input
+
+    // Links followed from the root, rebalanced bottom up after an insert
+    CountNode** path[MAX_HEIGHT];
+    int depth = 0;
+    CountNode** link = &tree->root;
+
+    while(*link) {
+        CountNode* node = *link;
+        int cmp = key_compare(key, key_size, node);
+
+        if(cmp == 0) // Key found
+            return &node->count;
+
+        path[depth++] = link;
+        link = cmp < 0 ? &node->left : &node->right;
+    }
+
+    CountNode* node = node_alloc(tree, key_size);
+
+    if(!node) // Allocation failed
+        return NULL;
+
+    node->left = NULL;
+    node->right = NULL;
+    node->count = 0;
+    node->key_size = key_size;
+    node->height = 1;
+    memcpy(node->key, key, key_size);
+
+    *link = node;
+    tree->size++;
+
+    // Heights above an unchanged subtree stay the same
+    while(depth--) {
+        CountNode** parent = path[depth];
+        uint8_t old_height = (*parent)->height;
+
+        *parent = balance(*parent);
+
+        if((*parent)->height == old_height)
+            break;
+    }
+
+    return &node->count;
+}
+
+
+size_t count_tree_size(CountTree* tree) {
+    if(!tree)
+        return 0;
+
+    return tree->size;
+}
+
+
+// Bytes held by the tree, reserved block space included
+size_t count_tree_memory(CountTree* tree) {
+    return tree ? tree->memory : 0;
+}
+
+
+void count_tree_free(CountTree* tree) {
+    if(!tree) // Ensure tree is not null
+        return;
+
+    NodeBlock* block = tree->blocks;
+
+    while(block) { // Nodes live in blocks
+        NodeBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+
+    free(tree);
+}
+
+
+static void iter_push_left(CountTreeIter* iter, CountNode* node) {
+    while(node) { // Push node and all left children
+        iter->stack[iter->stack_size++] = node;
+        node = node->left;
+    }
+}
+
+
+CountTreeIter* count_tree_iter_create(CountTree* tree) {
+    if(!tree) // Ensure non-null input
+        return NULL;
+
+    CountTreeIter* iter = malloc(sizeof(CountTreeIter));
+
+    if(!iter) // Allocation failed
+        return NULL;
+
+    iter->stack_size = 0;
+    iter_push_left(iter, tree->root);
+
+    return iter;
+}
+
+
+// Next key in order, key is owned by the tree
+char count_tree_iter_next(CountTreeIter* iter, const char** key, uint64_t* count) {
+    if(!iter || !key || iter->stack_size < 1)
+        return 0;
+
+    CountNode* next = iter->stack[--iter->stack_size];
+
+    *key = next->key;
+
+    if(count)
+        *count = next->count;
+
+    iter_push_left(iter, next->right);
+
+    return 1;
+}
+
+
+void count_tree_iter_free(CountTreeIter* iter) {
+    free(iter);
+}
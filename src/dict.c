@@ -0,0 +1,711 @@
+#include <stdio.h>
+#include <string.h>
+#include "../include/tree.h"
+#include "../include/art.h"
+#include "../include/sort_dict.h"
+#include "../include/count_tree.h"
+#include "../include/build_dict.h"
+#include "../include/dict.h"
+
+// Entries read from a tree per batch call
+#define TREE_BATCH_SIZE 64
+
+// Iterator over any engine, words come out in strcmp order
+struct DictIter {
+    const DictBackend* backend;
+    void* impl;
+    size_t pos; // Words returned so far, read in place by sorted engines
+
+    Dict* drain; // Dictionary released as its words pass, NULL when only read
+    char exhausted; // Last word returned, released on the next call
+};
+
+
+// Balanced tree of whole keys, values are allocated counts
+
+static void* avl_create(void) {
+    return tree_create(compare_str);
+}
+
+
+static char avl_increment(void* impl, const char* word, size_t word_size, unsigned long long count) {
+    unsigned long long* total = tree_upsert(impl, word, word_size, sizeof(unsigned long long));
+
+    if(!total) // Allocation failed
+        return 0;
+
+    *total += count;
+    return 1;
+}
+
+
+static void* avl_merge(void* a, void* b) {
+    return tree_merge(a, b, merge_word_count);
+}
+
+
+static size_t avl_size(void* impl) {
+    return tree_size(impl);
+}
+
+
+static size_t avl_memory(void* impl) {
+    return tree_memory(impl);
+}
+
+
+static void avl_free(void* impl) {
+    tree_free(impl);
+}
+
+
+static void* avl_iter_create(void* impl) {
+    return tree_iter_create(impl);
+}
+
+
+static void* avl_drain_create(void* impl) {
+    return tree_drain_create(impl);
+}
+
+
+static char avl_iter_next(void* iter, size_t pos, const char** word, unsigned long long* count) {
+    (void)pos;
+
+    void* key;
+    void* val;
+
+    if(!tree_iter_next(iter, &key, NULL, &val, NULL))
+        return 0;
+
+    *word = key;
+    *count = *(unsigned long long*)val;
+
+    return 1;
+}
+
+
+// Trees hand out entries in batches and free their own passed nodes
+static size_t avl_iter_next_batch(void* iter, DictEntry* entries, size_t max, char drain) {
+    TreeEntry batch[TREE_BATCH_SIZE];
+    size_t filled = 0;
+
+    if(drain && max > TREE_BATCH_SIZE) // Each tree call frees the nodes of the one before
+        max = TREE_BATCH_SIZE;
+
+    while(filled < max) {
+        size_t want = max - filled < TREE_BATCH_SIZE ? max - filled : TREE_BATCH_SIZE;
+        size_t got = tree_iter_next_batch(iter, batch, want);
+
+        for(size_t i = 0; i < got; i++) {
+            entries[filled + i].word = batch[i].key;
+            entries[filled + i].count = *(const unsigned long long*)batch[i].val;
+        }
+
+        filled += got;
+
+        if(got < want) // Tree exhausted
+            break;
+    }
+
+    return filled;
+}
+
+
+static void avl_iter_free(void* iter) {
+    tree_iter_free(iter);
+}
+
+
+// Adaptive radix tree, keys are rebuilt into one buffer per iterator
+
+static void* art_backend_create(void) {
+    return art_create();
+}
+
+
+static char art_increment(void* impl, const char* word, size_t word_size, unsigned long long count) {
+    uint64_t* total = art_upsert(impl, (const unsigned char*)word, word_size);
+
+    if(!total) // Allocation failed
+        return 0;
+
+    *total += count;
+    return 1;
+}
+
+
+static size_t art_backend_size(void* impl) {
+    return art_size(impl);
+}
+
+
+static size_t art_backend_memory(void* impl) {
+    return art_memory(impl);
+}
+
+
+static void art_backend_free(void* impl) {
+    art_free(impl);
+}
+
+
+static void* art_backend_iter_create(void* impl) {
+    return art_iter_create(impl);
+}
+
+
+static void* art_backend_drain_create(void* impl) {
+    return art_drain_create(impl);
+}
+
+
+static char art_backend_iter_next(void* iter, size_t pos, const char** word, unsigned long long* count) {
+    (void)pos;
+
+    const unsigned char* key;
+    size_t key_size;
+    uint64_t art_count;
+
+    if(!art_iter_next(iter, &key, &key_size, &art_count))
+        return 0;
+
+    *word = (const char*)key; // Keys are stored with their null
+    *count = art_count;
+
+    return 1;
+}
+
+
+static void art_backend_iter_free(void* iter) {
+    art_iter_free(iter);
+}
+
+
+// Sorted token array, counted when first read
+
+static void* sort_create(void) {
+    return sort_dict_create();
+}
+
+
+static char sort_reserve(void* impl, size_t num_tokens, size_t num_distinct, size_t key_size) {
+    (void)num_distinct;
+    (void)key_size;
+
+    return sort_dict_reserve(impl, num_tokens);
+}
+
+
+static char sort_increment(void* impl, const char* word, size_t word_size, unsigned long long count) {
+    return sort_dict_add_count(impl, word, word_size, count);
+}
+
+
+static void* sort_merge(void* a, void* b) {
+    return sort_dict_merge(a, b);
+}
+
+
+// Distinct words are known once sorted
+static size_t sort_size(void* impl) {
+    return sort_dict_finish(impl) ? sort_dict_size(impl) : 0;
+}
+
+
+static size_t sort_memory(void* impl) {
+    return sort_dict_memory(impl);
+}
+
+
+static void sort_free(void* impl) {
+    sort_dict_free(impl);
+}
+
+
+// Sort and count tokens before reading, words are read in place
+static void* sort_iter_create(void* impl) {
+    return sort_dict_finish(impl) ? impl : NULL;
+}
+
+
+static char sort_iter_next(void* iter, size_t pos, const char** word, unsigned long long* count) {
+    uint64_t sort_count;
+
+    if(!sort_dict_get(iter, pos, word, &sort_count))
+        return 0;
+
+    *count = sort_count;
+    return 1;
+}
+
+
+// Balanced tree specialized for counting strings
+
+static void* ctree_create(void) {
+    return count_tree_create();
+}
+
+
+static char ctree_reserve(void* impl, size_t num_tokens, size_t num_distinct, size_t key_size) {
+    (void)num_tokens;
+
+    return count_tree_reserve(impl, num_distinct, key_size);
+}
+
+
+static char ctree_increment(void* impl, const char* word, size_t word_size, unsigned long long count) {
+    uint64_t* total = count_tree_upsert(impl, word, word_size);
+
+    if(!total) // Allocation failed
+        return 0;
+
+    *total += count;
+    return 1;
+}
+
+
+static size_t ctree_size(void* impl) {
+    return count_tree_size(impl);
+}
+
+
+static size_t ctree_memory(void* impl) {
+    return count_tree_memory(impl);
+}
+
+
+static void ctree_free(void* impl) {
+    count_tree_free(impl);
+}
+
+
+static void* ctree_iter_create(void* impl) {
+    return count_tree_iter_create(impl);
+}
+
+
+static char ctree_iter_next(void* iter, size_t pos, const char** word, unsigned long long* count) {
+    (void)pos;
+
+    uint64_t tree_count;
+
+    if(!count_tree_iter_next(iter, word, &tree_count))
+        return 0;
+
+    *count = tree_count;
+    return 1;
+}
+
+
+static void ctree_iter_free(void* iter) {
+    count_tree_iter_free(iter);
+}
+
+
+// Counts by dense word ID, IDs of its own unless made by dict_create_ids
+
+static void* ids_create(void) {
+    return id_counter_create(NULL, NULL);
+}
+
+
+static char ids_increment(void* impl, const char* word, size_t word_size, unsigned long long count) {
+    if(count == 1)
+        return id_counter_add(impl, word, word_size);
+
+    return id_counter_add_count(impl, word, word_size, count);
+}
+
+
+static void* ids_merge(void* a, void* b) {
+    return id_counter_merge(a, b);
+}
+
+
+static size_t ids_size(void* impl) {
+    return id_counter_size(impl);
+}
+
+
+static size_t ids_memory(void* impl) {
+    return id_counter_memory(impl);
+}
+
+
+static void ids_free(void* impl) {
+    id_counter_free(impl);
+}
+
+
+static char ids_close_stream(void* impl) {
+    return id_counter_close_stream(impl);
+}
+
+
+static char ids_write_vocab(void* impl, const char* path) {
+    return id_counter_write_vocab(impl, path);
+}
+
+
+// Sort counted words before reading, words are read in place
+static void* ids_iter_create(void* impl) {
+    return id_counter_finish(impl) ? impl : NULL;
+}
+
+
+static char ids_iter_next(void* iter, size_t pos, const char** word, unsigned long long* count) {
+    uint64_t id_count;
+
+    if(!id_counter_get(iter, pos, word, &id_count))
+        return 0;
+
+    *count = id_count;
+    return 1;
+}
+
+
+static const DictBackend avl_backend = {
+    "avl", avl_create, NULL, avl_increment, avl_merge, avl_size, avl_memory, avl_free, NULL, NULL,
+    avl_iter_create, avl_drain_create, avl_iter_next, avl_iter_next_batch, avl_iter_free, 0
+};
+
+static const DictBackend art_backend = {
+    "art", art_backend_create, NULL, art_increment, NULL, art_backend_size, art_backend_memory,
+    art_backend_free, NULL, NULL, art_backend_iter_create, art_backend_drain_create, art_backend_iter_next,
+    NULL, art_backend_iter_free, 1
+};
+
+static const DictBackend sort_backend = {
+    "sort", sort_create, sort_reserve, sort_increment, sort_merge, sort_size, sort_memory, sort_free, NULL, NULL,
+    sort_iter_create, NULL, sort_iter_next, NULL, NULL, 0
+};
+
+static const DictBackend ctree_backend = {
+    "ctree", ctree_create, ctree_reserve, ctree_increment, NULL, ctree_size, ctree_memory, ctree_free, NULL, NULL,
+    ctree_iter_create, NULL, ctree_iter_next, NULL, ctree_iter_free, 0
+};
+
+static const DictBackend ids_backend = {
+    "ids", ids_create, NULL, ids_increment, ids_merge, ids_size, ids_memory, ids_free, ids_close_stream,
+    ids_write_vocab, ids_iter_create, NULL, ids_iter_next, NULL, NULL, 0
+};
+
+// Registered engines by Engine value, a new one needs an enum value and an entry
+static const DictBackend* const backends[] = {
+    [ENGINE_AVL] = &avl_backend,
+    [ENGINE_ART] = &art_backend,
+    [ENGINE_SORT] = &sort_backend,
+    [ENGINE_CTREE] = &ctree_backend,
+    [ENGINE_IDS] = &ids_backend,
+};
+
+#define NUM_BACKENDS (sizeof(backends) / sizeof(backends[0]))
+
+
+// Backend of engine, NULL past the last one registered
+const DictBackend* dict_backend(Engine engine) {
+    return (size_t)engine < NUM_BACKENDS ? backends[engine] : NULL;
+}
+
+
+// Wrap impl of engine, impl is freed when wrapping fails
+static Dict* dict_wrap(Engine engine, void* impl) {
+    const DictBackend* backend = dict_backend(engine);
+    Dict* dict = impl ? malloc(sizeof(Dict)) : NULL;
+
+    if(!dict) { // Allocation failed
+        if(impl)
+            backend->free(impl);
+        return NULL;
+    }
+
+    dict->engine = engine;
+    dict->backend = backend;
+    dict->impl = impl;
+
+    return dict;
+}
+
+
+Dict* dict_create(Engine engine) {
+    const DictBackend* backend = dict_backend(engine);
+
+    if(!backend) // Unknown engine
+        return NULL;
+
+    return dict_wrap(engine, backend->create());
+}
+
+
+// ID dictionary numbering words through interner, shared with the other
+// dictionaries of a count. With stream_path the ID of each token is
+// written there in input order.
+Dict* dict_create_ids(Interner* interner, const char* stream_path) {
+    return dict_wrap(ENGINE_IDS, id_counter_create(interner, stream_path));
+}
+
+
+// Finish the ID stream of an ID dictionary, other engines have none
+char dict_close_stream(Dict* dict) {
+    if(!dict)
+        return 0;
+
+    if(!dict->backend->close_stream)
+        return 1;
+
+    return dict->backend->close_stream(dict->impl);
+}
+
+
+// Write the words of an ID dictionary by ID with their totals, one per
+// line, returns 0 for engines without word IDs
+char dict_write_vocab(Dict* dict, const char* path) {
+    if(!dict || !path || !dict->backend->write_vocab)
+        return 0;
+
+    return dict->backend->write_vocab(dict->impl, path);
+}
+
+
+// Size dictionary for expected tokens and distinct words of about
+// key_size bytes, engines without a use for the hint ignore it
+char dict_reserve(Dict* dict, size_t num_tokens, size_t num_distinct, size_t key_size) {
+    if(!dict)
+        return 0;
+
+    if(!dict->backend->reserve)
+        return 1;
+
+    return dict->backend->reserve(dict->impl, num_tokens, num_distinct, key_size);
+}
+
+
+// Count word, word_size includes the terminating null
+char dict_add(Dict* dict, const char* word, size_t word_size) {
+    if(!dict || !word)
+        return 0;
+
+    return dict->backend->increment(dict->impl, word, word_size, 1);
+}
+
+
+// Count word count times at once
+char dict_add_count(Dict* dict, const char* word, size_t word_size, unsigned long long count) {
+    if(!dict || !word || count == 0)
+        return 0;
+
+    return dict->backend->increment(dict->impl, word, word_size, count);
+}
+
+
+size_t dict_size(Dict* dict) {
+    if(!dict)
+        return 0;
+
+    return dict->backend->size(dict->impl);
+}
+
+
+// Bytes the engine holds for its words and counts
+size_t dict_memory_used(Dict* dict) {
+    if(!dict || !dict->impl)
+        return 0;
+
+    return dict->backend->memory_used(dict->impl);
+}
+
+
+// Move all words of b into a, b is freed. Trees and sorted runs merge
+// in linear time, ID counts add by ID, other engines add b's words to a
+// one at a time
+Dict* dict_merge(Dict* a, Dict* b) {
+    if(!a || !b || a->engine != b->engine)
+        return NULL;
+
+    if(a->backend->merge) {
+        if(!a->backend->merge(a->impl, b->impl)) // Allocation failed
+            return NULL;
+
+        free(b); // Contents now belong to a
+        return a;
+    }
+
+    DictIter* iter = dict_iter_create(b);
+    unsigned long long count;
+    char* word;
+
+    if(!iter) // Allocation failed
+        return NULL;
+
+    while((word = dict_iter_next(iter, &count))) {
+        if(!a->backend->increment(a->impl, word, strlen(word) + 1, count)) { // Allocation failed
+            dict_iter_free(iter);
+            return NULL;
+        }
+    }
+
+    dict_iter_free(iter);
+    dict_free(b);
+
+    return a;
+}
+
+
+void dict_free(Dict* dict) {
+    if(!dict) // Ensure non-null input
+        return;
+
+    if(dict->impl) // Drained engines are already released
+        dict->backend->free(dict->impl);
+
+    free(dict);
+}
+
+
+static DictIter* iter_create(Dict* dict, char drain) {
+    if(!dict) // Ensure non-null input
+        return NULL;
+
+    DictIter* iter = malloc(sizeof(DictIter));
+
+    if(!iter) // Allocation failed
+        return NULL;
+
+    const DictBackend* backend = dict->backend;
+
+    iter->backend = backend;
+    iter->pos = 0;
+    iter->drain = drain ? dict : NULL;
+    iter->exhausted = 0;
+    iter->impl = drain && backend->drain_create ? backend->drain_create(dict->impl) : backend->iter_create(dict->impl);
+
+    if(!iter->impl) { // Allocation failed
+        free(iter);
+        return NULL;
+    }
+
+    return iter;
+}
+
+
+DictIter* dict_iter_create(Dict* dict) {
+    return iter_create(dict, 0);
+}
+
+
+// Iterator that frees the words of dict once the caller moves past them,
+// so what the merge allocates reuses their memory. Trees free node by
+// node, the sorted, ctree and ID engines all at once after their last
+// word. Afterwards dict may only be freed.
+DictIter* dict_drain_create(Dict* dict) {
+    return iter_create(dict, 1);
+}
+
+
+// Free what a drained engine still holds once its words are passed
+static void drain_release(DictIter* iter) {
+    Dict* dict = iter->drain;
+
+    if(iter->backend->drain_create) // Emptied when the drain started
+        return;
+
+    iter->backend->free(dict->impl);
+    dict->impl = NULL;
+
+    if(!iter->backend->iter_free) // Was read in place
+        iter->impl = NULL;
+}
+
+
+// Next word or NULL when done, word is valid until the next call
+char* dict_iter_next(DictIter* iter, unsigned long long* count) {
+    if(!iter || !iter->impl)
+        return NULL;
+
+    if(iter->exhausted) { // Caller is done with the last word
+        if(iter->drain && iter->drain->impl)
+            drain_release(iter);
+        return NULL;
+    }
+
+    const char* word;
+    unsigned long long word_count;
+
+    if(!iter->backend->iter_next(iter->impl, iter->pos, &word, &word_count)) {
+        iter->exhausted = 1;
+        return NULL;
+    }
+
+    iter->pos++;
+
+    if(count)
+        *count = word_count;
+
+    return (char*)word;
+}
+
+
+// Fill entries with up to max next words, returns number filled.
+// Words stay valid until the dictionary is freed, or the next call when
+// draining, except for engines that rebuild the word per call, such as
+// art, where only one entry is returned.
+size_t dict_iter_next_batch(DictIter* iter, DictEntry* entries, size_t max) {
+    if(!iter || !entries)
+        return 0;
+
+    if(iter->backend->iter_next_batch)
+        return iter->backend->iter_next_batch(iter->impl, entries, max, iter->drain != NULL);
+
+    size_t filled = 0;
+
+    while(filled < max) {
+        unsigned long long count;
+        char* word = dict_iter_next(iter, &count);
+
+        if(!word)
+            break;
+
+        entries[filled].word = word;
+        entries[filled].count = count;
+        filled++;
+
+        if(iter->backend->reuses_word) // Next call overwrites word
+            break;
+    }
+
+    return filled;
+}
+
+
+void dict_iter_free(DictIter* iter) {
+    if(!iter) // Ensure non-null input
+        return;
+
+    if(iter->drain && iter->drain->impl) // Stopped early or before the release
+        drain_release(iter);
+
+    if(iter->impl && iter->backend->iter_free)
+        iter->backend->iter_free(iter->impl);
+
+    free(iter);
+}
+
+
+const char* engine_name(Engine engine) {
+    const DictBackend* backend = dict_backend(engine);
+
+    return backend ? backend->name : "avl";
+}
+
+
+char engine_parse(const char* name, Engine* engine) {
+    for(size_t i = 0; i < NUM_BACKENDS; i++) {
+        if(!strcmp(name, backends[i]->name)) {
+            *engine = (Engine)i;
+            return 1;
+        }
+    }
+
+    return 0; // Unknown engine
+}
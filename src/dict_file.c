@@ -0,0 +1,438 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "../include/dict_file.h"
+
+// Block-compressed dictionaries. Records keep their word order but each
+// word stores only what differs from the previous word of its block, and
+// lengths and counts are varints instead of 8-byte integers. Blocks start
+// afresh, so a directory of block offsets at the end of the file lets
+// every block be decoded by a different thread.
+//
+// Record: varint shared prefix length, varint suffix length, suffix
+// bytes, varint count.
+
+// Blocks each thread decodes per round when printing
+#define BLOCKS_PER_TASK 8
+
+// Bytes of text reserved per record before a round's buffer grows
+#define TEXT_RECORD_GUESS 32
+
+// Share of a decode given to one thread
+typedef struct {
+    const BlockDict* dict;
+    size_t first; // First block
+    size_t count;
+
+    char* raw; // Plain records written here when loading, NULL when printing
+
+    // Printed words when printing
+    char* text;
+    size_t text_len;
+    size_t text_capacity;
+
+    char ok;
+} DecodeTask;
+
+
+static size_t put_varint(char* dest, uint64_t value) {
+    size_t n = 0;
+
+    while(value >= 0x80) {
+        dest[n++] = (char)(value | 0x80);
+        value >>= 7;
+    }
+
+    dest[n++] = (char)value;
+
+    return n;
+}
+
+
+// Read varint at *pos before end, returns 0 if it runs past end
+static char get_varint(const unsigned char* data, size_t end, size_t* pos, uint64_t* value) {
+    uint64_t result = 0;
+
+    for(int shift = 0; shift < 64 && *pos < end; shift += 7) {
+        unsigned char byte = data[(*pos)++];
+        result |= (uint64_t)(byte & 0x7f) << shift;
+
+        if(!(byte & 0x80)) {
+            *value = result;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+// Encode record of word after prev in the same block into dest, which
+// holds at least len + DICT_RECORD_OVERHEAD bytes. Returns bytes written.
+// The first record of a block passes a prev_len of 0.
+size_t dict_block_encode(char* dest, const char* prev, size_t prev_len,
+                         const char* word, size_t len, unsigned long long count) {
+    size_t shared = 0;
+
+    while(shared < prev_len && shared < len && prev[shared] == word[shared])
+        shared++;
+
+    size_t n = put_varint(dest, shared);
+    n += put_varint(dest + n, len - shared);
+    memcpy(dest + n, word + shared, len - shared);
+    n += len - shared;
+    n += put_varint(dest + n, count);
+
+    return n;
+}
+
+
+// Whether the file at fd starts as a block-compressed dictionary
+char dict_file_blocked(int fd) {
+    char magic[DICT_MAGIC_SIZE];
+
+    return pread(fd, magic, DICT_MAGIC_SIZE, 0) == DICT_MAGIC_SIZE &&
+           !memcmp(magic, DICT_BLOCK_MAGIC, DICT_MAGIC_SIZE);
+}
+
+
+// Read len bytes at offset
+static char pread_full(int fd, void* buf, size_t len, uint64_t offset) {
+    char* dest = (char*)buf;
+
+    while(len > 0) {
+        ssize_t n = pread(fd, dest, len, offset);
+
+        if(n <= 0)
+            return 0;
+
+        dest += n;
+        len -= n;
+        offset += n;
+    }
+
+    return 1;
+}
+
+
+// Read the directory of the block-compressed dictionary at fd, NULL if
+// the file isn't one or is truncated. The caller keeps fd open.
+BlockDict* block_dict_open(int fd) {
+    struct stat st;
+    DictFooter footer;
+
+    if(fstat(fd, &st) || (uint64_t)st.st_size < DICT_MAGIC_SIZE + sizeof(DictFooter) ||
+       !pread_full(fd, &footer, sizeof(footer), st.st_size - sizeof(footer)) ||
+       memcmp(footer.magic, DICT_BLOCK_MAGIC, DICT_MAGIC_SIZE))
+        return NULL;
+
+    uint64_t directory_size = footer.num_blocks * sizeof(DictBlock);
+
+    if(footer.directory_offset < DICT_MAGIC_SIZE || footer.num_blocks > st.st_size / sizeof(DictBlock) ||
+       footer.directory_offset + directory_size != st.st_size - sizeof(footer))
+        return NULL; // Directory doesn't fit the file
+
+    BlockDict* dict = calloc(1, sizeof(BlockDict));
+
+    if(!dict) // Allocation failed
+        return NULL;
+
+    dict->fd = fd;
+    dict->num_blocks = footer.num_blocks;
+    dict->file_size = st.st_size;
+    dict->blocks = malloc(directory_size ? directory_size : 1);
+
+    if(!dict->blocks || !pread_full(fd, dict->blocks, directory_size, footer.directory_offset)) {
+        block_dict_free(dict);
+        return NULL;
+    }
+
+    for(size_t i = 0; i < dict->num_blocks; i++) {
+        DictBlock* block = &dict->blocks[i];
+
+        if(block->offset < DICT_MAGIC_SIZE || block->offset + block->size > footer.directory_offset) {
+            block_dict_free(dict); // Block outside the data
+            return NULL;
+        }
+
+        dict->raw_size += block->raw_size;
+    }
+
+    return dict;
+}
+
+
+// Grow the task's text to hold extra more bytes
+static char text_reserve(DecodeTask* task, size_t extra) {
+    if(task->text_len + extra <= task->text_capacity)
+        return 1;
+
+    size_t capacity = task->text_capacity ? task->text_capacity : extra;
+
+    while(capacity < task->text_len + extra)
+        capacity *= 2;
+
+    char* text = realloc(task->text, capacity);
+
+    if(!text) // Allocation failed
+        return 0;
+
+    task->text = text;
+    task->text_capacity = capacity;
+
+    return 1;
+}
+
+
+// Append "word: count\n" as print_dict prints it
+static char text_append(DecodeTask* task, const char* word, size_t len, uint64_t count) {
+    if(!text_reserve(task, len + 24))
+        return 0;
+
+    char* dest = task->text + task->text_len;
+    memcpy(dest, word, len);
+    dest += len;
+    *dest++ = ':';
+    *dest++ = ' ';
+
+    char digits[20];
+    int n = 0;
+
+    do { // Digits come out last first
+        digits[n++] = '0' + count % 10;
+        count /= 10;
+    } while(count);
+
+    while(n)
+        *dest++ = digits[--n];
+
+    *dest++ = '\n';
+    task->text_len = dest - task->text;
+
+    return 1;
+}
+
+
+// Decode one block into the task's raw records at *raw_pos or its text.
+// data and word are scratch buffers of the block size
+static char decode_block(DecodeTask* task, const DictBlock* block, unsigned char* data, char* word,
+                         size_t* raw_pos) {
+    if(!pread_full(task->dict->fd, data, block->size, block->offset))
+        return 0;
+
+    size_t pos = 0;
+    size_t word_len = 0;
+    uint64_t raw_end = *raw_pos + block->raw_size;
+
+    for(uint32_t r = 0; r < block->num_records; r++) {
+        uint64_t shared, suffix, count;
+
+        if(!get_varint(data, block->size, &pos, &shared) || !get_varint(data, block->size, &pos, &suffix) ||
+           shared > word_len || suffix > block->size - pos)
+            return 0; // Corrupt record
+
+        memcpy(word + shared, data + pos, suffix); // Fits, a block's words are no longer than the block
+        word_len = shared + suffix;
+        pos += suffix;
+
+        if(!get_varint(data, block->size, &pos, &count))
+            return 0;
+
+        if(task->raw) { // Plain record: length, word, count
+            size_t len = word_len;
+            unsigned long long plain_count = count;
+
+            if(*raw_pos + sizeof(len) + len + sizeof(plain_count) > raw_end)
+                return 0; // Records larger than the directory says
+
+            memcpy(task->raw + *raw_pos, &len, sizeof(len));
+            memcpy(task->raw + *raw_pos + sizeof(len), word, len);
+            memcpy(task->raw + *raw_pos + sizeof(len) + len, &plain_count, sizeof(plain_count));
+            *raw_pos += sizeof(len) + len + sizeof(plain_count);
+        } else if(!text_append(task, word, word_len, count)) {
+            return 0;
+        }
+    }
+
+    return pos == block->size && (!task->raw || *raw_pos == raw_end);
+}
+
+
+static void* decode_task(void* arg) {
+    DecodeTask* task = (DecodeTask*)arg;
+    const BlockDict* dict = task->dict;
+    size_t max_size = 0;
+    size_t raw_pos = 0;
+
+    for(size_t i = 0; i < task->count; i++) {
+        if(dict->blocks[task->first + i].size > max_size)
+            max_size = dict->blocks[task->first + i].size;
+    }
+
+    unsigned char* data = malloc(max_size + 1);
+    char* word = malloc(max_size + 1);
+
+    task->ok = data && word;
+    task->text_len = 0;
+
+    if(!task->raw && task->ok) // Most of a round's text fits the first allocation
+        task->ok = text_reserve(task, task->count * DICT_BLOCK_SIZE);
+
+    for(size_t i = 0; task->ok && i < task->count; i++)
+        task->ok = decode_block(task, &dict->blocks[task->first + i], data, word, &raw_pos);
+
+    free(data);
+    free(word);
+
+    return NULL;
+}
+
+
+// Decode blocks first to first + count, split in contiguous shares over
+// num_threads threads
+static char decode_parallel(DecodeTask* tasks, int num_threads, size_t first, size_t count) {
+    pthread_t threads[num_threads];
+    size_t share = (count + num_threads - 1) / num_threads;
+    int started = 0;
+    char ok = 1;
+
+    for(int t = 0; t < num_threads; t++) {
+        tasks[t].first = first + t * share < first + count ? first + t * share : first + count;
+        tasks[t].count = tasks[t].first + share <= first + count ? share : first + count - tasks[t].first;
+    }
+
+    for(int t = 1; t < num_threads && tasks[t].count; t++) { // Calling thread decodes the first share
+        if(pthread_create(&threads[t], NULL, decode_task, &tasks[t])) {
+            ok = 0;
+            break;
+        }
+
+        started = t;
+    }
+
+    if(ok)
+        decode_task(&tasks[0]);
+
+    for(int t = 1; t <= started; t++)
+        pthread_join(threads[t], NULL);
+
+    for(int t = 0; ok && t < num_threads; t++)
+        ok = !tasks[t].count || tasks[t].ok;
+
+    return ok;
+}
+
+
+// Print every word of dict to out in order, decoding rounds of blocks on
+// num_threads threads while keeping the printed text of one round at most
+char block_dict_print(BlockDict* dict, FILE* out, int num_threads) {
+    if(!dict || !out || num_threads < 1)
+        return 0;
+
+    DecodeTask* tasks = calloc(num_threads, sizeof(DecodeTask));
+    size_t round = (size_t)num_threads * BLOCKS_PER_TASK;
+    char ok = tasks != NULL;
+
+    for(int t = 0; ok && t < num_threads; t++)
+        tasks[t].dict = dict;
+
+    for(size_t first = 0; ok && first < dict->num_blocks; first += round) {
+        size_t count = dict->num_blocks - first < round ? dict->num_blocks - first : round;
+
+        ok = decode_parallel(tasks, num_threads, first, count);
+
+        for(int t = 0; ok && t < num_threads; t++) // Shares are in word order
+            ok = !tasks[t].count || fwrite(tasks[t].text, 1, tasks[t].text_len, out) == tasks[t].text_len;
+    }
+
+    for(int t = 0; tasks && t < num_threads; t++)
+        free(tasks[t].text);
+
+    free(tasks);
+
+    return ok;
+}
+
+
+// Decode all of dict into one buffer of plain records, dict->raw_size
+// bytes, each thread filling its own range
+char* block_dict_load(BlockDict* dict, int num_threads) {
+    if(!dict || num_threads < 1)
+        return NULL;
+
+    char* raw = malloc(dict->raw_size ? dict->raw_size : 1);
+    DecodeTask* tasks = calloc(num_threads, sizeof(DecodeTask));
+    char ok = raw && tasks;
+
+    if(ok) {
+        size_t share = (dict->num_blocks + num_threads - 1) / num_threads;
+        uint64_t raw_offset = 0;
+
+        for(int t = 0; t < num_threads; t++) { // Each share starts after the records before it
+            size_t first = t * share < dict->num_blocks ? t * share : dict->num_blocks;
+            size_t last = first + share < dict->num_blocks ? first + share : dict->num_blocks;
+
+            tasks[t].dict = dict;
+            tasks[t].raw = raw + raw_offset;
+
+            for(size_t i = first; i < last; i++)
+                raw_offset += dict->blocks[i].raw_size;
+        }
+
+        ok = decode_parallel(tasks, num_threads, 0, dict->num_blocks);
+    }
+
+    free(tasks);
+
+    if(!ok) {
+        free(raw);
+        return NULL;
+    }
+
+    return raw;
+}
+
+
+void block_dict_free(BlockDict* dict) {
+    if(!dict) // Ensure non-null input
+        return;
+
+    free(dict->blocks);
+    free(dict);
+}
+
+
+// Read the dictionary at fd in the plain record format, decoding a
+// block-compressed one on all cores. Sets size to its bytes.
+char* dict_file_read(int fd, size_t* size) {
+    if(dict_file_blocked(fd)) {
+        BlockDict* dict = block_dict_open(fd);
+        long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+        char* raw = dict ? block_dict_load(dict, num_cores > 0 ? num_cores : 1) : NULL;
+
+        if(raw)
+            *size = dict->raw_size;
+
+        block_dict_free(dict);
+
+        return raw;
+    }
+
+    struct stat st;
+
+    if(fstat(fd, &st))
+        return NULL;
+
+    char* file = malloc(st.st_size ? st.st_size : 1);
+
+    if(!file || !pread_full(fd, file, st.st_size, 0)) {
+        free(file);
+        return NULL;
+    }
+
+    *size = st.st_size;
+
+    return file;
+}
@@ -0,0 +1,442 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "../include/dict_writer.h"
+#include "../include/dict_file.h"
+#include "../include/perf_counters.h"
+
+// Writes dictionary records on a thread of its own. The merge fills one
+// buffer while the writer flushes the others, buffers are used in turn
+// and the merge waits only when all of them are still being written.
+// Blocked writers encode records into blocks inside those buffers and
+// append the block directory on close. Records go to a temporary file
+// next to the target, renamed over it on close so readers such as serve
+// never see a partial dictionary.
+
+typedef struct {
+    char* data;
+    size_t len;
+    char full; // Handed to the writer thread
+} WriteBuffer;
+
+struct DictWriter {
+    int fd;
+    char* path;
+    char* tmp_path; // Same directory as path, so the rename stays atomic
+    pthread_t thread;
+
+    WriteBuffer buffers[DICT_WRITER_BUFFERS];
+    int fill; // Buffer the merge appends to
+    int flush; // Next buffer the writer thread writes
+
+    pthread_mutex_t lock;
+    pthread_cond_t filled; // A buffer became full or the merge finished
+    pthread_cond_t emptied; // A buffer was written
+    char done; // No more buffers will be filled
+    char error; // A write failed, later buffers are dropped
+
+    DictWriterStats stats;
+
+    // Touched only by the merge
+    size_t raw_bytes; // Records added, in the plain format
+    uint64_t submitted; // Bytes of buffers handed to the writer thread
+
+    // Block being encoded by a blocked writer
+    char blocked;
+    size_t block_start; // Offset in the buffer being filled
+    uint32_t block_records;
+    uint64_t block_raw;
+    char* prev; // Previous word of the block
+    size_t prev_len;
+    size_t prev_capacity;
+
+    DictBlock* directory;
+    size_t num_blocks;
+    size_t directory_capacity;
+};
+
+
+// Write all of data, retrying short writes
+static char write_all(int fd, const char* data, size_t len) {
+    while(len > 0) {
+        ssize_t written = write(fd, data, len);
+
+        if(written < 0 && errno == EINTR) // Interrupted, retry
+            continue;
+
+        if(written <= 0) // Write failed
+            return 0;
+
+        data += written;
+        len -= written;
+    }
+
+    return 1;
+}
+
+
+static void* writer_thread(void* arg) {
+    DictWriter* writer = (DictWriter*)arg;
+
+    PerfCounters perf;
+    perf_begin(&perf, PERF_WRITE);
+
+    pthread_mutex_lock(&writer->lock);
+
+    while(1) {
+        WriteBuffer* buffer = &writer->buffers[writer->flush];
+
+        while(!buffer->full && !writer->done)
+            pthread_cond_wait(&writer->filled, &writer->lock);
+
+        if(!buffer->full) // Finished and all buffers written
+            break;
+
+        pthread_mutex_unlock(&writer->lock);
+
+        // Write without the lock so the merge keeps filling
+        double start = now_seconds();
+        char ok = write_all(writer->fd, buffer->data, buffer->len);
+        double write_time = now_seconds() - start;
+
+        pthread_mutex_lock(&writer->lock);
+
+        writer->stats.write_time += write_time;
+        writer->stats.bytes_written += ok ? buffer->len : 0;
+
+        if(!ok)
+            writer->error = 1;
+
+        buffer->len = 0;
+        buffer->full = 0;
+        writer->flush = (writer->flush + 1) % DICT_WRITER_BUFFERS;
+        pthread_cond_signal(&writer->emptied);
+    }
+
+    pthread_mutex_unlock(&writer->lock);
+
+    perf_end(&perf);
+
+    return NULL;
+}
+
+
+static void writer_free(DictWriter* writer) {
+    for(int i = 0; i < DICT_WRITER_BUFFERS; i++)
+        free(writer->buffers[i].data);
+
+    free(writer->path);
+    free(writer->tmp_path);
+    free(writer->prev);
+    free(writer->directory);
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->filled);
+    pthread_cond_destroy(&writer->emptied);
+    free(writer);
+}
+
+
+// Mode for the dictionary at path, that of the file it replaces or else
+// what open would create under the umask, which can only be read by setting it
+static mode_t dict_mode(const char* path) {
+    struct stat st;
+
+    if(!stat(path, &st))
+        return st.st_mode & 07777;
+
+    mode_t mask = umask(0);
+    umask(mask);
+
+    return 0666 & ~mask;
+}
+
+
+static DictWriter* writer_open(const char* path, char blocked) {
+    if(!path)
+        return NULL; // Invalid input
+
+    DictWriter* writer = calloc(1, sizeof(DictWriter));
+
+    if(!writer) // Allocation failed
+        return NULL;
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->filled, NULL);
+    pthread_cond_init(&writer->emptied, NULL);
+
+    char ok = 1;
+
+    for(int i = 0; i < DICT_WRITER_BUFFERS; i++) {
+        writer->buffers[i].data = malloc(DICT_WRITER_BUFFER_SIZE);
+        ok = ok && writer->buffers[i].data;
+    }
+
+    writer->blocked = blocked;
+
+    if(ok && blocked) { // Readers tell the formats apart by the first bytes
+        memcpy(writer->buffers[0].data, DICT_BLOCK_MAGIC, DICT_MAGIC_SIZE);
+        writer->buffers[0].len = DICT_MAGIC_SIZE;
+    }
+
+    size_t path_len = strlen(path);
+    writer->path = ok ? strdup(path) : NULL;
+    writer->tmp_path = ok ? malloc(path_len + sizeof(".tmp-XXXXXX")) : NULL;
+    ok = writer->path && writer->tmp_path;
+
+    if(ok)
+        snprintf(writer->tmp_path, path_len + sizeof(".tmp-XXXXXX"), "%s.tmp-XXXXXX", path);
+
+    writer->fd = ok ? mkstemp(writer->tmp_path) : -1;
+
+    if(writer->fd < 0) { // Allocation failed or file failed to open
+        writer_free(writer);
+        return NULL;
+    }
+
+    if(fchmod(writer->fd, dict_mode(path)) || pthread_create(&writer->thread, NULL, writer_thread, writer)) {
+        close(writer->fd);
+        unlink(writer->tmp_path);
+        writer_free(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+
+// Writer of plain records, read back by print_dict and serve as is
+DictWriter* dict_writer_open(const char* path) {
+    return writer_open(path, 0);
+}
+
+
+// Writer of a block-compressed dictionary, see dict_file.c
+DictWriter* dict_writer_open_blocked(const char* path) {
+    return writer_open(path, 1);
+}
+
+
+// Hand the buffer being filled to the writer thread and wait until the next one is free
+static char submit_buffer(DictWriter* writer) {
+    writer->submitted += writer->buffers[writer->fill].len;
+
+    pthread_mutex_lock(&writer->lock);
+
+    writer->buffers[writer->fill].full = 1;
+    pthread_cond_signal(&writer->filled);
+
+    writer->fill = (writer->fill + 1) % DICT_WRITER_BUFFERS;
+
+    if(writer->buffers[writer->fill].full) { // Every buffer is being written, apply backpressure
+        double start = now_seconds();
+
+        while(writer->buffers[writer->fill].full)
+            pthread_cond_wait(&writer->emptied, &writer->lock);
+
+        writer->stats.stall_time += now_seconds() - start;
+    }
+
+    char ok = !writer->error;
+
+    pthread_mutex_unlock(&writer->lock);
+
+    return ok;
+}
+
+
+// List the block being encoded in the directory
+static char finish_block(DictWriter* writer) {
+    if(!writer->block_records) // Nothing encoded since the last block
+        return 1;
+
+    if(writer->num_blocks == writer->directory_capacity) { // Grow directory
+        size_t capacity = writer->directory_capacity ? writer->directory_capacity * 2 : 1024;
+        DictBlock* directory = realloc(writer->directory, capacity * sizeof(DictBlock));
+
+        if(!directory) // Allocation failed
+            return 0;
+
+        writer->directory = directory;
+        writer->directory_capacity = capacity;
+    }
+
+    DictBlock* block = &writer->directory[writer->num_blocks++];
+    block->offset = writer->submitted + writer->block_start;
+    block->raw_size = writer->block_raw;
+    block->size = writer->buffers[writer->fill].len - writer->block_start;
+    block->num_records = writer->block_records;
+
+    writer->block_records = 0;
+    writer->block_raw = 0;
+
+    return 1;
+}
+
+
+// Encode record into the current block, starting a new block once it
+// passes DICT_BLOCK_SIZE or the buffer is full
+static char add_blocked(DictWriter* writer, const char* word, size_t len, unsigned long long count) {
+    size_t max_size = len + DICT_RECORD_OVERHEAD;
+
+    if(max_size > DICT_WRITER_BUFFER_SIZE) // Record can't fit a buffer
+        return 0;
+
+    WriteBuffer* buffer = &writer->buffers[writer->fill];
+
+    if(buffer->len - writer->block_start >= DICT_BLOCK_SIZE && !finish_block(writer))
+        return 0;
+
+    if(buffer->len + max_size > DICT_WRITER_BUFFER_SIZE) { // Blocks don't span buffers
+        if(!finish_block(writer) || !submit_buffer(writer))
+            return 0;
+
+        buffer = &writer->buffers[writer->fill];
+    }
+
+    if(!writer->block_records) { // First record of a block shares nothing
+        writer->block_start = buffer->len;
+        writer->prev_len = 0;
+    }
+
+    if(len > writer->prev_capacity) { // Grow previous word
+        char* prev = realloc(writer->prev, len);
+
+        if(!prev) // Allocation failed
+            return 0;
+
+        writer->prev = prev;
+        writer->prev_capacity = len;
+    }
+
+    buffer->len += dict_block_encode(buffer->data + buffer->len, writer->prev, writer->prev_len, word, len, count);
+
+    memcpy(writer->prev, word, len);
+    writer->prev_len = len;
+    writer->block_records++;
+    writer->block_raw += sizeof(len) + len + sizeof(count);
+
+    return 1;
+}
+
+
+// Append bytes after the records, across as many buffers as they need
+static char append_bytes(DictWriter* writer, const void* data, size_t len) {
+    const char* src = (const char*)data;
+
+    while(len > 0) {
+        WriteBuffer* buffer = &writer->buffers[writer->fill];
+
+        if(buffer->len == DICT_WRITER_BUFFER_SIZE) { // Buffer full
+            if(!submit_buffer(writer))
+                return 0;
+
+            continue;
+        }
+
+        size_t n = DICT_WRITER_BUFFER_SIZE - buffer->len < len ? DICT_WRITER_BUFFER_SIZE - buffer->len : len;
+        memcpy(buffer->data + buffer->len, src, n);
+        buffer->len += n;
+        src += n;
+        len -= n;
+    }
+
+    return 1;
+}
+
+
+// Finish the last block and append the block directory with its footer
+static char finish_blocked(DictWriter* writer) {
+    if(!finish_block(writer))
+        return 0;
+
+    DictFooter footer;
+    footer.num_blocks = writer->num_blocks;
+    footer.directory_offset = writer->submitted + writer->buffers[writer->fill].len;
+    memcpy(footer.magic, DICT_BLOCK_MAGIC, DICT_MAGIC_SIZE);
+
+    return append_bytes(writer, writer->directory, writer->num_blocks * sizeof(DictBlock)) &&
+           append_bytes(writer, &footer, sizeof(footer));
+}
+
+
+// Append record of word length, word and count as read by print_dict
+char dict_writer_add(void* ctx, const char* word, unsigned long long count) {
+    DictWriter* writer = (DictWriter*)ctx;
+
+    if(!writer || !word)
+        return 0; // Invalid input
+
+    size_t len = strlen(word);
+    size_t record_size = sizeof(len) + len + sizeof(count);
+
+    if(writer->blocked) {
+        writer->raw_bytes += record_size;
+        return add_blocked(writer, word, len, count);
+    }
+
+    if(record_size > DICT_WRITER_BUFFER_SIZE) // Record can't fit a buffer
+        return 0;
+
+    WriteBuffer* buffer = &writer->buffers[writer->fill];
+
+    if(buffer->len + record_size > DICT_WRITER_BUFFER_SIZE) { // Buffer full
+        if(!submit_buffer(writer))
+            return 0;
+
+        buffer = &writer->buffers[writer->fill];
+    }
+
+    char* dest = buffer->data + buffer->len;
+    memcpy(dest, &len, sizeof(len));
+    memcpy(dest + sizeof(len), word, len);
+    memcpy(dest + sizeof(len) + len, &count, sizeof(count));
+    buffer->len += record_size;
+    writer->raw_bytes += record_size;
+
+    return 1;
+}
+
+
+// Write remaining records and close the file, returns 0 if any write failed
+char dict_writer_close(DictWriter* writer, DictWriterStats* stats) {
+    if(!writer) // Ensure non-null input
+        return 0;
+
+    char trailer_ok = !writer->blocked || finish_blocked(writer);
+
+    pthread_mutex_lock(&writer->lock);
+
+    if(writer->buffers[writer->fill].len) // Flush partial buffer
+        writer->buffers[writer->fill].full = 1;
+
+    writer->done = 1;
+    pthread_cond_signal(&writer->filled);
+    pthread_mutex_unlock(&writer->lock);
+
+    pthread_join(writer->thread, NULL);
+
+    char ok = !writer->error && trailer_ok;
+
+    if(close(writer->fd)) // Deferred write error
+        ok = 0;
+
+    if(ok) // Publish the complete file in one step
+        ok = !rename(writer->tmp_path, writer->path);
+
+    if(!ok) // Leave any previous dictionary in place
+        unlink(writer->tmp_path);
+
+    writer->stats.raw_bytes = writer->raw_bytes;
+
+    if(stats)
+        *stats = writer->stats;
+
+    writer_free(writer);
+
+    return ok;
+}
@@ -0,0 +1,114 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../include/hot_cache.h"
+#include "../include/word_hash.h"
+
+// Word frequencies are skewed, so a few words make up most tokens. Their
+// counts collect here and reach the dictionary only when the entry is
+// evicted or the cache is flushed at the end of the worker's input.
+
+
+HotCache* hot_cache_create(Dict* dict) {
+    if(!dict)
+        return NULL; // Invalid input
+
+    HotCache* cache = calloc(1, sizeof(HotCache));
+
+    if(!cache) // Allocation failed
+        return NULL;
+
+    cache->dict = dict;
+
+    return cache;
+}
+
+
+// Engines that walk a tree of string compares per insert gain from the
+// cache, ART's path is already about as short as a cache probe and sorted
+// runs only append
+char hot_cache_useful(Engine engine) {
+    return engine == ENGINE_AVL || engine == ENGINE_CTREE;
+}
+
+
+// Count word, word_size includes the terminating null
+char hot_cache_add(HotCache* cache, const char* word, size_t word_size) {
+    cache->lookups++;
+
+    if(word_size > HOT_KEY_SIZE) // Too long to cache
+        return dict_add(cache->dict, word, word_size);
+
+    uint64_t hash = word_hash(word, word_size, 0);
+    size_t set = hash & (HOT_CACHE_SETS - 1);
+    HotEntry* ways = cache->entries[set];
+
+    for(int w = 0; w < HOT_CACHE_WAYS; w++) {
+        HotEntry* entry = &ways[w];
+
+        if(entry->hash == hash && entry->count && entry->key_size == word_size &&
+           !memcmp(entry->key, word, word_size)) { // Hit, keep this way
+            entry->count++;
+            cache->victim[set] = !w;
+            cache->hits++;
+            return 1;
+        }
+    }
+
+    // Miss, replace the less recently hit way after adding its count
+    int w = cache->victim[set];
+    HotEntry* entry = &ways[w];
+
+    if(entry->count && !dict_add_count(cache->dict, entry->key, entry->key_size, entry->count))
+        return 0;
+
+    entry->hash = hash;
+    entry->count = 1;
+    entry->key_size = word_size;
+    memcpy(entry->key, word, word_size);
+    cache->victim[set] = !w;
+
+    return 1;
+}
+
+
+// Add every cached count to the dictionary and empty the cache
+char hot_cache_flush(HotCache* cache) {
+    if(!cache) // Ensure non-null input
+        return 0;
+
+    char ok = 1;
+
+    for(int s = 0; s < HOT_CACHE_SETS; s++) {
+        for(int w = 0; w < HOT_CACHE_WAYS; w++) {
+            HotEntry* entry = &cache->entries[s][w];
+
+            if(entry->count && !dict_add_count(cache->dict, entry->key, entry->key_size, entry->count))
+                ok = 0;
+
+            entry->count = 0;
+        }
+    }
+
+    return ok;
+}
+
+
+// Flush and free cache, adding its lookups and hits to the totals.
+// A NULL cache was never used and succeeds.
+char hot_cache_close(HotCache* cache, size_t* lookups, size_t* hits) {
+    if(!cache)
+        return 1;
+
+    char ok = hot_cache_flush(cache);
+
+    *lookups += cache->lookups;
+    *hits += cache->hits;
+    hot_cache_free(cache);
+
+    return ok;
+}
+
+
+void hot_cache_free(HotCache* cache) {
+    free(cache);
+}
@@ -0,0 +1,530 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "../include/interner.h"
+#include "../include/word_hash.h"
+#include "../include/word_arena.h"
+
+// Dense word IDs shared by all workers. The shared table is split into
+// shards by hash, each behind its own lock, and hands out IDs from one
+// atomic counter. Workers keep their own table of the IDs they have
+// seen, so the shared table is locked once per distinct word a worker
+// meets rather than once per token, and count into a flat array indexed
+// by ID. Counters sharing an interner merge by adding their arrays.
+
+#define INTERN_SHARD_BITS 6
+#define INTERN_SHARDS (1 << INTERN_SHARD_BITS)
+#define INITIAL_TABLE_SIZE 1024 // Slots, a power of two
+#define INITIAL_COUNTS 4096
+#define WORD_BLOCK_SIZE (64 * 1024) // Smaller than the default, most shards hold few words
+#define STREAM_BATCH 16384 // IDs buffered before each write
+
+// Word and its ID in an open addressing table
+typedef struct InternSlot {
+    uint64_t hash;
+    const char* word; // NULL when empty
+    uint32_t word_size; // Includes terminating null
+    uint32_t id;
+} InternSlot;
+
+// Open addressing table with linear probing
+typedef struct InternTable {
+    InternSlot* slots;
+    size_t capacity; // Power of two
+    size_t size;
+} InternTable;
+
+// Words whose hash falls in one shard
+typedef struct InternShard {
+    pthread_mutex_t lock;
+    InternTable table;
+    WordArena words; // Copies of the words in table
+} InternShard;
+
+struct Interner {
+    InternShard shards[INTERN_SHARDS];
+    uint32_t next_id; // Next ID handed out, updated atomically
+
+    // Words by ID, rebuilt when IDs were added since
+    const char** words;
+    size_t num_words;
+};
+
+// Word of a finished counter, sorted by word
+typedef struct CountedWord {
+    const char* word;
+    uint32_t id;
+} CountedWord;
+
+struct IdCounter {
+    Interner* interner;
+    char owns_interner; // Created without a shared interner
+
+    InternTable local; // IDs this worker has looked up
+
+    uint64_t* counts; // Indexed by ID
+    size_t num_counts;
+
+    // Binary stream of the ID of each token, NULL when not kept
+    FILE* stream;
+    uint32_t* batch;
+    size_t batch_len;
+    char failed; // Stream write failed
+
+    // Words with a count in word order, built by finish
+    CountedWord* sorted;
+    size_t num_sorted;
+};
+
+
+static char table_init(InternTable* table) {
+    table->slots = calloc(INITIAL_TABLE_SIZE, sizeof(InternSlot));
+    table->capacity = INITIAL_TABLE_SIZE;
+    table->size = 0;
+
+    return table->slots != NULL;
+}
+
+
+// Slot holding word, or the empty slot it would go in
+static InternSlot* table_find(const InternTable* table, const char* word, size_t word_size, uint64_t hash) {
+    size_t mask = table->capacity - 1;
+    size_t i = hash & mask;
+
+    while(1) {
+        InternSlot* slot = &table->slots[i];
+
+        if(!slot->word || (slot->hash == hash && slot->word_size == word_size &&
+                           !memcmp(slot->word, word, word_size)))
+            return slot;
+
+        i = (i + 1) & mask;
+    }
+}
+
+
+// Double the table once it is three quarters full
+static char table_grow(InternTable* table) {
+    if(4 * (table->size + 1) <= 3 * table->capacity)
+        return 1;
+
+    InternTable grown = {calloc(2 * table->capacity, sizeof(InternSlot)), 2 * table->capacity, table->size};
+
+    if(!grown.slots) // Allocation failed
+        return 0;
+
+    for(size_t i = 0; i < table->capacity; i++) {
+        InternSlot* slot = &table->slots[i];
+
+        if(slot->word)
+            *table_find(&grown, slot->word, slot->word_size, slot->hash) = *slot;
+    }
+
+    free(table->slots);
+    *table = grown;
+
+    return 1;
+}
+
+
+Interner* interner_create() {
+    Interner* interner = calloc(1, sizeof(Interner));
+
+    if(!interner) // Allocation failed
+        return NULL;
+
+    for(int i = 0; i < INTERN_SHARDS; i++) {
+        pthread_mutex_init(&interner->shards[i].lock, NULL);
+        interner->shards[i].words.block_size = WORD_BLOCK_SIZE;
+
+        if(!table_init(&interner->shards[i].table)) {
+            interner_free(interner);
+            return NULL;
+        }
+    }
+
+    return interner;
+}
+
+
+// Copy the shared slot of word to found, assigning the next ID to a new
+// word. Returns 0 when allocation fails
+static char intern(Interner* interner, const char* word, size_t word_size, uint64_t hash, InternSlot* found) {
+    InternShard* shard = &interner->shards[hash >> (64 - INTERN_SHARD_BITS)];
+    pthread_mutex_lock(&shard->lock);
+
+    InternSlot* slot = table_find(&shard->table, word, word_size, hash);
+
+    if(!slot->word) { // First sighting by any worker
+        const char* copy = table_grow(&shard->table) ? word_arena_copy(&shard->words, word, word_size) : NULL;
+
+        if(!copy) {
+            pthread_mutex_unlock(&shard->lock);
+            return 0;
+        }
+
+        slot = table_find(&shard->table, word, word_size, hash); // Table may have grown
+        slot->hash = hash;
+        slot->word = copy;
+        slot->word_size = word_size;
+        slot->id = __atomic_fetch_add(&interner->next_id, 1, __ATOMIC_RELAXED);
+        shard->table.size++;
+    }
+
+    *found = *slot; // Slots move when another worker grows the table
+    pthread_mutex_unlock(&shard->lock);
+
+    return 1;
+}
+
+
+// Number of IDs handed out
+size_t interner_size(Interner* interner) {
+    return interner ? __atomic_load_n(&interner->next_id, __ATOMIC_RELAXED) : 0;
+}
+
+
+// Bytes held by the shared tables, word copies and words by ID
+size_t interner_memory(Interner* interner) {
+    if(!interner)
+        return 0;
+
+    size_t memory = sizeof(Interner) + interner->num_words * sizeof(char*);
+
+    for(int i = 0; i < INTERN_SHARDS; i++) {
+        InternShard* shard = &interner->shards[i];
+
+        pthread_mutex_lock(&shard->lock);
+        memory += shard->table.capacity * sizeof(InternSlot) + shard->words.size;
+
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    return memory;
+}
+
+
+// Words by ID, once no worker is adding words
+static const char** interner_words(Interner* interner) {
+    size_t size = interner_size(interner);
+
+    if(interner->words && interner->num_words == size) // Nothing added since
+        return interner->words;
+
+    const char** words = realloc(interner->words, (size ? size : 1) * sizeof(char*));
+
+    if(!words) // Allocation failed
+        return NULL;
+
+    for(int s = 0; s < INTERN_SHARDS; s++) {
+        InternTable* table = &interner->shards[s].table;
+
+        for(size_t i = 0; i < table->capacity; i++) {
+            if(table->slots[i].word)
+                words[table->slots[i].id] = table->slots[i].word;
+        }
+    }
+
+    interner->words = words;
+    interner->num_words = size;
+
+    return words;
+}
+
+
+void interner_free(Interner* interner) {
+    if(!interner) // Ensure non-null input
+        return;
+
+    for(int i = 0; i < INTERN_SHARDS; i++) {
+        InternShard* shard = &interner->shards[i];
+        word_arena_free(&shard->words);
+        free(shard->table.slots);
+        pthread_mutex_destroy(&shard->lock);
+    }
+
+    free(interner->words);
+    free(interner);
+}
+
+
+// Counter of one worker, words get their IDs from interner, or from a
+// private one when NULL. With stream_path each token's ID is also written
+// there as a native 32-bit integer.
+IdCounter* id_counter_create(Interner* interner, const char* stream_path) {
+    IdCounter* counter = calloc(1, sizeof(IdCounter));
+
+    if(!counter) // Allocation failed
+        return NULL;
+
+    counter->interner = interner;
+
+    if(!interner) { // Counted on its own
+        counter->interner = interner_create();
+        counter->owns_interner = 1;
+    }
+
+    counter->counts = calloc(INITIAL_COUNTS, sizeof(uint64_t));
+    counter->num_counts = INITIAL_COUNTS;
+
+    char ok = counter->interner && counter->counts && table_init(&counter->local);
+
+    if(ok && stream_path) {
+        counter->stream = fopen(stream_path, "wb");
+        counter->batch = malloc(STREAM_BATCH * sizeof(uint32_t));
+        ok = counter->stream && counter->batch;
+    }
+
+    if(!ok) {
+        id_counter_free(counter);
+        return NULL;
+    }
+
+    return counter;
+}
+
+
+// ID of word, from the worker's table or else the shared one. Returns 0
+// when allocation fails
+static char lookup(IdCounter* counter, const char* word, size_t word_size, uint32_t* id) {
+    uint64_t hash = word_hash(word, word_size, 0);
+    InternSlot* slot = table_find(&counter->local, word, word_size, hash);
+
+    if(!slot->word) { // First sighting by this worker
+        InternSlot shared;
+
+        if(!table_grow(&counter->local) || !intern(counter->interner, word, word_size, hash, &shared))
+            return 0; // Allocation failed
+
+        slot = table_find(&counter->local, word, word_size, hash);
+        *slot = shared; // Word copy is owned by the interner
+        counter->local.size++;
+    }
+
+    *id = slot->id;
+
+    if(*id >= counter->num_counts) { // ID handed out after the array was sized
+        size_t num_counts = counter->num_counts * 2 > (size_t)*id + 1 ? counter->num_counts * 2 : (size_t)*id + 1;
+        uint64_t* counts = realloc(counter->counts, num_counts * sizeof(uint64_t));
+
+        if(!counts) // Allocation failed
+            return 0;
+
+        memset(counts + counter->num_counts, 0, (num_counts - counter->num_counts) * sizeof(uint64_t));
+        counter->counts = counts;
+        counter->num_counts = num_counts;
+    }
+
+    return 1;
+}
+
+
+// Write buffered IDs to the stream
+static void stream_flush(IdCounter* counter) {
+    if(counter->batch_len && fwrite(counter->batch, sizeof(uint32_t), counter->batch_len, counter->stream) !=
+       counter->batch_len)
+        counter->failed = 1;
+
+    counter->batch_len = 0;
+}
+
+
+// Count one token of word, word_size includes the terminating null
+char id_counter_add(IdCounter* counter, const char* word, size_t word_size) {
+    uint32_t id;
+
+    if(!lookup(counter, word, word_size, &id))
+        return 0;
+
+    counter->counts[id]++;
+
+    if(counter->stream) { // Record token in input order
+        counter->batch[counter->batch_len++] = id;
+
+        if(counter->batch_len == STREAM_BATCH)
+            stream_flush(counter);
+    }
+
+    return 1;
+}
+
+
+// Count word count times at once, not recorded in the stream
+char id_counter_add_count(IdCounter* counter, const char* word, size_t word_size, uint64_t count) {
+    uint32_t id;
+
+    if(!lookup(counter, word, word_size, &id))
+        return 0;
+
+    counter->counts[id] += count;
+
+    return 1;
+}
+
+
+// Write the rest of the stream and close it, returns 0 if any write failed
+char id_counter_close_stream(IdCounter* counter) {
+    if(!counter || !counter->stream)
+        return counter != NULL;
+
+    stream_flush(counter);
+
+    if(fclose(counter->stream))
+        counter->failed = 1;
+
+    counter->stream = NULL;
+
+    return !counter->failed;
+}
+
+
+// Write each word with its total count, one per line in ID order, so line
+// n holds the word of ID n
+char id_counter_write_vocab(IdCounter* totals, const char* path) {
+    if(!totals || !path)
+        return 0;
+
+    Interner* interner = totals->interner;
+    const char** words = interner_words(interner);
+    FILE* file = words ? fopen(path, "w") : NULL;
+
+    if(!file)
+        return 0;
+
+    for(size_t id = 0; id < interner->num_words; id++) {
+        unsigned long long count = id < totals->num_counts ? totals->counts[id] : 0;
+        fprintf(file, "%s\t%llu\n", words[id], count);
+    }
+
+    char ok = !ferror(file);
+
+    return !fclose(file) && ok;
+}
+
+
+static int compare_counted(const void* a, const void* b) {
+    return strcmp(((const CountedWord*)a)->word, ((const CountedWord*)b)->word);
+}
+
+
+// Sort the words with a count so they can be read in word order
+char id_counter_finish(IdCounter* counter) {
+    if(!counter)
+        return 0;
+
+    if(counter->sorted) // Already finished
+        return 1;
+
+    const char** words = interner_words(counter->interner);
+    size_t num_ids = counter->interner->num_words < counter->num_counts
+        ? counter->interner->num_words : counter->num_counts;
+
+    counter->sorted = malloc((num_ids ? num_ids : 1) * sizeof(CountedWord));
+
+    if(!words || !counter->sorted) // Allocation failed
+        return 0;
+
+    for(size_t id = 0; id < num_ids; id++) {
+        if(counter->counts[id])
+            counter->sorted[counter->num_sorted++] = (CountedWord){words[id], id};
+    }
+
+    qsort(counter->sorted, counter->num_sorted, sizeof(CountedWord), compare_counted);
+
+    return 1;
+}
+
+
+// Number of distinct words counted
+size_t id_counter_size(IdCounter* counter) {
+    return id_counter_finish(counter) ? counter->num_sorted : 0;
+}
+
+
+// Bytes held by the counter, its interner only when it is private
+size_t id_counter_memory(IdCounter* counter) {
+    if(!counter)
+        return 0;
+
+    size_t memory = sizeof(IdCounter) + counter->local.capacity * sizeof(InternSlot)
+        + counter->num_counts * sizeof(uint64_t) + counter->num_sorted * sizeof(CountedWord);
+
+    if(counter->batch)
+        memory += STREAM_BATCH * sizeof(uint32_t);
+
+    if(counter->owns_interner)
+        memory += interner_memory(counter->interner);
+
+    return memory;
+}
+
+
+// Word at index in word order, after finish
+char id_counter_get(IdCounter* counter, size_t index, const char** word, uint64_t* count) {
+    if(!counter || !counter->sorted || index >= counter->num_sorted)
+        return 0;
+
+    *word = counter->sorted[index].word;
+    *count = counter->counts[counter->sorted[index].id];
+
+    return 1;
+}
+
+
+// Move all counts of b into a, b is freed. Counters sharing an interner
+// add their arrays, others add b's words to a one at a time
+IdCounter* id_counter_merge(IdCounter* a, IdCounter* b) {
+    if(!a || !b)
+        return NULL;
+
+    if(a->interner != b->interner) { // IDs mean different words
+        if(!id_counter_finish(b))
+            return NULL;
+
+        for(size_t i = 0; i < b->num_sorted; i++) {
+            CountedWord* entry = &b->sorted[i];
+
+            if(!id_counter_add_count(a, entry->word, strlen(entry->word) + 1, b->counts[entry->id]))
+                return NULL;
+        }
+    } else {
+        if(b->num_counts > a->num_counts) { // Add into the longer array
+            uint64_t* counts = a->counts;
+            size_t num_counts = a->num_counts;
+
+            a->counts = b->counts;
+            a->num_counts = b->num_counts;
+            b->counts = counts;
+            b->num_counts = num_counts;
+        }
+
+        for(size_t id = 0; id < b->num_counts; id++)
+            a->counts[id] += b->counts[id];
+    }
+
+    free(a->sorted); // Counts changed
+    a->sorted = NULL;
+    a->num_sorted = 0;
+
+    id_counter_free(b);
+
+    return a;
+}
+
+
+void id_counter_free(IdCounter* counter) {
+    if(!counter) // Ensure non-null input
+        return;
+
+    if(counter->stream) // Freed without closing
+        fclose(counter->stream);
+
+    if(counter->owns_interner)
+        interner_free(counter->interner);
+
+    free(counter->local.slots);
+    free(counter->counts);
+    free(counter->batch);
+    free(counter->sorted);
+    free(counter);
+}
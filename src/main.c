@@ -3,11 +3,18 @@
 #include "../include/tree.h"
 #include "../include/build_dict.h"
 #include "../include/print_dict.h"
+#include "../include/options.h"
+#include "../include/serve.h"
+#include "../include/perf_counters.h"
 
 #ifdef TEST
 #include "../test/test.h"
 #endif
 
+#ifdef BENCH
+#include "../bench/bench.h"
+#endif
+
 
 
 int main(int argc, char *argv[]) {
@@ -15,12 +22,24 @@ int main(int argc, char *argv[]) {
     test();
     #endif
 
-    if(argc != 2) {
+    #ifdef BENCH
+    return bench(argc, argv);
+    #endif
+
+    if(argc >= 2 && !strcmp(argv[1], "serve")) // Answer queries on a dictionary
+        return serve_main(argc - 1, argv + 1);
+
+    Options opts;
+
+    if(!options_parse(&opts, argc, argv)) {
         printf("single path to text file must be include as program argument\n");
+        options_usage(argv[0]);
         return 1;
     }
 
-    char result = count_words(argv[1]);
+    perf_enable(opts.perf);
+
+    char result = count_words(opts.filepath, &opts);
 
     #ifdef DBG
     if(result)
@@ -29,8 +48,29 @@ int main(int argc, char *argv[]) {
         printf("Word Counting Failed\n");
     #endif
 
-    if(!print_dict())
-        printf("Error Reading Word Counts\n");
+    // Streamed and count ordered words were printed while counting
+    if(!opts.stream && opts.sort == SORT_WORD) {
+        PerfCounters perf;
+        DictReadStats read_stats = {0, 0, 0, 0, 0};
+        perf_begin(&perf, PERF_PRINT);
+
+        if(!print_dict_stats(opts.dict_path, opts.output, &read_stats))
+            printf("Error Reading Word Counts\n");
+
+        perf_end(&perf);
+
+        if(opts.stats && read_stats.num_blocks) // Report decode speed of compressed dictionaries
+            fprintf(stderr, "print: %zu blocks of %.2f MiB (%.2f MiB of records, %.2f:1) in %.3f s, "
+                "%.2f GB/s decoded on %d threads\n", read_stats.num_blocks, read_stats.file_size / (1024.0 * 1024.0),
+                read_stats.raw_size / (1024.0 * 1024.0), (double)read_stats.raw_size / read_stats.file_size,
+                read_stats.decode_time, read_stats.decode_time > 0 ? read_stats.raw_size / read_stats.decode_time / 1e9 : 0.0,
+                read_stats.num_threads);
+        else if(opts.stats)
+            fprintf(stderr, "print: %.2f MiB of records in %.3f s\n", read_stats.raw_size / (1024.0 * 1024.0),
+                read_stats.decode_time);
+    }
+
+    perf_report(stderr);
 
     return 1;
 }
\ No newline at end of file
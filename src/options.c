@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "../include/options.h"
+#include "../include/tokenizer.h"
+
+#define DEFAULT_CACHE_SIZE (1024LL * 1024 * 1024)
+#define DEFAULT_SEGMENT_SIZE (1024LL * 1024 * 1024)
+
+
+void options_init(Options* opts) {
+    if(!opts) // Ensure non-null input
+        return;
+
+    opts->filepath = NULL;
+    opts->io = IO_AUTO;
+    opts->read_mode = READ_BUFFERED;
+    opts->stats = 0;
+    opts->perf = 0;
+    opts->threads = 0;
+    opts->engine = ENGINE_ART; // Used when input can't be sampled
+    opts->auto_engine = 1;
+    opts->ngram = 1;
+    opts->reduce = 0;
+    opts->cache_dir = NULL;
+    opts->cache_size = DEFAULT_CACHE_SIZE;
+    opts->sort = SORT_WORD;
+    opts->stream = 0;
+    opts->output = NULL;
+    opts->dict_path = DEFAULT_DICT_PATH;
+    opts->include_file = NULL;
+    opts->exclude_file = NULL;
+    opts->filter = NULL;
+    opts->hot_cache = 1;
+    opts->checkpoint_dir = NULL;
+    opts->segment_size = DEFAULT_SEGMENT_SIZE;
+    opts->follow_dir = NULL;
+    opts->compress_dict = 0;
+    opts->id_stream = NULL;
+    opts->interner = NULL;
+}
+
+
+void options_usage(const char* prog) {
+    fprintf(stderr, "usage: %s [options] <file>\n", prog);
+    fprintf(stderr, "       %s serve [--socket PATH] <dict>\n", prog);
+    fprintf(stderr, "  --io auto|uring|pread   backend used to read the file (default auto)\n");
+    fprintf(stderr, "  --direct-io             read the file with O_DIRECT, keeping it out of the page\n");
+    fprintf(stderr, "                          cache, or drop its pages behind where unsupported\n");
+    fprintf(stderr, "  -j N                    reading threads (default from sampled tokens and cores)\n");
+    fprintf(stderr, "  --engine NAME           dictionary: auto, avl, art, sort, ctree or ids (default auto)\n");
+    fprintf(stderr, "  --ngram N               count runs of N words, 1 to %d (default 1)\n", NGRAM_MAX);
+    fprintf(stderr, "  --reduce                merge dictionaries pairwise in parallel before writing\n");
+    fprintf(stderr, "  --sort word|count       print in word order or by descending count (default word)\n");
+    fprintf(stderr, "  --stream                print words as they are merged, without %s\n", DEFAULT_DICT_PATH);
+    fprintf(stderr, "  -o, --output PATH       print to PATH instead of stdout\n");
+    fprintf(stderr, "  --dict PATH             binary dictionary path (default %s, none with\n", DEFAULT_DICT_PATH);
+    fprintf(stderr, "                          --stream or --sort count unless given)\n");
+    fprintf(stderr, "  --compress-dict         write the dictionary as front-coded blocks that print\n");
+    fprintf(stderr, "                          decodes on all cores\n");
+    fprintf(stderr, "  --id-stream PATH        with the ids engine, write each token's word ID to PATH as\n");
+    fprintf(stderr, "                          a 32-bit integer and the words by ID to PATH%s\n", ID_VOCAB_SUFFIX);
+    fprintf(stderr, "  --include-file PATH     count only the whitespace separated words in PATH\n");
+    fprintf(stderr, "  --exclude-file PATH     don't count the words in PATH, such as stopwords\n");
+    fprintf(stderr, "  --no-hot-cache          add every word to the tree engines, without the per-thread cache\n");
+    fprintf(stderr, "  --cache-dir DIR         reuse dictionaries of unchanged inputs from DIR\n");
+    fprintf(stderr, "  --cache-size N[K|M|G]   bytes the cache may hold (default 1G)\n");
+    fprintf(stderr, "  --checkpoint DIR        save counts of each input segment in DIR, a rerun\n");
+    fprintf(stderr, "                          counts only the segments missing there\n");
+    fprintf(stderr, "  --segment-size N[K|M|G] input bytes per checkpoint segment (default 1G)\n");
+    fprintf(stderr, "  --follow DIR            keep counts of a growing file in DIR, a rerun counts only\n");
+    fprintf(stderr, "                          the bytes appended since, up to its last complete word\n");
+    fprintf(stderr, "  --stats                 report timing and throughput on stderr\n");
+    fprintf(stderr, "  --perf                  report hardware counters per phase on stderr\n");
+}
+
+
+static char parse_io(const char* arg, IoBackend* io) {
+    if(!strcmp(arg, "auto"))
+        *io = IO_AUTO;
+    else if(!strcmp(arg, "uring") || !strcmp(arg, "io_uring"))
+        *io = IO_URING;
+    else if(!strcmp(arg, "pread"))
+        *io = IO_PREAD;
+    else // Unknown backend
+        return 0;
+
+    return 1;
+}
+
+
+// Byte count with optional K, M or G suffix
+static char parse_size(const char* arg, long long* size) {
+    char* end;
+    long long value = strtoll(arg, &end, 10);
+
+    if(end == arg || value < 0)
+        return 0;
+
+    switch(*end) {
+        case 'G': case 'g':
+            value *= 1024;
+            /* fall through */
+        case 'M': case 'm':
+            value *= 1024;
+            /* fall through */
+        case 'K': case 'k':
+            value *= 1024;
+            end++;
+            break;
+    }
+
+    if(*end != '\0') // Trailing characters
+        return 0;
+
+    *size = value;
+
+    return 1;
+}
+
+
+char options_parse(Options* opts, int argc, char* argv[]) {
+    if(!opts || !argv)
+        return 0; // Invalid input
+
+    static struct option long_opts[] = {
+        {"io", required_argument, NULL, 'i'},
+        {"direct-io", no_argument, NULL, 'R'},
+        {"stats", no_argument, NULL, 's'},
+        {"engine", required_argument, NULL, 'e'},
+        {"cache-dir", required_argument, NULL, 'c'},
+        {"ngram", required_argument, NULL, 'n'},
+        {"reduce", no_argument, NULL, 'r'},
+        {"cache-size", required_argument, NULL, 'z'},
+        {"sort", required_argument, NULL, 'O'},
+        {"stream", no_argument, NULL, 'S'},
+        {"output", required_argument, NULL, 'o'},
+        {"dict", required_argument, NULL, 'd'},
+        {"perf", no_argument, NULL, 'p'},
+        {"include-file", required_argument, NULL, 'I'},
+        {"exclude-file", required_argument, NULL, 'X'},
+        {"no-hot-cache", no_argument, NULL, 'H'},
+        {"checkpoint", required_argument, NULL, 'k'},
+        {"segment-size", required_argument, NULL, 'G'},
+        {"follow", required_argument, NULL, 'F'},
+        {"id-stream", required_argument, NULL, 'D'},
+        {"compress-dict", no_argument, NULL, 'Z'},
+        {NULL, 0, NULL, 0}
+    };
+
+    options_init(opts);
+    optind = 1;
+
+    int opt;
+    char dict_given = 0;
+
+    while((opt = getopt_long(argc, argv, "j:o:", long_opts, NULL)) != -1) {
+        switch(opt) {
+            case 'j':
+                opts->threads = atoi(optarg);
+
+                if(opts->threads < 1) {
+                    fprintf(stderr, "thread count must be positive: %s\n", optarg);
+                    return 0;
+                }
+                break;
+            case 'i':
+                if(!parse_io(optarg, &opts->io)) {
+                    fprintf(stderr, "unknown io backend: %s\n", optarg);
+                    return 0;
+                }
+                break;
+            case 'R':
+                opts->read_mode = READ_DIRECT;
+                break;
+            case 's':
+                opts->stats = 1;
+                break;
+            case 'e':
+                opts->auto_engine = !strcmp(optarg, "auto");
+
+                if(!opts->auto_engine && !engine_parse(optarg, &opts->engine)) {
+                    fprintf(stderr, "unknown engine: %s\n", optarg);
+                    return 0;
+                }
+                break;
+            case 'n':
+                opts->ngram = atoi(optarg);
+
+                if(opts->ngram < 1 || opts->ngram > NGRAM_MAX) {
+                    fprintf(stderr, "n-gram size must be 1 to %d: %s\n", NGRAM_MAX, optarg);
+                    return 0;
+                }
+                break;
+            case 'r':
+                opts->reduce = 1;
+                break;
+            case 'c':
+                opts->cache_dir = optarg;
+                break;
+            case 'z':
+                if(!parse_size(optarg, &opts->cache_size)) {
+                    fprintf(stderr, "invalid cache size: %s\n", optarg);
+                    return 0;
+                }
+                break;
+            case 'O':
+                if(!strcmp(optarg, "word"))
+                    opts->sort = SORT_WORD;
+                else if(!strcmp(optarg, "count"))
+                    opts->sort = SORT_COUNT;
+                else {
+                    fprintf(stderr, "unknown sort order: %s\n", optarg);
+                    return 0;
+                }
+                break;
+            case 'p':
+                opts->perf = 1;
+                break;
+            case 'I':
+                opts->include_file = optarg;
+                break;
+            case 'X':
+                opts->exclude_file = optarg;
+                break;
+            case 'H':
+                opts->hot_cache = 0;
+                break;
+            case 'k':
+                opts->checkpoint_dir = optarg;
+                break;
+            case 'G':
+                if(!parse_size(optarg, &opts->segment_size) || opts->segment_size < 1) {
+                    fprintf(stderr, "invalid segment size: %s\n", optarg);
+                    return 0;
+                }
+                break;
+            case 'F':
+                opts->follow_dir = optarg;
+                break;
+            case 'D':
+                opts->id_stream = optarg;
+                break;
+            case 'Z':
+                opts->compress_dict = 1;
+                break;
+            case 'S':
+                opts->stream = 1;
+                break;
+            case 'o':
+                opts->output = optarg;
+                break;
+            case 'd':
+                opts->dict_path = optarg;
+                dict_given = 1;
+                break;
+            default: // Unknown option
+                return 0;
+        }
+    }
+
+    // Words printed directly only persist a dictionary when asked to
+    if((opts->stream || opts->sort == SORT_COUNT) && !dict_given)
+        opts->dict_path = NULL;
+
+    // Token IDs are numbered by the ID engine
+    if(opts->id_stream && opts->auto_engine) {
+        opts->engine = ENGINE_IDS;
+        opts->auto_engine = 0;
+    }
+
+    if(opts->id_stream && opts->engine != ENGINE_IDS) {
+        fprintf(stderr, "--id-stream needs the ids engine\n");
+        return 0;
+    }
+
+    // Saved segments hold counts, not the tokens of the input
+    if(opts->id_stream && (opts->checkpoint_dir || opts->follow_dir)) {
+        fprintf(stderr, "--id-stream can't be combined with --checkpoint or --follow\n");
+        return 0;
+    }
+
+    if(opts->follow_dir && opts->checkpoint_dir) {
+        fprintf(stderr, "--follow and --checkpoint can't be combined\n");
+        return 0;
+    }
+
+    // N-grams crossing the end of one update would need the next
+    if(opts->follow_dir && opts->ngram > 1) {
+        fprintf(stderr, "--follow counts single words only\n");
+        return 0;
+    }
+
+    if(argc - optind != 1) // Exactly one input file
+        return 0;
+
+    opts->filepath = argv[optind];
+
+    return 1;
+}
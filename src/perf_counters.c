@@ -0,0 +1,227 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "../include/perf_counters.h"
+
+// Hardware counters per thread and phase through perf_event_open. Each
+// thread opens its own counters when it enters a phase, counting threads
+// it creates in that phase too, and adds them to the totals when it
+// leaves. Events the kernel or hardware refuse are reported as missing.
+
+// Thread and phase samples kept for the report
+#define PERF_MAX_SAMPLES 256
+
+typedef struct PerfSample {
+    PerfPhase phase;
+    int thread; // Order threads entered the phase
+    double seconds;
+    uint64_t values[PERF_EVENTS];
+    char valid[PERF_EVENTS];
+} PerfSample;
+
+static const char* phase_names[PERF_PHASES] = {"decode", "count", "merge", "sort", "write", "print"};
+
+static char enabled = 0;
+static unsigned long long total_tokens = 0;
+static int open_errno = 0; // First reason an event failed to open
+
+static pthread_mutex_t samples_lock = PTHREAD_MUTEX_INITIALIZER;
+static PerfSample samples[PERF_MAX_SAMPLES];
+static int num_samples = 0;
+static int phase_threads[PERF_PHASES];
+
+
+// Monotonic wall clock in seconds
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+void perf_enable(char enable) {
+    enabled = enable;
+}
+
+
+void perf_set_tokens(unsigned long long num_tokens) {
+    total_tokens = num_tokens;
+}
+
+
+// Fill attr to count event on the calling thread
+static void event_attr(PerfEvent event, struct perf_event_attr* attr) {
+    memset(attr, 0, sizeof(struct perf_event_attr));
+    attr->size = sizeof(struct perf_event_attr);
+    attr->type = PERF_TYPE_HARDWARE;
+    attr->disabled = 1;
+    attr->inherit = 1; // Include threads created during the phase
+    attr->exclude_kernel = 1;
+    attr->exclude_hv = 1;
+    attr->read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    switch(event) {
+        case PERF_CYCLES:
+            attr->config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case PERF_INSTRUCTIONS:
+            attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case PERF_LLC_MISSES:
+            attr->config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        case PERF_BRANCH_MISSES:
+            attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+        default: // Data TLB read misses
+            attr->type = PERF_TYPE_HW_CACHE;
+            attr->config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+    }
+}
+
+
+// Open and start counters for the calling thread, does nothing unless enabled
+void perf_begin(PerfCounters* counters, PerfPhase phase) {
+    if(!counters) // Ensure non-null input
+        return;
+
+    counters->phase = phase;
+    counters->start = now_seconds();
+
+    for(int e = 0; e < PERF_EVENTS; e++) {
+        counters->fds[e] = -1;
+
+        if(!enabled)
+            continue;
+
+        struct perf_event_attr attr;
+        event_attr(e, &attr);
+        counters->fds[e] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+
+        if(counters->fds[e] < 0 && !open_errno) // Remember why counters are missing
+            open_errno = errno;
+    }
+
+    for(int e = 0; e < PERF_EVENTS; e++) {
+        if(counters->fds[e] >= 0)
+            ioctl(counters->fds[e], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+
+// Stop counters and add them to the phase totals
+void perf_end(PerfCounters* counters) {
+    if(!counters || !enabled)
+        return;
+
+    PerfSample sample;
+    memset(&sample, 0, sizeof(PerfSample));
+    sample.phase = counters->phase;
+    sample.seconds = now_seconds() - counters->start;
+
+    for(int e = 0; e < PERF_EVENTS; e++) {
+        if(counters->fds[e] < 0)
+            continue;
+
+        ioctl(counters->fds[e], PERF_EVENT_IOC_DISABLE, 0);
+
+        uint64_t data[3]; // Value, time enabled, time running
+
+        if(read(counters->fds[e], data, sizeof(data)) == sizeof(data) && data[2] > 0) {
+            // Scale up when the event shared a hardware counter
+            sample.values[e] = data[2] < data[1] ? (uint64_t)((double)data[0] * data[1] / data[2]) : data[0];
+            sample.valid[e] = 1;
+        }
+
+        close(counters->fds[e]);
+        counters->fds[e] = -1;
+    }
+
+    pthread_mutex_lock(&samples_lock);
+
+    sample.thread = phase_threads[sample.phase]++;
+
+    if(num_samples < PERF_MAX_SAMPLES)
+        samples[num_samples++] = sample;
+
+    pthread_mutex_unlock(&samples_lock);
+}
+
+
+// Print one sample as IPC and events per token
+static void report_line(FILE* out, const char* label, const PerfSample* sample) {
+    double tokens = total_tokens ? (double)total_tokens : 1;
+
+    fprintf(out, "  %-14s %8.3f s", label, sample->seconds);
+
+    if(sample->valid[PERF_CYCLES] && sample->valid[PERF_INSTRUCTIONS] && sample->values[PERF_CYCLES])
+        fprintf(out, "  ipc %5.2f", (double)sample->values[PERF_INSTRUCTIONS] / sample->values[PERF_CYCLES]);
+    else
+        fprintf(out, "  ipc   n/a");
+
+    static const char* per_token[] = {"cyc", "ins", "llc", "br", "dtlb"};
+
+    for(int e = 0; e < PERF_EVENTS; e++) {
+        if(sample->valid[e])
+            fprintf(out, "  %s/tok %7.2f", per_token[e], sample->values[e] / tokens);
+        else
+            fprintf(out, "  %s/tok     n/a", per_token[e]);
+    }
+
+    fprintf(out, "\n");
+}
+
+
+// Report each thread of each phase and the phase totals
+void perf_report(FILE* out) {
+    if(!enabled || !out)
+        return;
+
+    fprintf(out, "perf: %llu tokens\n", total_tokens);
+
+    if(open_errno) // Some or all events unavailable, wall time still reported
+        fprintf(out, "perf: some counters unavailable (%s), shown as n/a\n", strerror(open_errno));
+
+    for(int p = 0; p < PERF_PHASES; p++) {
+        PerfSample total;
+        memset(&total, 0, sizeof(PerfSample));
+        int threads = 0;
+
+        for(int e = 0; e < PERF_EVENTS; e++)
+            total.valid[e] = 1;
+
+        for(int i = 0; i < num_samples; i++) {
+            if(samples[i].phase != (PerfPhase)p)
+                continue;
+
+            char label[32];
+            snprintf(label, sizeof(label), "%s/%d", phase_names[p], samples[i].thread);
+
+            if(phase_threads[p] > 1) // Single thread phases print only the total
+                report_line(out, label, &samples[i]);
+
+            // Phases run concurrently per thread, so wall time is the longest thread
+            if(samples[i].seconds > total.seconds)
+                total.seconds = samples[i].seconds;
+
+            for(int e = 0; e < PERF_EVENTS; e++) {
+                total.values[e] += samples[i].values[e];
+                total.valid[e] = total.valid[e] && samples[i].valid[e];
+            }
+
+            threads++;
+        }
+
+        if(threads)
+            report_line(out, phase_names[p], &total);
+    }
+}
@@ -1,19 +1,57 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "../include/print_dict.h"
+#include "../include/perf_counters.h"
 
-#define DICT_FILE "data.bin"
+// Open path for printed words, stdout when path is NULL
+FILE* output_open(const char* path) {
+    if(!path)
+        return stdout;
 
-char print_dict() {
-    FILE* file = fopen(DICT_FILE, "rb"); // Open file to read
+    return fopen(path, "w");
+}
 
-    if(!file) // File failed too open
-        return 1;
 
-    #ifdef DBG
-    printf("data.bin opened for writing\n");
-    #endif
+// Close printed words, returns 0 if they failed to flush
+char output_close(FILE* out) {
+    if(!out)
+        return 0;
+
+    if(out == stdout)
+        return fflush(out) == 0;
+
+    return fclose(out) == 0;
+}
+
+
+// Print block-compressed dictionary open as file to out, decoding on all cores
+static char print_blocked(FILE* file, FILE* out, DictReadStats* stats) {
+    double start = now_seconds();
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int num_threads = num_cores > 0 ? num_cores : 1;
+
+    BlockDict* dict = block_dict_open(fileno(file));
+    char ok = dict && block_dict_print(dict, out, num_threads);
+
+    if(ok && stats) {
+        stats->file_size = dict->file_size;
+        stats->raw_size = dict->raw_size;
+        stats->num_blocks = dict->num_blocks;
+        stats->num_threads = num_threads;
+        stats->decode_time = now_seconds() - start;
+    }
+
+    block_dict_free(dict);
+
+    return ok;
+}
+
+
+// Print plain records of file to out
+static char print_plain(FILE* file, FILE* out, DictReadStats* stats) {
+    double start = now_seconds();
 
     while(1) {
         size_t len;
@@ -28,8 +66,8 @@ char print_dict() {
         if (read_len != 1) {
             if(feof(file)) // End of file reached
                 break;
-            else if(ferror(file)) // Reading error
-                return 1;
+
+            return 0; // Reading error
         }
 
         // Allocate memory for next word
@@ -43,7 +81,7 @@ char print_dict() {
 
         if(read_word != len) {
             free(word);
-            return 0;;
+            return 0;
         }
 
         word[len] = '\0'; // Null-terminate the string
@@ -54,14 +92,57 @@ char print_dict() {
 
         if(read_count != 1) { // Count read failed
             free(word);
-            return 0;;
+            return 0;
         }
 
         // Print the result
-        printf("%s: %llu\n", word, count);
+        fprintf(out, "%s: %llu\n", word, count);
         free(word);
     }
 
-    fclose(file);
+    if(stats) { // Plain records are read as printed
+        stats->raw_size = stats->file_size = ftell(file);
+        stats->num_blocks = 0;
+        stats->num_threads = 1;
+        stats->decode_time = now_seconds() - start;
+    }
+
     return 1;
 }
+
+
+// Print dictionary at dict_path to out_path, or stdout when NULL
+char print_dict(const char* dict_path, const char* out_path) {
+    return print_dict_stats(dict_path, out_path, NULL);
+}
+
+
+// Print as print_dict does, filling stats when not NULL
+char print_dict_stats(const char* dict_path, const char* out_path, DictReadStats* stats) {
+    FILE* file = fopen(dict_path, "rb"); // Open file to read
+
+    if(!file) // File failed too open
+        return 1;
+
+    #ifdef DBG
+    printf("%s opened for reading\n", dict_path);
+    #endif
+
+    FILE* out = output_open(out_path);
+
+    if(!out) { // Output failed to open
+        fclose(file);
+        return 0;
+    }
+
+    char ok = dict_file_blocked(fileno(file)) ? print_blocked(file, out, stats)
+                                              : print_plain(file, out, stats);
+
+    // Both files are closed whether or not printing succeeded
+    fclose(file);
+
+    if(!output_close(out))
+        ok = 0;
+
+    return ok;
+}
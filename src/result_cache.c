@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "../include/result_cache.h"
+#include "../include/fnv_hash.h"
+
+// Cache of finished dictionaries. An entry is named after the input's
+// device, inode and size plus a hash of its mtime and sampled content,
+// is published by rename so readers never see a partial file, and uses
+// its mtime as the LRU clock.
+
+#define CACHE_SUFFIX ".dict"
+#define CACHE_LOCK ".lock"
+
+// Content hashed from inputs, spread evenly over the file
+#define SAMPLE_COUNT 64
+#define SAMPLE_SIZE 4096
+
+#define COPY_BUF_SIZE (256 * 1024)
+
+// Entry seen while evicting
+typedef struct {
+    char name[CACHE_KEY_SIZE + sizeof(CACHE_SUFFIX)];
+    long long size;
+    struct timespec used;
+} CacheEntry;
+
+
+// Name input by identity and a hash of sampled content
+char cache_key(const char* filepath, const struct stat* st, char* key) {
+    int fd = open(filepath, O_RDONLY);
+
+    if(fd < 0)
+        return 0;
+
+    uint64_t hash = FNV_OFFSET;
+    hash = fnv_update(hash, &st->st_mtim, sizeof(st->st_mtim));
+
+    char sample[SAMPLE_SIZE];
+    long long size = st->st_size;
+    long long stride = size / SAMPLE_COUNT;
+
+    // Small files are hashed whole
+    if(stride < SAMPLE_SIZE)
+        stride = SAMPLE_SIZE;
+
+    for(long long offset = 0; offset < size; offset += stride) {
+        ssize_t n = pread(fd, sample, SAMPLE_SIZE, offset);
+
+        if(n < 0) {
+            close(fd);
+            return 0;
+        }
+
+        hash = fnv_update(hash, sample, n);
+    }
+
+    // Appends change the tail first
+    if(size > SAMPLE_SIZE) {
+        ssize_t n = pread(fd, sample, SAMPLE_SIZE, size - SAMPLE_SIZE);
+
+        if(n > 0)
+            hash = fnv_update(hash, sample, n);
+    }
+
+    close(fd);
+
+    snprintf(key, CACHE_KEY_SIZE, "%llx-%llx-%llx-%016llx", (unsigned long long)st->st_dev,
+        (unsigned long long)st->st_ino, size, (unsigned long long)hash);
+
+    return 1;
+}
+
+
+static char copy_fd(int in, int out) {
+    char* buf = malloc(COPY_BUF_SIZE);
+    char ok = buf != NULL;
+
+    while(ok) {
+        ssize_t n = read(in, buf, COPY_BUF_SIZE);
+
+        if(n <= 0) { // End of file or failure
+            ok = n == 0;
+            break;
+        }
+
+        ok = write(out, buf, n) == n;
+    }
+
+    free(buf);
+
+    return ok;
+}
+
+
+// Copy cached dictionary for key to dest, 0 on a miss
+char cache_fetch(const char* dir, const char* key, const char* dest) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s%s", dir, key, CACHE_SUFFIX);
+
+    // An evicted entry stays readable once open
+    int in = open(path, O_RDONLY);
+
+    if(in < 0) // Miss
+        return 0;
+
+    int out = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    char ok = out >= 0 && copy_fd(in, out);
+
+    if(out >= 0 && close(out))
+        ok = 0;
+
+    // Mark entry as recently used
+    if(ok)
+        futimens(in, NULL);
+
+    close(in);
+
+    return ok;
+}
+
+
+static int compare_used(const void* a, const void* b) {
+    const CacheEntry* x = (const CacheEntry*)a;
+    const CacheEntry* y = (const CacheEntry*)b;
+
+    if(x->used.tv_sec != y->used.tv_sec)
+        return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+
+    return (x->used.tv_nsec > y->used.tv_nsec) - (x->used.tv_nsec < y->used.tv_nsec);
+}
+
+
+// Remove least recently used entries until dir holds at most max_bytes
+static void cache_evict(const char* dir, long long max_bytes) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, CACHE_LOCK);
+
+    // One evictor at a time, readers and writers need no lock
+    int lock_fd = open(path, O_RDWR | O_CREAT, 0644);
+
+    if(lock_fd < 0 || flock(lock_fd, LOCK_EX)) {
+        if(lock_fd >= 0)
+            close(lock_fd);
+        return;
+    }
+
+    DIR* d = opendir(dir);
+    CacheEntry* entries = NULL;
+    size_t num_entries = 0;
+    size_t capacity = 0;
+    long long total = 0;
+    struct dirent* ent;
+
+    while(d && (ent = readdir(d))) {
+        size_t len = strlen(ent->d_name);
+        size_t suffix_len = strlen(CACHE_SUFFIX);
+        struct stat st;
+
+        if(len <= suffix_len || len >= sizeof(entries->name) || strcmp(ent->d_name + len - suffix_len, CACHE_SUFFIX))
+            continue; // Not an entry
+
+        if(fstatat(dirfd(d), ent->d_name, &st, 0))
+            continue; // Removed meanwhile
+
+        if(num_entries == capacity) { // Grow entry list
+            size_t new_capacity = capacity ? capacity * 2 : 64;
+            CacheEntry* new_entries = realloc(entries, new_capacity * sizeof(CacheEntry));
+
+            if(!new_entries) // Allocation failed
+                break;
+
+            entries = new_entries;
+            capacity = new_capacity;
+        }
+
+        CacheEntry* entry = &entries[num_entries++];
+        strcpy(entry->name, ent->d_name);
+        entry->size = st.st_size;
+        entry->used = st.st_mtim;
+        total += st.st_size;
+    }
+
+    if(d)
+        closedir(d);
+
+    qsort(entries, num_entries, sizeof(CacheEntry), compare_used);
+
+    for(size_t i = 0; i < num_entries && total > max_bytes; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, entries[i].name);
+
+        if(!unlink(path))
+            total -= entries[i].size;
+    }
+
+    free(entries);
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+}
+
+
+// Publish src as the entry for key, then enforce the size limit
+char cache_store(const char* dir, const char* key, const char* src, long long max_bytes) {
+    char tmp_path[4096];
+    char path[4096];
+
+    if(mkdir(dir, 0755) && access(dir, W_OK)) { // Create cache on first use
+        perror(dir);
+        return 0;
+    }
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s/.tmp-XXXXXX", dir);
+    snprintf(path, sizeof(path), "%s/%s%s", dir, key, CACHE_SUFFIX);
+
+    int in = open(src, O_RDONLY);
+    int out = mkstemp(tmp_path);
+    char ok = in >= 0 && out >= 0 && !fchmod(out, 0644) && copy_fd(in, out);
+
+    if(ok) // Entry must be durable before it is visible
+        ok = !fsync(out);
+
+    if(in >= 0)
+        close(in);
+
+    if(out >= 0 && close(out))
+        ok = 0;
+
+    // Concurrent runs storing the same key write identical content
+    if(ok)
+        ok = !rename(tmp_path, path);
+
+    if(!ok && out >= 0)
+        unlink(tmp_path);
+
+    if(ok)
+        cache_evict(dir, max_bytes);
+
+    return ok;
+}
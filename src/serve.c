@@ -0,0 +1,710 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "../include/serve.h"
+#include "../include/dict_file.h"
+
+// How often the dictionary file is checked for changes
+#define RELOAD_INTERVAL_MS 200
+
+// Size of a packed response entry without its word
+#define ENTRY_HEADER_SIZE (sizeof(uint64_t) + sizeof(uint32_t))
+
+// Dictionary loaded for queries
+typedef struct {
+    char* words; // Null terminated words in dictionary order
+    size_t* offsets; // Start of each word in words
+    uint32_t* lens;
+    uint64_t* counts;
+    size_t* by_count; // Word indices by descending count
+    size_t size;
+} ServeIndex;
+
+typedef struct {
+    const char* dict_path;
+
+    // Queries hold the read lock, reloads swap the index under the write lock
+    pthread_rwlock_t lock;
+    ServeIndex* index;
+
+    struct stat loaded; // Identity of the loaded file
+    struct stat failed; // Identity of the last file that failed to load
+    struct stat pending; // Identity seen on the previous poll, reloaded once it holds still
+} Server;
+
+typedef struct {
+    Server* server;
+    int fd;
+} Client;
+
+// Growable response buffer
+typedef struct {
+    char* data;
+    size_t len;
+    size_t capacity;
+} Buffer;
+
+// Used to sort words by count
+typedef struct {
+    uint64_t count;
+    size_t index;
+} CountRank;
+
+static volatile sig_atomic_t stop_requested;
+
+
+static void on_stop(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+
+static void index_free(ServeIndex* index) {
+    if(!index) // Ensure non-null input
+        return;
+
+    free(index->words);
+    free(index->offsets);
+    free(index->lens);
+    free(index->counts);
+    free(index->by_count);
+    free(index);
+}
+
+
+static int compare_rank(const void* a, const void* b) {
+    const CountRank* x = (const CountRank*)a;
+    const CountRank* y = (const CountRank*)b;
+
+    if(x->count != y->count) // Most frequent first
+        return x->count < y->count ? 1 : -1;
+
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+
+// Order words by count for top-K queries
+static char index_rank(ServeIndex* index) {
+    CountRank* ranks = malloc((index->size ? index->size : 1) * sizeof(CountRank));
+    index->by_count = malloc((index->size ? index->size : 1) * sizeof(size_t));
+
+    if(!ranks || !index->by_count) { // Allocation failed
+        free(ranks);
+        return 0;
+    }
+
+    for(size_t i = 0; i < index->size; i++) {
+        ranks[i].count = index->counts[i];
+        ranks[i].index = i;
+    }
+
+    qsort(ranks, index->size, sizeof(CountRank), compare_rank);
+
+    for(size_t i = 0; i < index->size; i++)
+        index->by_count[i] = ranks[i].index;
+
+    free(ranks);
+
+    return 1;
+}
+
+
+// Load dictionary written by count_words in either format, NULL if it is
+// missing, truncated or unsorted
+static ServeIndex* index_load(const char* path, struct stat* st) {
+    int fd = open(path, O_RDONLY);
+
+    if(fd < 0)
+        return NULL;
+
+    if(fstat(fd, st)) {
+        close(fd);
+        return NULL;
+    }
+
+    // Whole file as plain records, compressed blocks are decoded on all cores
+    size_t file_size = 0;
+    char* file = dict_file_read(fd, &file_size);
+
+    close(fd);
+
+    // Each record holds at least a length and a count, so file_size bounds words and bytes
+    size_t max_words = file_size / (sizeof(size_t) + sizeof(unsigned long long)) + 1;
+    ServeIndex* index = calloc(1, sizeof(ServeIndex));
+
+    if(index) {
+        index->words = malloc(file_size + 1);
+        index->offsets = malloc(max_words * sizeof(size_t));
+        index->lens = malloc(max_words * sizeof(uint32_t));
+        index->counts = malloc(max_words * sizeof(uint64_t));
+    }
+
+    if(!file || !index || !index->words || !index->offsets || !index->lens || !index->counts) {
+        free(file);
+        index_free(index);
+        return NULL;
+    }
+
+    size_t pos = 0;
+    size_t word_pos = 0;
+    char ok = 1;
+
+    while(ok && pos < file_size) {
+        size_t len;
+        unsigned long long count;
+
+        if(file_size - pos < sizeof(len)) { // Truncated length
+            ok = 0;
+            break;
+        }
+
+        memcpy(&len, file + pos, sizeof(len));
+        pos += sizeof(len);
+
+        if(len > UINT32_MAX || file_size - pos < sizeof(count) || len > file_size - pos - sizeof(count)) {
+            ok = 0; // Truncated word or count
+            break;
+        }
+
+        char* word = index->words + word_pos;
+        memcpy(word, file + pos, len);
+        word[len] = '\0';
+        pos += len;
+
+        memcpy(&count, file + pos, sizeof(count));
+        pos += sizeof(count);
+
+        // Queries rely on dictionary order
+        if(index->size && strcmp(index->words + index->offsets[index->size - 1], word) >= 0)
+            ok = 0;
+
+        index->offsets[index->size] = word_pos;
+        index->lens[index->size] = len;
+        index->counts[index->size] = count;
+        index->size++;
+        word_pos += len + 1;
+    }
+
+    free(file);
+
+    if(!ok || !index_rank(index)) {
+        index_free(index);
+        return NULL;
+    }
+
+    return index;
+}
+
+
+static const char* index_word(const ServeIndex* index, size_t i) {
+    return index->words + index->offsets[i];
+}
+
+
+// First word not less than key
+static size_t index_lower_bound(const ServeIndex* index, const char* key) {
+    size_t lo = 0;
+    size_t hi = index->size;
+
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if(strcmp(index_word(index, mid), key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+
+static char buffer_reserve(Buffer* buf, size_t extra) {
+    if(buf->len + extra <= buf->capacity)
+        return 1;
+
+    size_t new_capacity = buf->capacity ? buf->capacity : 4096;
+
+    while(new_capacity < buf->len + extra)
+        new_capacity *= 2;
+
+    char* new_data = realloc(buf->data, new_capacity);
+
+    if(!new_data) // Allocation failed
+        return 0;
+
+    buf->data = new_data;
+    buf->capacity = new_capacity;
+
+    return 1;
+}
+
+
+static char buffer_add_entry(Buffer* buf, const ServeIndex* index, size_t i) {
+    uint64_t count = index->counts[i];
+    uint32_t len = index->lens[i];
+
+    if(!buffer_reserve(buf, ENTRY_HEADER_SIZE + len))
+        return 0;
+
+    memcpy(buf->data + buf->len, &count, sizeof(count));
+    memcpy(buf->data + buf->len + sizeof(count), &len, sizeof(len));
+    memcpy(buf->data + buf->len + ENTRY_HEADER_SIZE, index_word(index, i), len);
+    buf->len += ENTRY_HEADER_SIZE + len;
+
+    return 1;
+}
+
+
+// Answer request into out, header included
+static char build_response(const ServeIndex* index, const ServeRequest* req, const char* key, Buffer* out) {
+    ServeResponse resp = {SERVE_OK, 0, 0};
+    out->len = 0;
+
+    if(!buffer_reserve(out, sizeof(resp)))
+        return 0;
+
+    out->len = sizeof(resp);
+
+    uint32_t limit = req->limit;
+
+    if(limit == 0 || limit > SERVE_MAX_RESULTS)
+        limit = SERVE_MAX_RESULTS;
+
+    switch(req->op) {
+        case SERVE_LOOKUP: {
+            size_t i = index_lower_bound(index, key);
+
+            if(i < index->size && !strcmp(index_word(index, i), key)) {
+                if(!buffer_add_entry(out, index, i))
+                    return 0;
+                resp.num_entries = 1;
+            }
+            break;
+        }
+        case SERVE_PREFIX: {
+            size_t i = index_lower_bound(index, key);
+
+            while(i < index->size && resp.num_entries < limit && !strncmp(index_word(index, i), key, req->key_len)) {
+                if(!buffer_add_entry(out, index, i++))
+                    return 0;
+                resp.num_entries++;
+            }
+            break;
+        }
+        case SERVE_TOPK: {
+            for(size_t i = 0; i < index->size && resp.num_entries < limit; i++) {
+                if(!buffer_add_entry(out, index, index->by_count[i]))
+                    return 0;
+                resp.num_entries++;
+            }
+            break;
+        }
+        default: // Unknown operation
+            resp.status = SERVE_BAD_REQUEST;
+            break;
+    }
+
+    resp.length = out->len - sizeof(resp);
+    memcpy(out->data, &resp, sizeof(resp));
+
+    return 1;
+}
+
+
+static char read_full(int fd, void* buf, size_t len) {
+    size_t done = 0;
+
+    while(done < len) {
+        ssize_t n = read(fd, (char*)buf + done, len - done);
+
+        if(n < 0 && errno == EINTR)
+            continue;
+
+        if(n <= 0) // Closed or failed
+            return 0;
+
+        done += n;
+    }
+
+    return 1;
+}
+
+
+static char write_full(int fd, const void* buf, size_t len) {
+    size_t done = 0;
+
+    while(done < len) {
+        ssize_t n = send(fd, (const char*)buf + done, len - done, MSG_NOSIGNAL);
+
+        if(n < 0 && errno == EINTR)
+            continue;
+
+        if(n <= 0) // Closed or failed
+            return 0;
+
+        done += n;
+    }
+
+    return 1;
+}
+
+
+// Answer requests on one connection until the client closes it
+static void* client_thread(void* arg) {
+    Client* client = (Client*)arg;
+    Server* server = client->server;
+    int fd = client->fd;
+    free(client);
+
+    char key[SERVE_MAX_KEY + 1];
+    Buffer out = {NULL, 0, 0};
+    ServeRequest req;
+
+    while(read_full(fd, &req, sizeof(req))) {
+        if(req.key_len > SERVE_MAX_KEY) { // Can't resynchronize, reject and hang up
+            ServeResponse resp = {SERVE_BAD_REQUEST, 0, 0};
+            write_full(fd, &resp, sizeof(resp));
+            break;
+        }
+
+        if(!read_full(fd, key, req.key_len))
+            break;
+
+        key[req.key_len] = '\0';
+
+        pthread_rwlock_rdlock(&server->lock);
+        char ok = build_response(server->index, &req, key, &out);
+        pthread_rwlock_unlock(&server->lock);
+
+        if(!ok || !write_full(fd, out.data, out.len))
+            break;
+    }
+
+    free(out.data);
+    close(fd);
+
+    return NULL;
+}
+
+
+static char same_file(const struct stat* a, const struct stat* b) {
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+
+// Swap in the dictionary once its file changed and settled, old index stays on failure
+static void maybe_reload(Server* server) {
+    struct stat st;
+
+    if(stat(server->dict_path, &st) || same_file(&st, &server->loaded) || same_file(&st, &server->failed))
+        return;
+
+    if(!same_file(&st, &server->pending)) { // Still being written, wait for size and mtime to hold for a poll
+        server->pending = st;
+        return;
+    }
+
+    if(st.st_size == 0) { // Truncated for a rewrite in place, never a dictionary worth swapping in
+        server->failed = st;
+        fprintf(stderr, "%s: reload skipped, file is empty\n", server->dict_path);
+        return;
+    }
+
+    ServeIndex* index = index_load(server->dict_path, &st);
+
+    if(!index) { // Partially written or invalid, retried when it changes again
+        server->failed = st;
+        fprintf(stderr, "%s: reload failed, keeping previous dictionary\n", server->dict_path);
+        return;
+    }
+
+    pthread_rwlock_wrlock(&server->lock);
+    ServeIndex* old = server->index;
+    server->index = index;
+    pthread_rwlock_unlock(&server->lock);
+
+    index_free(old);
+    server->loaded = st;
+
+    fprintf(stderr, "%s: reloaded %zu words\n", server->dict_path, index->size);
+}
+
+
+// Checks the dictionary file between sleeps, so building a new index
+// never holds up accepting clients
+static void* reload_thread(void* arg) {
+    Server* server = (Server*)arg;
+
+    while(!stop_requested) {
+        poll(NULL, 0, RELOAD_INTERVAL_MS);
+        maybe_reload(server);
+    }
+
+    return NULL;
+}
+
+
+static int listen_unix(const char* path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path too long: %s\n", path);
+        return -1;
+    }
+
+    strcpy(addr.sun_path, path);
+
+    struct stat st;
+
+    if(!lstat(path, &st) && S_ISSOCK(st.st_mode)) // Stale socket of a previous server
+        unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if(fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) || listen(fd, SOMAXCONN)) {
+        perror(path);
+        if(fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+static void serve_usage(const char* prog) {
+    fprintf(stderr, "usage: %s serve [--socket PATH] <dict>\n", prog);
+    fprintf(stderr, "  --socket PATH           unix socket to listen on (default %s)\n", SERVE_SOCKET);
+}
+
+
+// Serve lookups on a dictionary file until interrupted
+int serve_main(int argc, char* argv[]) {
+    static struct option long_opts[] = {
+        {"socket", required_argument, NULL, 's'},
+        {NULL, 0, NULL, 0}
+    };
+
+    const char* socket_path = SERVE_SOCKET;
+    int opt;
+    optind = 1;
+
+    while((opt = getopt_long(argc, argv, "", long_opts, NULL)) != -1) {
+        if(opt != 's') { // Unknown option
+            serve_usage("word_count");
+            return 1;
+        }
+
+        socket_path = optarg;
+    }
+
+    if(argc - optind != 1) { // Exactly one dictionary
+        serve_usage("word_count");
+        return 1;
+    }
+
+    Server server;
+    memset(&server, 0, sizeof(Server));
+    server.dict_path = argv[optind];
+    server.index = index_load(server.dict_path, &server.loaded);
+
+    if(!server.index) {
+        fprintf(stderr, "%s: not a readable dictionary\n", server.dict_path);
+        return 1;
+    }
+
+    int listen_fd = listen_unix(socket_path);
+
+    if(listen_fd < 0) {
+        index_free(server.index);
+        return 1;
+    }
+
+    pthread_rwlock_init(&server.lock, NULL);
+
+    // Stop on interrupt, poll returns EINTR since SA_RESTART is not set
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Signals stay with the accept loop, whose poll they interrupt
+    sigset_t stop_signals, old_mask;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &old_mask);
+
+    pthread_t reloader;
+    int reload_error = pthread_create(&reloader, NULL, reload_thread, &server);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+    if(reload_error) {
+        close(listen_fd);
+        unlink(socket_path);
+        index_free(server.index);
+        return 1;
+    }
+
+    fprintf(stderr, "serving %zu words from %s on %s\n", server.index->size, server.dict_path, socket_path);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    struct pollfd pfd = {listen_fd, POLLIN, 0};
+
+    while(!stop_requested) {
+        int ready = poll(&pfd, 1, RELOAD_INTERVAL_MS);
+
+        if(ready > 0) { // New client, one thread each
+            int fd = accept(listen_fd, NULL, NULL);
+            Client* client = fd >= 0 ? malloc(sizeof(Client)) : NULL;
+            pthread_t thread;
+
+            if(client) {
+                client->server = &server;
+                client->fd = fd;
+            }
+
+            if(!client || pthread_create(&thread, &attr, client_thread, client)) {
+                free(client);
+                if(fd >= 0)
+                    close(fd);
+            }
+        }
+    }
+
+    pthread_join(reloader, NULL);
+    pthread_attr_destroy(&attr);
+    close(listen_fd);
+    unlink(socket_path);
+
+    // Client threads may still be answering, the index is freed with the process
+    fprintf(stderr, "server stopped\n");
+
+    return 0;
+}
+
+
+int serve_connect(const char* socket_path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if(strlen(socket_path) >= sizeof(addr.sun_path))
+        return -1;
+
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if(fd < 0)
+        return -1;
+
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+// Send one request and wait for its response
+char serve_query(int fd, uint8_t op, uint32_t limit, const char* key, size_t key_len, ServeReply* reply) {
+    if(!reply || key_len > SERVE_MAX_KEY || (key_len && !key))
+        return 0; // Invalid input
+
+    char request[sizeof(ServeRequest) + SERVE_MAX_KEY];
+    ServeRequest req;
+    memset(&req, 0, sizeof(req));
+    req.op = op;
+    req.limit = limit;
+    req.key_len = key_len;
+
+    memcpy(request, &req, sizeof(req));
+
+    if(key_len) // Key may be NULL when empty
+        memcpy(request + sizeof(req), key, key_len);
+
+    if(!write_full(fd, request, sizeof(req) + key_len))
+        return 0;
+
+    ServeResponse resp;
+
+    if(!read_full(fd, &resp, sizeof(resp)))
+        return 0;
+
+    if(resp.length > reply->capacity) { // Grow reply buffer
+        char* new_data = realloc(reply->data, resp.length);
+
+        if(!new_data) // Allocation failed
+            return 0;
+
+        reply->data = new_data;
+        reply->capacity = resp.length;
+    }
+
+    if(!read_full(fd, reply->data, resp.length))
+        return 0;
+
+    reply->status = resp.status;
+    reply->num_entries = resp.num_entries;
+    reply->len = resp.length;
+
+    return 1;
+}
+
+
+// Decode entry at *pos, word is not null terminated
+char serve_reply_next(const ServeReply* reply, size_t* pos, const char** word, uint32_t* word_len, uint64_t* count) {
+    if(!reply || !pos || *pos > reply->len || reply->len - *pos < ENTRY_HEADER_SIZE)
+        return 0;
+
+    uint64_t entry_count;
+    uint32_t len;
+    memcpy(&entry_count, reply->data + *pos, sizeof(entry_count));
+    memcpy(&len, reply->data + *pos + sizeof(entry_count), sizeof(len));
+
+    if(reply->len - *pos - ENTRY_HEADER_SIZE < len) // Truncated entry
+        return 0;
+
+    if(word)
+        *word = reply->data + *pos + ENTRY_HEADER_SIZE;
+    if(word_len)
+        *word_len = len;
+    if(count)
+        *count = entry_count;
+
+    *pos += ENTRY_HEADER_SIZE + len;
+
+    return 1;
+}
+
+
+void serve_reply_free(ServeReply* reply) {
+    if(!reply) // Ensure non-null input
+        return;
+
+    free(reply->data);
+    reply->data = NULL;
+    reply->len = 0;
+    reply->capacity = 0;
+}
@@ -0,0 +1,392 @@
+#include <stdio.h>
+#include <string.h>
+#include "../include/sort_dict.h"
+#include "../include/word_arena.h"
+
+// Sort-then-count dictionary. Every token is copied into an arena and
+// only sorted and run-length counted once the dictionary is read, which
+// trades memory per token for no per-token search. Words added with a
+// count, as when merging other dictionaries in, are kept as (word, count)
+// pairs and folded into the sorted run by finish.
+
+// Buckets smaller than this are finished with insertion sort
+#define INSERTION_SORT_SIZE 32
+
+typedef struct WeightedWord {
+    char* word;
+    uint64_t count;
+} WeightedWord;
+
+struct SortDict {
+    WordArena arena; // Copies of all tokens
+
+    // Tokens in insertion order, then distinct words after finish
+    char** words;
+    size_t num_words;
+    size_t capacity;
+
+    uint64_t* counts; // Run length of each distinct word
+    size_t counts_capacity;
+
+    // Words added with a count, folded in by finish
+    WeightedWord* weighted;
+    size_t num_weighted;
+    size_t weighted_capacity;
+    char finished;
+};
+
+
+SortDict* sort_dict_create() {
+    SortDict* dict = calloc(1, sizeof(SortDict));
+
+    if(!dict) // Allocation failed
+        return NULL;
+
+    return dict;
+}
+
+
+// Size token array for num_tokens tokens up front
+char sort_dict_reserve(SortDict* dict, size_t num_tokens) {
+    if(!dict || dict->finished)
+        return 0; // Invalid input
+
+    if(num_tokens <= dict->capacity) // Already large enough
+        return 1;
+
+    char** new_words = realloc(dict->words, num_tokens * sizeof(char*));
+
+    if(!new_words) // Allocation failed
+        return 0;
+
+    dict->words = new_words;
+    dict->capacity = num_tokens;
+
+    return 1;
+}
+
+
+char sort_dict_add(SortDict* dict, const char* word, size_t word_size) {
+    if(!dict || !word || dict->finished || word_size > ARENA_BLOCK_SIZE)
+        return 0; // Invalid input
+
+    if(dict->num_words == dict->capacity) { // Grow token array
+        size_t new_capacity = dict->capacity ? dict->capacity * 2 : 4096;
+        char** new_words = realloc(dict->words, new_capacity * sizeof(char*));
+
+        if(!new_words) // Allocation failed
+            return 0;
+
+        dict->words = new_words;
+        dict->capacity = new_capacity;
+    }
+
+    char* copy = word_arena_copy(&dict->arena, word, word_size);
+
+    if(!copy) // Allocation failed
+        return 0;
+
+    dict->words[dict->num_words++] = copy;
+
+    return 1;
+}
+
+
+// Add word count times, kept as one pair rather than count tokens
+char sort_dict_add_count(SortDict* dict, const char* word, size_t word_size, uint64_t count) {
+    if(count == 1) // Plain token
+        return sort_dict_add(dict, word, word_size);
+
+    if(!dict || !word || dict->finished || word_size > ARENA_BLOCK_SIZE)
+        return 0; // Invalid input
+
+    if(dict->num_weighted == dict->weighted_capacity) { // Grow pair array
+        size_t new_capacity = dict->weighted_capacity ? dict->weighted_capacity * 2 : 256;
+        WeightedWord* new_weighted = realloc(dict->weighted, new_capacity * sizeof(WeightedWord));
+
+        if(!new_weighted) // Allocation failed
+            return 0;
+
+        dict->weighted = new_weighted;
+        dict->weighted_capacity = new_capacity;
+    }
+
+    char* copy = word_arena_copy(&dict->arena, word, word_size);
+
+    if(!copy) // Allocation failed
+        return 0;
+
+    dict->weighted[dict->num_weighted].word = copy;
+    dict->weighted[dict->num_weighted++].count = count;
+
+    return 1;
+}
+
+
+static void insertion_sort(char** words, size_t n, size_t depth) {
+    for(size_t i = 1; i < n; i++) {
+        char* word = words[i];
+        size_t j = i;
+
+        while(j > 0 && strcmp(words[j - 1] + depth, word + depth) > 0) {
+            words[j] = words[j - 1];
+            j--;
+        }
+
+        words[j] = word;
+    }
+}
+
+
+// MSD radix sort of words sharing their first depth bytes. The byte at
+// depth is read once per word into cache, so the distribution passes
+// stream through arrays instead of chasing word pointers again.
+static void radix_sort(char** words, char** tmp, unsigned char* cache, size_t n, size_t depth) {
+    while(n >= INSERTION_SORT_SIZE) {
+        size_t counts[256] = {0};
+
+        for(size_t i = 0; i < n; i++) {
+            cache[i] = (unsigned char)words[i][depth];
+            counts[cache[i]]++;
+        }
+
+        if(counts[cache[0]] == n) { // Common byte, no reordering needed
+            if(cache[0] == '\0') // All words equal
+                return;
+
+            depth++;
+            continue;
+        }
+
+        size_t starts[256];
+        size_t pos = 0;
+
+        for(int b = 0; b < 256; b++) {
+            starts[b] = pos;
+            pos += counts[b];
+        }
+
+        for(size_t i = 0; i < n; i++)
+            tmp[starts[cache[i]]++] = words[i];
+
+        memcpy(words, tmp, n * sizeof(char*));
+
+        // Words ending here are equal, sort the rest of each bucket
+        pos = counts[0];
+
+        for(int b = 1; b < 256; b++) {
+            if(counts[b] > 1)
+                radix_sort(words + pos, tmp, cache, counts[b], depth + 1);
+
+            pos += counts[b];
+        }
+
+        return;
+    }
+
+    insertion_sort(words, n, depth);
+}
+
+
+// Merge the sorted distinct words of b into the finished run of a
+static char merge_run(SortDict* a, char** b_words, const uint64_t* b_counts, size_t b_num) {
+    size_t total = a->num_words + b_num;
+    char** words = malloc((total ? total : 1) * sizeof(char*));
+    uint64_t* counts = malloc((total ? total : 1) * sizeof(uint64_t));
+
+    if(!words || !counts) { // Allocation failed
+        free(words);
+        free(counts);
+        return 0;
+    }
+
+    size_t i = 0, j = 0, n = 0;
+
+    while(i < a->num_words || j < b_num) {
+        int cmp;
+
+        if(i == a->num_words)
+            cmp = 1;
+        else if(j == b_num)
+            cmp = -1;
+        else
+            cmp = strcmp(a->words[i], b_words[j]);
+
+        if(cmp <= 0) {
+            words[n] = a->words[i];
+            counts[n] = a->counts[i++];
+
+            if(cmp == 0) // Word in both runs
+                counts[n] += b_counts[j++];
+        } else {
+            words[n] = b_words[j];
+            counts[n] = b_counts[j++];
+        }
+
+        n++;
+    }
+
+    free(a->words);
+    free(a->counts);
+    a->words = words;
+    a->counts = counts;
+    a->num_words = n;
+    a->capacity = total;
+    a->counts_capacity = total ? total : 1;
+
+    return 1;
+}
+
+
+static int compare_weighted(const void* a, const void* b) {
+    return strcmp(((const WeightedWord*)a)->word, ((const WeightedWord*)b)->word);
+}
+
+
+// Sort the (word, count) pairs, sum repeats and merge them into the run
+static char fold_weighted(SortDict* dict) {
+    size_t n = dict->num_weighted;
+
+    qsort(dict->weighted, n, sizeof(WeightedWord), compare_weighted);
+
+    char** words = malloc(n * sizeof(char*));
+    uint64_t* counts = malloc(n * sizeof(uint64_t));
+
+    if(!words || !counts) { // Allocation failed
+        free(words);
+        free(counts);
+        return 0;
+    }
+
+    size_t distinct = 0;
+
+    for(size_t i = 0; i < n; i++) {
+        if(distinct && !strcmp(words[distinct - 1], dict->weighted[i].word)) {
+            counts[distinct - 1] += dict->weighted[i].count;
+        } else {
+            words[distinct] = dict->weighted[i].word;
+            counts[distinct++] = dict->weighted[i].count;
+        }
+    }
+
+    char ok = merge_run(dict, words, counts, distinct);
+
+    free(words);
+    free(counts);
+
+    if(!ok)
+        return 0;
+
+    free(dict->weighted);
+    dict->weighted = NULL;
+    dict->num_weighted = 0;
+    dict->weighted_capacity = 0;
+
+    return 1;
+}
+
+
+// Sort tokens and collapse runs of equal words into counts
+char sort_dict_finish(SortDict* dict) {
+    if(!dict)
+        return 0;
+
+    if(dict->finished) // Pairs are left pending when folding failed
+        return dict->num_weighted ? fold_weighted(dict) : 1;
+
+    size_t n = dict->num_words;
+    char** tmp = malloc((n ? n : 1) * sizeof(char*));
+    unsigned char* cache = malloc(n ? n : 1);
+    dict->counts = malloc((n ? n : 1) * sizeof(uint64_t));
+    dict->counts_capacity = n ? n : 1;
+
+    if(!tmp || !cache || !dict->counts) { // Allocation failed
+        free(tmp);
+        free(cache);
+        return 0;
+    }
+
+    radix_sort(dict->words, tmp, cache, n, 0);
+
+    free(tmp);
+    free(cache);
+
+    // Run-length count in place
+    size_t distinct = 0;
+
+    for(size_t i = 0; i < n; i++) {
+        if(distinct && !strcmp(dict->words[distinct - 1], dict->words[i])) {
+            dict->counts[distinct - 1]++;
+        } else {
+            dict->words[distinct] = dict->words[i];
+            dict->counts[distinct++] = 1;
+        }
+    }
+
+    dict->num_words = distinct;
+    dict->finished = 1;
+
+    return dict->num_weighted ? fold_weighted(dict) : 1;
+}
+
+
+// Number of tokens and pairs before finish, distinct words after
+size_t sort_dict_size(SortDict* dict) {
+    if(!dict)
+        return 0;
+
+    return dict->num_words + dict->num_weighted;
+}
+
+
+// Bytes held by the arena, token and pair arrays and counts
+size_t sort_dict_memory(SortDict* dict) {
+    if(!dict)
+        return 0;
+
+    return sizeof(SortDict) + dict->arena.size + dict->capacity * sizeof(char*)
+        + (dict->counts ? dict->counts_capacity * sizeof(uint64_t) : 0)
+        + dict->weighted_capacity * sizeof(WeightedWord);
+}
+
+
+// Word at index in sorted order, dictionary must be finished
+char sort_dict_get(SortDict* dict, size_t index, const char** word, uint64_t* count) {
+    if(!dict || !dict->finished || index >= dict->num_words || !word)
+        return 0;
+
+    *word = dict->words[index];
+
+    if(count)
+        *count = dict->counts[index];
+
+    return 1;
+}
+
+
+// Move all words of b into a with one pass over both sorted runs, b is freed
+SortDict* sort_dict_merge(SortDict* a, SortDict* b) {
+    if(!a || !b || !sort_dict_finish(a) || !sort_dict_finish(b))
+        return NULL;
+
+    if(!merge_run(a, b->words, b->counts, b->num_words))
+        return NULL;
+
+    // Words of b point into its arena, which a now owns
+    word_arena_take(&a->arena, &b->arena);
+    sort_dict_free(b);
+
+    return a;
+}
+
+
+void sort_dict_free(SortDict* dict) {
+    if(!dict) // Ensure dict is not null
+        return;
+
+    word_arena_free(&dict->arena);
+    free(dict->words);
+    free(dict->counts);
+    free(dict->weighted);
+    free(dict);
+}
@@ -0,0 +1,199 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "../include/dict.h"
+#include "../include/tokenizer.h"
+
+
+void scanner_init(WordScanner* scan, Dict* dict) {
+    if(!scan) // Ensure non-null input
+        return;
+
+    scan->dict = dict;
+    scan->filter = NULL;
+    scan->cache = NULL;
+    scan->len = 0;
+    scan->in_word = 0;
+    scan->skip = 0;
+    scan->saw_space = 0;
+    scan->word_owned = 1;
+    scan->error = 0;
+
+    scan->ngram = 1;
+    scan->window_len = 0;
+    scan->window_count = 0;
+
+    scan->keep_head = 0;
+    scan->head = NULL;
+    scan->head_len = 0;
+    scan->head_capacity = 0;
+}
+
+
+// Count key through the hot-word cache when the scanner has one, returns 0
+// and marks the scanner failed if the dictionary couldn't take it
+static inline char scan_count(WordScanner* scan, const char* key, size_t key_size) {
+    char ok = scan->cache ? hot_cache_add(scan->cache, key, key_size) : dict_add(scan->dict, key, key_size);
+
+    if(!ok)
+        scan->error = 1;
+
+    return ok;
+}
+
+
+// Append word to the window and count the n-gram it completes
+static char window_push(WordScanner* scan) {
+    if(scan->window_len + scan->len + 2 > NGRAM_WINDOW_SIZE) { // Move kept tokens to the front
+        size_t first = scan->token_start[0];
+
+        memmove(scan->window, scan->window + first, scan->window_len - first);
+        scan->window_len -= first;
+
+        for(int i = 0; i < scan->window_count; i++)
+            scan->token_start[i] -= first;
+    }
+
+    if(scan->window_count) // Separate from previous token
+        scan->window[scan->window_len++] = ' ';
+
+    scan->token_start[scan->window_count] = scan->window_len;
+    scan->token_owned[scan->window_count] = scan->word_owned;
+    scan->window_count++;
+
+    memcpy(scan->window + scan->window_len, scan->word, scan->len);
+    scan->window_len += scan->len;
+
+    if(scan->window_count < scan->ngram)
+        return 1;
+
+    char ok = 1;
+
+    // N-grams belong to the section owning their first token
+    if(scan->token_owned[0]) {
+        size_t start = scan->token_start[0];
+
+        scan->window[scan->window_len] = '\0';
+        ok = scan_count(scan, scan->window + start, scan->window_len - start + 1);
+    }
+
+    // Slide past the first token
+    scan->window_count--;
+    memmove(scan->token_start, scan->token_start + 1, scan->window_count * sizeof(size_t));
+    memmove(scan->token_owned, scan->token_owned + 1, scan->window_count);
+
+    return ok;
+}
+
+
+// Whether an n-gram started by this section still needs tokens
+static char window_has_owned(const WordScanner* scan) {
+    for(int i = 0; i < scan->window_count; i++) {
+        if(scan->token_owned[i])
+            return 1;
+    }
+
+    return 0;
+}
+
+
+// Record the scanned word in dict, returns 0 if it failed to count
+static char scan_emit(WordScanner* scan) {
+    if(scan->filter && !word_filter_keep(scan->filter, scan->word, scan->len)) { // Filtered before any insert
+        scan->len = 0;
+        return 1;
+    }
+
+    scan->word[scan->len] = '\0';
+
+    char ok = scan->ngram > 1 ? window_push(scan) : scan_count(scan, scan->word, scan->len + 1);
+    scan->len = 0;
+
+    return ok;
+}
+
+
+// Append skipped character to head
+static char head_push(WordScanner* scan, char c) {
+    if(scan->head_len == scan->head_capacity) { // Grow head buffer
+        size_t new_capacity = scan->head_capacity ? scan->head_capacity * 2 : WORD_BUF_SIZE;
+        char* new_head = realloc(scan->head, new_capacity);
+
+        if(!new_head) // Allocation failed
+            return 0;
+
+        scan->head = new_head;
+        scan->head_capacity = new_capacity;
+    }
+
+    scan->head[scan->head_len++] = c;
+
+    return 1;
+}
+
+
+// Add words starting before end to dict, returns 0 once a word starts past
+// end or, with error set, once a word fails to count
+char scanner_feed(WordScanner* scan, const char* data, size_t len, long offset, long end) {
+    for(size_t i = 0; i < len; i++) {
+        unsigned char c = data[i];
+
+        if(isspace(c)) { // Delimiter ends current word
+            if(scan->len && !scan_emit(scan))
+                return 0;
+
+            scan->in_word = 0;
+            scan->skip = 0;
+            scan->saw_space = 1;
+            continue;
+        }
+
+        if(scan->skip) { // Word belongs to previous section
+            if(scan->keep_head && !head_push(scan, c)) {
+                scan->error = 1;
+                return 0;
+            }
+            continue;
+        }
+
+        if(!scan->in_word) { // First character of a word
+            scan->word_owned = offset + (long)i < end;
+
+            // Word belongs to next section, read ahead only to finish this section's n-grams
+            if(!scan->word_owned && (scan->ngram < 2 || !window_has_owned(scan)))
+                return 0;
+
+            scan->in_word = 1;
+        }
+
+        scan->word[scan->len++] = c;
+
+        if(scan->len == WORD_BUF_SIZE - 1 && !scan_emit(scan)) // Split long words like fscanf("%255s")
+            return 0;
+    }
+
+    return 1;
+}
+
+
+// Record word ended by end of input, returns 0 if any word failed to count
+char scanner_finish(WordScanner* scan) {
+    if(!scan) // Ensure non-null input
+        return 0;
+
+    if(scan->len)
+        scan_emit(scan);
+
+    return !scan->error;
+}
+
+
+void scanner_free(WordScanner* scan) {
+    if(!scan) // Ensure non-null input
+        return;
+
+    free(scan->head);
+    scan->head = NULL;
+    scan->head_len = 0;
+    scan->head_capacity = 0;
+}
\ No newline at end of file
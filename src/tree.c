@@ -29,14 +29,27 @@ typedef struct Tree {
     int (*compare)(const void*, const void*); // Comparison function
     uint32_t size; // Number of items in tree
     uint8_t max_height;
+    size_t memory; // Bytes of the tree, its nodes, keys and values
 } Tree;
 
 
-    typedef struct TreeIter {
-        Node** node_stack;
-        uint8_t stack_size;
-        uint8_t stack_capacity;
-    } TreeIter;
+typedef struct TreeIter {
+    Tree* tree; // Searched by seek
+    Node** node_stack;
+    size_t stack_size;
+    size_t stack_capacity;
+
+    // Draining iterators own the nodes and free each one on the call
+    // after it was returned
+    char drain;
+    Node** passed;
+    size_t passed_len;
+    size_t passed_capacity;
+} TreeIter;
+
+
+// Nodes a draining iterator can hold before the first grow
+#define DRAIN_PASSED_SIZE 64
 
 
 Node* rotate_left(Node* node) {
@@ -197,6 +210,7 @@ Tree* tree_create(int (*compare)(const void*, const void*)) {
     tree->compare = compare;
     tree->size = 0;
     tree->max_height = 0;
+    tree->memory = sizeof(Tree);
 
     return tree;
 }
@@ -219,6 +233,7 @@ char node_set(Node* node, const void* key, const size_t key_size, int(*set_val)(
         // Create new node as left child
         node->left = node_create(key, NULL, key_size, 0); // Create new node
         set_val(&node->left->val, &node->left->val_size); // Allow caller to set val
+        tree->memory += sizeof(Node) + key_size + node->left->val_size;
 
         //Increment tree height if necessary
         if(node->height == tree->max_height)
@@ -239,6 +254,7 @@ char node_set(Node* node, const void* key, const size_t key_size, int(*set_val)(
         // Create new node as right child
         node->right = node_create(key, NULL, key_size, 0); // Create new node
         set_val(&node->right->val, &node->right->val_size); // Allow caller to set val
+        tree->memory += sizeof(Node) + key_size + node->right->val_size;
 
         //Increment tree height if necessary
         if(node->height == tree->max_height)
@@ -260,6 +276,7 @@ char tree_set(Tree* tree, const void* key, const size_t key_size, int (*set_val)
         // Set root node
         tree->root = node_create(key, NULL, key_size, 0);
         set_val(&tree->root->val, &tree->root->val_size);
+        tree->memory += sizeof(Node) + key_size + tree->root->val_size;
         tree->size++;
         
         return 0;
@@ -279,10 +296,209 @@ char tree_set(Tree* tree, const void* key, const size_t key_size, int (*set_val)
 }
 
 
+// Value stored under key, NULL when key is absent
+// Insert key below node with a zeroed value unless present, storing its
+// value in val. Returns the subtree root, rebalanced when a node was added
+static Node* node_upsert(Node* node, const void* key, size_t key_size, size_t val_size, Tree* tree, void** val) {
+    if(!node) { // Key missing, create it here
+        node = node_create(key, NULL, key_size, 0);
+
+        if(!node) // Allocation failed
+            return NULL;
+
+        node->val = calloc(1, val_size);
+
+        if(!node->val) { // Allocation failed
+            free(node->key);
+            free(node);
+            return NULL;
+        }
+
+        node->val_size = val_size;
+        tree->memory += sizeof(Node) + key_size + val_size;
+        tree->size++;
+        *val = node->val;
+
+        return node;
+    }
+
+    int cmp = tree->compare(key, node->key);
+
+    if(cmp == 0) { // Key found
+        *val = node->val;
+        return node;
+    }
+
+    uint32_t size = tree->size;
+    Node** child = cmp < 0 ? &node->left : &node->right;
+    Node* subtree = node_upsert(*child, key, key_size, val_size, tree, val);
+
+    if(subtree)
+        *child = subtree;
+
+    return tree->size != size ? balance(node) : node;
+}
+
+
+// Value of key, inserted zeroed with val_size bytes when absent. Unlike
+// tree_set this walks the tree once, NULL when allocation fails
+void* tree_upsert(Tree* tree, const void* key, const size_t key_size, const size_t val_size) {
+    if(!tree || !key || !val_size)
+        return NULL; // Invalid input
+
+    void* val = NULL;
+    Node* root = node_upsert(tree->root, key, key_size, val_size, tree, &val);
+
+    if(root) {
+        tree->root = root;
+        tree->max_height = root->height;
+    }
+
+    return val;
+}
+
+
+void* tree_get(Tree* tree, const void* key) {
+    if(!tree || !key)
+        return NULL; // Invalid input
+
+    Node* node = tree->root;
+
+    while(node) {
+        int cmp = tree->compare(key, node->key);
+
+        if(cmp == 0) // Key found
+            return node->val;
+
+        node = cmp < 0 ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
 uint32_t tree_size(Tree* tree) {
     return tree->size;
 }
 
+
+// Bytes held by the tree, its nodes, keys and values
+size_t tree_memory(Tree* tree) {
+    return tree ? tree->memory : 0;
+}
+
+// Append nodes of subtree to nodes in order
+static size_t node_flatten(Node* node, Node** nodes, size_t count, Node** stack) {
+    size_t stack_size = 0;
+
+    while(node || stack_size) {
+        while(node) { // Descend to leftmost node
+            stack[stack_size++] = node;
+            node = node->left;
+        }
+
+        node = stack[--stack_size];
+        nodes[count++] = node;
+        node = node->right;
+    }
+
+    return count;
+}
+
+
+// Link sorted nodes into a perfectly balanced subtree
+static Node* node_build(Node** nodes, size_t count) {
+    if(count == 0)
+        return NULL;
+
+    size_t mid = count / 2;
+    Node* node = nodes[mid];
+
+    node->left = node_build(nodes, mid);
+    node->right = node_build(nodes + mid + 1, count - mid - 1);
+    node->height = 1 + MAX(
+        node->left ? node->left->height : 0,
+        node->right ? node->right->height : 0
+    );
+
+    return node;
+}
+
+
+// Move all items of b into a in O(n + m), merge_val combines values of
+// keys in both trees into a's value. b is freed, returns a or NULL on failure
+Tree* tree_merge(Tree* a, Tree* b, int (*merge_val)(void**, size_t*, void*, size_t)) {
+    if(!a || !b || !merge_val)
+        return NULL; // Invalid input
+
+    size_t a_size = a->size;
+    size_t b_size = b->size;
+    size_t max_height = MAX(a->max_height, b->max_height) + 1;
+
+    Node** a_nodes = malloc((a_size + 1) * sizeof(Node*));
+    Node** b_nodes = malloc((b_size + 1) * sizeof(Node*));
+    Node** merged = malloc((a_size + b_size + 1) * sizeof(Node*));
+    Node** stack = malloc(max_height * sizeof(Node*));
+
+    if(!a_nodes || !b_nodes || !merged || !stack) { // Allocation failed
+        free(a_nodes);
+        free(b_nodes);
+        free(merged);
+        free(stack);
+        return NULL;
+    }
+
+    node_flatten(a->root, a_nodes, 0, stack);
+    node_flatten(b->root, b_nodes, 0, stack);
+
+    // Merge sorted node lists, equal keys keep a's node
+    size_t i = 0, j = 0, count = 0;
+    size_t freed = sizeof(Tree); // Bytes of b released here
+
+    while(i < a_size && j < b_size) {
+        int cmp = a->compare(a_nodes[i]->key, b_nodes[j]->key);
+
+        if(cmp < 0) {
+            merged[count++] = a_nodes[i++];
+        } else if(cmp > 0) {
+            merged[count++] = b_nodes[j++];
+        } else {
+            Node* dup = b_nodes[j++];
+            size_t val_size = a_nodes[i]->val_size;
+            merge_val(&a_nodes[i]->val, &a_nodes[i]->val_size, dup->val, dup->val_size);
+            a->memory += a_nodes[i]->val_size - val_size;
+            freed += sizeof(Node) + dup->key_size + dup->val_size;
+            merged[count++] = a_nodes[i++];
+
+            // Free duplicate node only, children are in the lists
+            free(dup->key);
+            free(dup->val);
+            free(dup);
+        }
+    }
+
+    while(i < a_size)
+        merged[count++] = a_nodes[i++];
+    while(j < b_size)
+        merged[count++] = b_nodes[j++];
+
+    a->root = node_build(merged, count);
+    a->size = count;
+    a->memory += b->memory - freed;
+    a->max_height = a->root ? a->root->height : 0;
+
+    free(a_nodes);
+    free(b_nodes);
+    free(merged);
+    free(stack);
+
+    b->root = NULL; // Nodes now belong to a
+    tree_free(b);
+
+    return a;
+}
+
+
 #ifdef TEST
 void node_print_level(Node* node, void (*print)(const void*, const void*, const size_t, const size_t), int level) {
     if(!node) // Node null
@@ -343,6 +559,14 @@ void node_free(Node* node) {
     free(node);
 }
 
+// Free node without its children
+static void node_release(Node* node) {
+    free(node->key);
+    free(node->val);
+    free(node);
+}
+
+
 void tree_free(Tree* tree) {
     if(!tree) // Ensure tree is not null
         return;
@@ -359,24 +583,15 @@ void tree_iter_grow_stack(TreeIter* tree_iter) {
     if(!tree_iter) // Ensure non-null input
         return; 
 
-    uint8_t new_capacity; // Nex capacity for iterator stack
-
-    // Calculate new capacity
-    if((uint16_t)tree_iter->stack_capacity + (tree_iter->stack_capacity / 2) > UINT8_MAX) // Check for possible overflow
-        new_capacity = UINT8_MAX; // Set stack to max size
-    else // Double current stack size
-        new_capacity = tree_iter->stack_capacity + (tree_iter->stack_capacity / 2);
+    // Double current stack size
+    size_t new_capacity = tree_iter->stack_capacity ? tree_iter->stack_capacity * 2 : 16;
 
     // Allocate memory for new stack
-    Node** new_stack = malloc(new_capacity * sizeof(Node*));
+    Node** new_stack = realloc(tree_iter->node_stack, new_capacity * sizeof(Node*));
 
     if(!new_stack) // Handle allocation failure
         return;
 
-    // Copy old stack to new and free
-    memcpy(new_stack, tree_iter->node_stack, tree_iter->stack_size * sizeof(Node*));
-    free(tree_iter->node_stack);  
-
     // Update iterator fields
     tree_iter->node_stack = new_stack;
     tree_iter->stack_capacity = new_capacity;
@@ -390,6 +605,9 @@ void tree_iter_push_left(TreeIter* tree_iter, Node* node) {
         if(tree_iter->stack_size == tree_iter->stack_capacity)
             tree_iter_grow_stack(tree_iter);
 
+        if(tree_iter->stack_size == tree_iter->stack_capacity) // Growth failed
+            return;
+
         // Push to stack
         tree_iter->node_stack[tree_iter->stack_size++] = temp;
         temp = temp->left;
@@ -407,7 +625,8 @@ TreeIter* tree_iter_create(Tree* tree) {
         return NULL;
 
     // Allocate memory for node stack
-    tree_iter->node_stack = malloc(tree->max_height * sizeof(Node*));
+    size_t capacity = tree->max_height ? tree->max_height : 1;
+    tree_iter->node_stack = malloc(capacity * sizeof(Node*));
 
     if(!tree_iter->node_stack) { // Handle allocation failure
         free(tree_iter); // Deallocate iterator memory
@@ -415,8 +634,13 @@ TreeIter* tree_iter_create(Tree* tree) {
     }
 
     // Initialize stack size and capacity
+    tree_iter->tree = tree;
     tree_iter->stack_size = 0;
-    tree_iter->stack_capacity = tree->max_height;
+    tree_iter->stack_capacity = capacity;
+    tree_iter->drain = 0;
+    tree_iter->passed = NULL;
+    tree_iter->passed_len = 0;
+    tree_iter->passed_capacity = 0;
 
     // Push leftmost nodes to stack
     tree_iter_push_left(tree_iter, tree->root);
@@ -424,6 +648,58 @@ TreeIter* tree_iter_create(Tree* tree) {
     return tree_iter;
 }
 
+// Iterator that takes the nodes of tree and frees each one once the
+// caller moves past it, tree is left empty
+TreeIter* tree_drain_create(Tree* tree) {
+    TreeIter* tree_iter = tree_iter_create(tree);
+
+    if(!tree_iter) // Allocation failed
+        return NULL;
+
+    tree_iter->passed = malloc(DRAIN_PASSED_SIZE * sizeof(Node*));
+
+    if(!tree_iter->passed) { // Allocation failed
+        tree_iter_free(tree_iter);
+        return NULL;
+    }
+
+    tree_iter->drain = 1;
+    tree_iter->passed_capacity = DRAIN_PASSED_SIZE;
+
+    // Nodes now belong to the iterator
+    tree->root = NULL;
+    tree->size = 0;
+    tree->max_height = 0;
+    tree->memory = sizeof(Tree);
+
+    return tree_iter;
+}
+
+
+// Free nodes returned by the previous call of a draining iterator
+static void drain_release_passed(TreeIter* tree_iter) {
+    for(size_t i = 0; i < tree_iter->passed_len; i++)
+        node_release(tree_iter->passed[i]);
+
+    tree_iter->passed_len = 0;
+}
+
+
+// Room to hold up to max returned nodes, returns how many fit
+static size_t drain_reserve(TreeIter* tree_iter, size_t max) {
+    if(max > tree_iter->passed_capacity) {
+        Node** new_passed = realloc(tree_iter->passed, max * sizeof(Node*));
+
+        if(new_passed) { // On failure return fewer items per call
+            tree_iter->passed = new_passed;
+            tree_iter->passed_capacity = max;
+        }
+    }
+
+    return max < tree_iter->passed_capacity ? max : tree_iter->passed_capacity;
+}
+
+
 char tree_iter_has_next(TreeIter* tree_iter) {
     if(!tree_iter) // Ensure non-null input
         return 0;
@@ -439,6 +715,9 @@ char tree_iter_next(TreeIter* tree_iter, void** key, size_t* key_size, void** va
     // Ensure non-null inputs
     if(!tree_iter || !key || !val)
         return 0;
+
+    if(tree_iter->drain) // Caller is done with the previous node
+        drain_release_passed(tree_iter);
     
     if(tree_iter->stack_size < 1)
         return 0;
@@ -446,6 +725,9 @@ char tree_iter_next(TreeIter* tree_iter, void** key, size_t* key_size, void** va
     // Get next node
     Node* next = tree_iter->node_stack[--tree_iter->stack_size];
 
+    if(tree_iter->drain) // Passed capacity is never below one
+        tree_iter->passed[tree_iter->passed_len++] = next;
+
     // Set pointer arguments to node's key and value
     *key = next->key;
     *val = next->val;
@@ -464,10 +746,89 @@ char tree_iter_next(TreeIter* tree_iter, void** key, size_t* key_size, void** va
 }
 
 
+// Fill entries with up to max next items, returns number filled
+size_t tree_iter_next_batch(TreeIter* tree_iter, TreeEntry* entries, size_t max) {
+    if(!tree_iter || !entries)
+        return 0;
+
+    size_t count = 0;
+
+    if(tree_iter->drain) { // Caller is done with the previous batch
+        drain_release_passed(tree_iter);
+        max = drain_reserve(tree_iter, max);
+    }
+
+    while(count < max && tree_iter->stack_size > 0) {
+        Node* next = tree_iter->node_stack[--tree_iter->stack_size];
+
+        if(tree_iter->drain)
+            tree_iter->passed[tree_iter->passed_len++] = next;
+
+        entries[count].key = next->key;
+        entries[count].key_size = next->key_size;
+        entries[count].val = next->val;
+        count++;
+
+        // Push right child and it's leftmost children to stack
+        if(next->right)
+            tree_iter_push_left(tree_iter, next->right);
+
+        // Start loading the next node's key and value while this one is consumed
+        if(tree_iter->stack_size > 0) {
+            Node* upcoming = tree_iter->node_stack[tree_iter->stack_size - 1];
+            __builtin_prefetch(upcoming->key);
+            __builtin_prefetch(upcoming->val);
+        }
+    }
+
+    return count;
+}
+
+
+// Position iterator at the first key not less than key
+char tree_iter_seek(TreeIter* tree_iter, const void* key) {
+    if(!tree_iter || !key)
+        return 0;
+
+    tree_iter->stack_size = 0;
+    Node* node = tree_iter->tree->root;
+
+    // Stack keeps the ancestors still to be visited, in order
+    while(node) {
+        if(tree_iter->tree->compare(key, node->key) <= 0) {
+            if(tree_iter->stack_size == tree_iter->stack_capacity)
+                tree_iter_grow_stack(tree_iter);
+
+            if(tree_iter->stack_size == tree_iter->stack_capacity) // Growth failed
+                return 0;
+
+            tree_iter->node_stack[tree_iter->stack_size++] = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+
+    return tree_iter->stack_size > 0;
+}
+
+
 void tree_iter_free(TreeIter* tree_iter) {
     if(!tree_iter) // Ensure non-null input
         return;
 
+    if(tree_iter->drain) { // Free nodes not drained yet
+        drain_release_passed(tree_iter);
+
+        // Left subtrees of stacked nodes are stacked above them or already passed
+        for(size_t i = 0; i < tree_iter->stack_size; i++) {
+            node_free(tree_iter->node_stack[i]->right);
+            node_release(tree_iter->node_stack[i]);
+        }
+
+        free(tree_iter->passed);
+    }
+
     // Deallocate stack memory
     if(tree_iter->node_stack)
         free(tree_iter->node_stack);
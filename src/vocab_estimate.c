@@ -0,0 +1,262 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include "../include/tokenizer.h"
+#include "../include/vocab_estimate.h"
+#include "../include/word_hash.h"
+
+// Reads a few chunks spread over the file, counts their keys exactly and
+// their distinct keys with HyperLogLog, then extrapolates to the whole
+// file. Distinct keys grow sublinearly with tokens, so the growth rate is
+// fitted from the first half of each sample against the whole sample.
+
+#define NUM_SAMPLES 16
+#define SAMPLE_SIZE (64 * 1024)
+
+// 2^HLL_BITS registers, standard error 1.04 / sqrt(2^HLL_BITS), about 0.8%
+#define HLL_BITS 14
+#define HLL_REGISTERS (1 << HLL_BITS)
+
+typedef struct HyperLogLog {
+    uint8_t registers[HLL_REGISTERS];
+} HyperLogLog;
+
+// Keys of the samples and of the first half of each sample
+typedef struct SampleCounts {
+    HyperLogLog full;
+    HyperLogLog half;
+    size_t tokens;
+    size_t half_tokens;
+    size_t key_bytes;
+
+    // Hashes of the last tokens, combined into n-gram hashes
+    uint64_t window[NGRAM_MAX];
+    size_t window_bytes[NGRAM_MAX];
+    int window_count;
+} SampleCounts;
+
+
+// Spread the bits of a hash, MurmurHash3 finalizer
+static inline uint64_t mix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+
+static void hll_add(HyperLogLog* hll, uint64_t hash) {
+    size_t index = hash >> (64 - HLL_BITS);
+    uint64_t rest = (hash << HLL_BITS) | (1ULL << (HLL_BITS - 1)); // Bound rank when rest is zero
+    uint8_t rank = __builtin_clzll(rest) + 1;
+
+    if(rank > hll->registers[index])
+        hll->registers[index] = rank;
+}
+
+
+static double hll_count(const HyperLogLog* hll) {
+    double m = HLL_REGISTERS;
+    double sum = 0;
+    int zeros = 0;
+
+    for(int i = 0; i < HLL_REGISTERS; i++) {
+        sum += ldexp(1.0, -hll->registers[i]);
+        zeros += hll->registers[i] == 0;
+    }
+
+    double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+
+    if(estimate <= 2.5 * m && zeros) // Small counts, use linear counting
+        estimate = m * log(m / zeros);
+
+    return estimate;
+}
+
+
+// Count token and the n-gram it completes
+static void sample_token(SampleCounts* counts, const char* token, size_t len, int ngram, char first_half) {
+    if(counts->window_count == ngram) { // Slide past the first token
+        counts->window_count--;
+        memmove(counts->window, counts->window + 1, counts->window_count * sizeof(uint64_t));
+        memmove(counts->window_bytes, counts->window_bytes + 1, counts->window_count * sizeof(size_t));
+    }
+
+    counts->window[counts->window_count] = word_hash(token, len, 0);
+    counts->window_bytes[counts->window_count] = len + 1; // Separator or null
+    counts->window_count++;
+
+    if(counts->window_count < ngram)
+        return;
+
+    uint64_t hash = counts->window[0];
+
+    for(int i = 1; i < ngram; i++) {
+        hash = mix64(hash ^ counts->window[i]);
+        counts->key_bytes += counts->window_bytes[i];
+    }
+
+    counts->key_bytes += counts->window_bytes[0];
+    counts->tokens++;
+    hll_add(&counts->full, hash);
+
+    if(first_half) {
+        counts->half_tokens++;
+        hll_add(&counts->half, hash);
+    }
+}
+
+
+// Count keys of data, skipping a partial word at either edge
+static size_t sample_scan(SampleCounts* counts, const char* data, size_t len, char cut_start, char cut_end, int ngram) {
+    size_t i = 0;
+
+    if(cut_start) { // Word started before the sample
+        while(i < len && !isspace((unsigned char)data[i]))
+            i++;
+    }
+
+    if(cut_end) { // Word continues after the sample
+        while(len > i && !isspace((unsigned char)data[len - 1]))
+            len--;
+    }
+
+    size_t start = i;
+    size_t half = start + (len - start) / 2;
+    size_t word_start = 0, word_len = 0;
+
+    counts->window_count = 0;
+
+    for(; i <= len; i++) {
+        if(i == len || isspace((unsigned char)data[i])) {
+            if(word_len)
+                sample_token(counts, data + word_start, word_len, ngram, word_start < half);
+
+            word_len = 0;
+            continue;
+        }
+
+        if(!word_len)
+            word_start = i;
+
+        // Split long words like the scanner
+        if(++word_len == WORD_BUF_SIZE - 1) {
+            sample_token(counts, data + word_start, word_len, ngram, word_start < half);
+            word_len = 0;
+            word_start = i + 1;
+        }
+    }
+
+    return len - start;
+}
+
+
+char vocab_estimate(const char* filepath, long file_size, int ngram, VocabEstimate* est) {
+    if(!filepath || !est || file_size < 0 || ngram < 1 || ngram > NGRAM_MAX)
+        return 0; // Invalid input
+
+    memset(est, 0, sizeof(VocabEstimate));
+
+    int fd = open(filepath, O_RDONLY);
+
+    if(fd < 0) // File failed to open
+        return 0;
+
+    // Small files are read whole, larger ones at a random offset in each of
+    // NUM_SAMPLES strata, each longer than a sample so the offset has room
+    int num_samples = file_size / NUM_SAMPLES > SAMPLE_SIZE ? NUM_SAMPLES : 1;
+    size_t buffer_size = num_samples > 1 ? SAMPLE_SIZE : (size_t)file_size;
+
+    SampleCounts* counts = calloc(1, sizeof(SampleCounts));
+    char* buffer = malloc(buffer_size + 1);
+
+    if(!counts || !buffer) { // Allocation failed
+        free(counts);
+        free(buffer);
+        close(fd);
+        return 0;
+    }
+
+    long stratum = file_size / num_samples;
+    uint64_t seed = mix64(file_size); // Same samples for the same size
+    char ok = 1;
+
+    for(int s = 0; ok && s < num_samples; s++) {
+        long offset = 0;
+        size_t want = file_size;
+
+        if(num_samples > 1) {
+            seed = mix64(seed + s);
+            offset = s * stratum + seed % (stratum - SAMPLE_SIZE);
+            want = SAMPLE_SIZE;
+        }
+
+        // Read the byte before the sample to tell whether its first word is cut
+        long read_offset = offset > 0 ? offset - 1 : 0;
+        ssize_t got = pread(fd, buffer, want + (offset > 0), read_offset);
+
+        if(got < 0) { // Read failed
+            ok = 0;
+            break;
+        }
+
+        char cut_start = offset > 0 && got > 0 && !isspace((unsigned char)buffer[0]);
+        char* data = buffer + (offset > 0);
+        size_t len = got > (offset > 0) ? got - (offset > 0) : 0;
+        char cut_end = offset + (long)len < file_size;
+
+        est->sample_bytes += sample_scan(counts, data, len, cut_start, cut_end, ngram);
+    }
+
+    if(ok) { // Extrapolate from samples
+        double distinct = hll_count(&counts->full);
+        double half_distinct = hll_count(&counts->half);
+
+        if(distinct > counts->tokens) // Counted exactly, HyperLogLog can overshoot
+            distinct = counts->tokens;
+
+        est->num_samples = num_samples;
+        est->sample_tokens = counts->tokens;
+        est->sample_distinct = distinct + 0.5;
+        est->key_size = counts->tokens ? counts->key_bytes / counts->tokens : 0;
+        est->growth = 1;
+
+        if(half_distinct >= 1 && distinct > half_distinct && counts->tokens > counts->half_tokens && counts->half_tokens)
+            est->growth = log(distinct / half_distinct) / log((double)counts->tokens / counts->half_tokens);
+        else if(distinct <= half_distinct) // No new keys in the second halves
+            est->growth = 0;
+
+        if(est->growth > 1)
+            est->growth = 1;
+
+        est->num_tokens = est->sample_bytes ? (double)counts->tokens * file_size / est->sample_bytes + 0.5 : 0;
+        est->num_distinct = vocab_distinct_at(est, est->num_tokens);
+    }
+
+    free(counts);
+    free(buffer);
+    close(fd);
+
+    return ok;
+}
+
+
+// Expected distinct keys among num_tokens keys of the file
+size_t vocab_distinct_at(const VocabEstimate* est, size_t num_tokens) {
+    if(!est || !est->sample_tokens)
+        return 0;
+
+    double distinct = est->sample_distinct * pow((double)num_tokens / est->sample_tokens, est->growth);
+
+    if(distinct > num_tokens)
+        distinct = num_tokens;
+
+    return distinct + 0.5;
+}
@@ -0,0 +1,54 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../include/word_arena.h"
+
+// Copy word into the arena, word_size includes the terminating null
+char* word_arena_copy(WordArena* arena, const char* word, size_t word_size) {
+    ArenaBlock* block = arena->blocks;
+
+    if(!block || block->used + word_size > block->size) { // Start new block
+        size_t block_size = arena->block_size ? arena->block_size : ARENA_BLOCK_SIZE;
+        size_t size = word_size > block_size ? word_size : block_size;
+        block = malloc(sizeof(ArenaBlock) + size);
+
+        if(!block) // Allocation failed
+            return NULL;
+
+        block->next = arena->blocks;
+        block->used = 0;
+        block->size = size;
+        arena->blocks = block;
+        arena->size += sizeof(ArenaBlock) + size;
+    }
+
+    char* copy = block->data + block->used;
+    memcpy(copy, word, word_size);
+    block->used += word_size;
+
+    return copy;
+}
+
+
+// Move the blocks of other into arena, words in them stay where they are
+void word_arena_take(WordArena* arena, WordArena* other) {
+    ArenaBlock** tail = &arena->blocks;
+
+    while(*tail)
+        tail = &(*tail)->next;
+
+    *tail = other->blocks;
+    arena->size += other->size;
+    other->blocks = NULL;
+    other->size = 0;
+}
+
+
+void word_arena_free(WordArena* arena) {
+    while(arena->blocks) { // Free arena blocks
+        ArenaBlock* next = arena->blocks->next;
+        free(arena->blocks);
+        arena->blocks = next;
+    }
+
+    arena->size = 0;
+}
@@ -0,0 +1,440 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "../include/tokenizer.h"
+#include "../include/word_filter.h"
+#include "../include/word_hash.h"
+
+// Minimal perfect hash by hash and displace. Keys are spread over buckets
+// of about BUCKET_KEYS keys, then buckets, largest first, search for a
+// seed that sends all their keys to free slots. A lookup is one hash, one
+// seed load and one key comparison, with no probing.
+
+#define BUCKET_KEYS 2
+
+// Seeds tried per bucket before the build restarts with a new salt
+#define MAX_SEED (1 << 20)
+#define MAX_SALTS 8
+
+// Key stored in a slot, short keys compare without touching key
+typedef struct {
+    uint64_t prefix; // First eight bytes, zero padded
+    size_t len;
+    char* key;
+} Slot;
+
+struct PerfectHash {
+    size_t num_keys; // Also the number of slots
+    size_t num_buckets;
+    uint64_t salt;
+    uint32_t* seeds; // Per bucket
+    Slot* slots;
+};
+
+
+// Map hash onto [0, n) by multiplying, cheaper than a division
+static inline size_t reduce_range(uint64_t hash, size_t n) {
+    return (size_t)(((unsigned __int128)hash * n) >> 64);
+}
+
+
+static inline size_t slot_of(uint64_t hash, uint32_t seed, size_t num_keys) {
+    uint64_t h = (hash ^ (seed * 0x9e3779b97f4a7c15ULL)) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+
+    return reduce_range(h, num_keys);
+}
+
+
+static inline size_t bucket_of(uint64_t hash, size_t num_buckets) {
+    return reduce_range(hash << 32 | hash >> 32, num_buckets);
+}
+
+
+static int compare_word(const void* a, const void* b) {
+    return strcmp(*(const char**)a, *(const char**)b);
+}
+
+
+// Keys hashed into one bucket
+typedef struct {
+    size_t bucket;
+    size_t start; // First key in the bucket ordered key array
+    size_t size;
+} Bucket;
+
+
+static int compare_bucket_size(const void* a, const void* b) {
+    const Bucket* x = (const Bucket*)a;
+    const Bucket* y = (const Bucket*)b;
+
+    if(x->size != y->size) // Largest first
+        return x->size < y->size ? 1 : -1;
+
+    return x->bucket < y->bucket ? -1 : x->bucket > y->bucket;
+}
+
+
+// Find a seed for every bucket with this salt, returns 0 if one has none
+static char place_keys(PerfectHash* hash, char** words, size_t num_words) {
+    size_t n = num_words;
+    uint64_t* hashes = malloc(n * sizeof(uint64_t));
+    size_t* order = malloc(n * sizeof(size_t)); // Key indices grouped by bucket
+    Bucket* buckets = calloc(hash->num_buckets, sizeof(Bucket));
+    char* taken = calloc(n, 1);
+    size_t* slots = malloc(n * sizeof(size_t));
+    char ok = hashes && order && buckets && taken && slots;
+
+    for(size_t i = 0; ok && i < n; i++) {
+        hashes[i] = word_hash(words[i], strlen(words[i]), hash->salt);
+        buckets[bucket_of(hashes[i], hash->num_buckets)].size++;
+    }
+
+    // Group keys by bucket
+    size_t start = 0;
+
+    for(size_t b = 0; ok && b < hash->num_buckets; b++) {
+        buckets[b].bucket = b;
+        buckets[b].start = start;
+        start += buckets[b].size;
+        buckets[b].size = 0;
+    }
+
+    for(size_t i = 0; ok && i < n; i++) {
+        Bucket* bucket = &buckets[bucket_of(hashes[i], hash->num_buckets)];
+        order[bucket->start + bucket->size++] = i;
+    }
+
+    if(ok)
+        qsort(buckets, hash->num_buckets, sizeof(Bucket), compare_bucket_size);
+
+    for(size_t b = 0; ok && b < hash->num_buckets && buckets[b].size; b++) {
+        Bucket* bucket = &buckets[b];
+        uint32_t seed;
+
+        for(seed = 0; seed < MAX_SEED; seed++) {
+            size_t placed = 0;
+
+            for(; placed < bucket->size; placed++) {
+                size_t slot = slot_of(hashes[order[bucket->start + placed]], seed, n);
+
+                if(taken[slot]) // Collides with an earlier bucket or this one
+                    break;
+
+                taken[slot] = 1;
+                slots[placed] = slot;
+            }
+
+            if(placed == bucket->size) // Every key found a free slot
+                break;
+
+            for(size_t k = 0; k < placed; k++) // Undo partial placement
+                taken[slots[k]] = 0;
+        }
+
+        if(seed == MAX_SEED) { // No seed works, retry with another salt
+            ok = 0;
+            break;
+        }
+
+        hash->seeds[bucket->bucket] = seed;
+
+        for(size_t k = 0; k < bucket->size; k++) {
+            Slot* slot = &hash->slots[slots[k]];
+            slot->key = words[order[bucket->start + k]];
+            slot->len = strlen(slot->key);
+            slot->prefix = word_prefix(slot->key, slot->len);
+        }
+    }
+
+    free(hashes);
+    free(order);
+    free(buckets);
+    free(taken);
+    free(slots);
+
+    return ok;
+}
+
+
+// Build a minimal perfect hash over words, duplicates are counted once
+PerfectHash* perfect_hash_create(const char** words, size_t num_words) {
+    PerfectHash* hash = calloc(1, sizeof(PerfectHash));
+    char** keys = malloc((num_words ? num_words : 1) * sizeof(char*));
+
+    if(!hash || !keys) { // Allocation failed
+        free(hash);
+        free(keys);
+        return NULL;
+    }
+
+    // Own sorted copies, dropping duplicates which no seed could separate
+    size_t n = 0;
+
+    for(size_t i = 0; i < num_words; i++)
+        keys[i] = (char*)words[i];
+
+    qsort(keys, num_words, sizeof(char*), compare_word);
+
+    for(size_t i = 0; i < num_words; i++) {
+        if(n && !strcmp(keys[n - 1], keys[i]))
+            continue;
+
+        keys[n] = strdup(keys[i]);
+
+        if(!keys[n]) { // Allocation failed
+            for(size_t k = 0; k < n; k++)
+                free(keys[k]);
+
+            free(keys);
+            free(hash);
+            return NULL;
+        }
+
+        n++;
+    }
+
+    hash->num_keys = n;
+    hash->num_buckets = n / BUCKET_KEYS + 1;
+    hash->seeds = calloc(hash->num_buckets, sizeof(uint32_t));
+    hash->slots = calloc(n ? n : 1, sizeof(Slot));
+    char ok = hash->seeds && hash->slots;
+
+    if(ok) {
+        ok = 0;
+
+        for(int s = 0; !ok && s < MAX_SALTS; s++) {
+            hash->salt = 0x243f6a8885a308d3ULL * (s + 1);
+            memset(hash->seeds, 0, hash->num_buckets * sizeof(uint32_t));
+            ok = place_keys(hash, keys, n);
+        }
+    }
+
+    if(!ok) { // Allocation failed or no salt worked, slots don't own the keys
+        for(size_t i = 0; i < n; i++)
+            free(keys[i]);
+
+        free(keys);
+
+        if(hash->slots)
+            memset(hash->slots, 0, (n ? n : 1) * sizeof(Slot));
+
+        perfect_hash_free(hash);
+        return NULL;
+    }
+
+    free(keys); // Slots own the copies now
+
+    return hash;
+}
+
+
+size_t perfect_hash_size(const PerfectHash* hash) {
+    return hash ? hash->num_keys : 0;
+}
+
+
+char perfect_hash_contains(const PerfectHash* hash, const char* word, size_t len) {
+    if(!hash || !hash->num_keys)
+        return 0;
+
+    uint64_t h = word_hash(word, len, hash->salt);
+    size_t slot = slot_of(h, hash->seeds[bucket_of(h, hash->num_buckets)], hash->num_keys);
+
+    // Words outside the set land on some slot too, so compare the key
+    const Slot* entry = &hash->slots[slot];
+
+    if(entry->len != len || entry->prefix != word_prefix(word, len))
+        return 0;
+
+    return len <= 8 || !memcmp(entry->key + 8, word + 8, len - 8);
+}
+
+
+void perfect_hash_free(PerfectHash* hash) {
+    if(!hash) // Ensure non-null input
+        return;
+
+    for(size_t i = 0; hash->slots && i < hash->num_keys; i++)
+        free(hash->slots[i].key);
+
+    free(hash->slots);
+    free(hash->seeds);
+    free(hash);
+}
+
+
+// Identify a word set by its sorted words
+static uint64_t set_id(const PerfectHash* hash, uint64_t id) {
+    if(!hash)
+        return id;
+
+    char** words = malloc((hash->num_keys ? hash->num_keys : 1) * sizeof(char*));
+
+    if(!words) // Allocation failed, fall back to size
+        return id ^ hash->num_keys;
+
+    for(size_t i = 0; i < hash->num_keys; i++)
+        words[i] = hash->slots[i].key;
+
+    qsort(words, hash->num_keys, sizeof(char*), compare_word);
+
+    for(size_t i = 0; i < hash->num_keys; i++)
+        id = word_hash(words[i], strlen(words[i]), id);
+
+    free(words);
+
+    return id;
+}
+
+
+WordFilter* word_filter_create(const char** include, size_t num_include, const char** exclude, size_t num_exclude) {
+    WordFilter* filter = calloc(1, sizeof(WordFilter));
+
+    if(!filter) // Allocation failed
+        return NULL;
+
+    if(include && !(filter->include = perfect_hash_create(include, num_include))) {
+        word_filter_free(filter);
+        return NULL;
+    }
+
+    if(exclude && !(filter->exclude = perfect_hash_create(exclude, num_exclude))) {
+        word_filter_free(filter);
+        return NULL;
+    }
+
+    filter->id = set_id(filter->exclude, set_id(filter->include, 1) * 31);
+
+    return filter;
+}
+
+
+// Read whitespace separated words of path, words the tokenizer splits can't match and are skipped.
+// Once text is set the caller frees text and words, also on failure.
+static char read_words(const char* path, char** text, const char*** words, size_t* num_words) {
+    FILE* file = fopen(path, "rb");
+
+    if(!file) { // File failed to open
+        perror(path);
+        return 0;
+    }
+
+    size_t len = 0, capacity = 0, words_capacity = 0;
+    char* data = NULL;
+    char buf[65536];
+    size_t got;
+
+    while((got = fread(buf, 1, sizeof(buf), file)) > 0) {
+        if(len + got + 1 > capacity) { // Grow text
+            capacity = (len + got + 1) * 2;
+            char* new_data = realloc(data, capacity);
+
+            if(!new_data) { // Allocation failed
+                free(data);
+                fclose(file);
+                return 0;
+            }
+
+            data = new_data;
+        }
+
+        memcpy(data + len, buf, got);
+        len += got;
+    }
+
+    if(ferror(file)) { // Read failed, the list would be truncated
+        perror(path);
+        free(data);
+        fclose(file);
+        return 0;
+    }
+
+    fclose(file);
+
+    *text = data;
+    *words = NULL;
+    *num_words = 0;
+
+    for(size_t i = 0; i < len;) {
+        while(i < len && isspace((unsigned char)data[i]))
+            i++;
+
+        size_t start = i;
+
+        while(i < len && !isspace((unsigned char)data[i]))
+            i++;
+
+        if(i == start || i - start > WORD_BUF_SIZE - 1) // Empty or split by the tokenizer
+            continue;
+
+        data[i++] = '\0'; // Terminate in place, text has room for a final null
+
+        if(*num_words == words_capacity) { // Grow word array
+            words_capacity = words_capacity ? words_capacity * 2 : 256;
+            const char** new_words = realloc(*words, words_capacity * sizeof(char*));
+
+            if(!new_words) // Allocation failed, caller frees the text and words so far
+                return 0;
+
+            *words = new_words;
+        }
+
+        (*words)[(*num_words)++] = data + start;
+    }
+
+    return 1;
+}
+
+
+// Build filter from word list files, either path may be NULL
+WordFilter* word_filter_load(const char* include_path, const char* exclude_path) {
+    char* text[2] = {NULL, NULL};
+    const char** words[2] = {NULL, NULL};
+    size_t num_words[2] = {0, 0};
+    const char* paths[2] = {include_path, exclude_path};
+    char ok = 1;
+
+    for(int i = 0; ok && i < 2; i++) {
+        if(paths[i])
+            ok = read_words(paths[i], &text[i], &words[i], &num_words[i]);
+    }
+
+    // An empty list still filters, so give it a non-null word array
+    static const char* none[1];
+    WordFilter* filter = NULL;
+
+    if(ok)
+        filter = word_filter_create(include_path ? (words[0] ? words[0] : none) : NULL, num_words[0],
+            exclude_path ? (words[1] ? words[1] : none) : NULL, num_words[1]);
+
+    for(int i = 0; i < 2; i++) { // Hashes keep their own copies
+        free(text[i]);
+        free(words[i]);
+    }
+
+    return filter;
+}
+
+
+// Whether word of len bytes is counted
+char word_filter_keep(const WordFilter* filter, const char* word, size_t len) {
+    if(!filter)
+        return 1;
+
+    if(filter->exclude && perfect_hash_contains(filter->exclude, word, len))
+        return 0;
+
+    return !filter->include || perfect_hash_contains(filter->include, word, len);
+}
+
+
+void word_filter_free(WordFilter* filter) {
+    if(!filter) // Ensure non-null input
+        return;
+
+    perfect_hash_free(filter->include);
+    perfect_hash_free(filter->exclude);
+    free(filter);
+}
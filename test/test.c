@@ -4,9 +4,26 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "../include/tree.h"
+#include "../include/art.h"
+#include "../include/dict_file.h"
+#include "../include/word_filter.h"
+#include "../include/result_cache.h"
+#include "../include/checkpoint.h"
+#include "../include/dict_writer.h"
+#include "../include/serve.h"
 
-void print_word(const void* key, const void* val, const size_t key_size, const size_t val_size) {
+// Room for the words merged by a test
+#define MERGED_SIZE 256
+
+static void print_word(const void* key, const void* val, const size_t key_size, const size_t val_size) {
     const char* word = (const char*)key;
     unsigned long long count = *(const unsigned long long*)val;
 
@@ -14,13 +31,13 @@ void print_word(const void* key, const void* val, const size_t key_size, const s
 }
 
 
-int compare_str(const void* a, const void* b) {
+static int compare_str(const void* a, const void* b) {
     return strcmp((const char*)a, (const char*)b);
 }
 
 
 // Pass to tree set to increment val (word count) or set to 1 if null
-int set_word_count(void** val, size_t* val_size) {
+static int set_word_count(void** val, size_t* val_size) {
     if(*val == NULL) { // New word added to tree
         // Allocate memory for word count
         unsigned long long* count = malloc(sizeof(unsigned long long));
@@ -39,6 +56,160 @@ int set_word_count(void** val, size_t* val_size) {
 }
 
 
+static char write_file(const char* path, const char* text) {
+    FILE* file = fopen(path, "w");
+
+    if(!file)
+        return 0;
+
+    char ok = fputs(text, file) >= 0;
+
+    return !fclose(file) && ok;
+}
+
+
+// Remove dir and the files in it
+static void remove_dir(const char* dir) {
+    DIR* d = opendir(dir);
+    struct dirent* ent;
+    char path[4096];
+
+    while(d && (ent = readdir(d))) {
+        if(strcmp(ent->d_name, ".") && strcmp(ent->d_name, "..")) {
+            snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+            unlink(path);
+        }
+    }
+
+    if(d)
+        closedir(d);
+
+    rmdir(dir);
+}
+
+
+// Write a plain dictionary of words in order
+static char write_dict(const char* path, const char** words, const unsigned long long* counts, size_t num_words) {
+    DictWriter* writer = dict_writer_open(path);
+    char ok = writer != NULL;
+
+    for(size_t i = 0; ok && i < num_words; i++)
+        ok = dict_writer_add(writer, words[i], counts[i]);
+
+    return writer && dict_writer_close(writer, NULL) && ok;
+}
+
+
+// Append word and count to the MERGED_SIZE string in ctx
+static char merged_sink(void* ctx, const char* word, unsigned long long count) {
+    char* merged = (char*)ctx;
+    size_t len = strlen(merged);
+
+    return snprintf(merged + len, MERGED_SIZE - len, "%s:%llu ", word, count) < (int)(MERGED_SIZE - len);
+}
+
+
+// Arguments and exit status of a server run on its own thread
+typedef struct {
+    char** argv;
+    int status;
+} ServeRun;
+
+
+static void* serve_thread(void* arg) {
+    ServeRun* run = (ServeRun*)arg;
+    run->status = serve_main(4, run->argv);
+
+    return NULL;
+}
+
+
+// Query server and render the words found as "word:count ", NULL on failure
+static const char* serve_words(int fd, uint8_t op, uint32_t limit, const char* key, char* out) {
+    ServeReply reply = {0};
+    char ok = serve_query(fd, op, limit, key, strlen(key), &reply) && reply.status == SERVE_OK;
+    size_t pos = 0, len = 0;
+    const char* word;
+    uint32_t word_len;
+    uint64_t count;
+    out[0] = '\0';
+
+    for(uint32_t i = 0; ok && i < reply.num_entries; i++) {
+        ok = serve_reply_next(&reply, &pos, &word, &word_len, &count);
+        len += snprintf(out + len, MERGED_SIZE - len, "%.*s:%llu ", (int)word_len, word, (unsigned long long)count);
+        ok = ok && len < MERGED_SIZE;
+    }
+
+    serve_reply_free(&reply);
+
+    return ok ? out : NULL;
+}
+
+
+// Write a block-compressed dictionary of words, per_block records a block
+static char write_dict_blocks(FILE* file, const char** words, const unsigned long long* counts,
+                              size_t num_words, size_t per_block) {
+    static char data[DICT_BLOCK_SIZE];
+    DictBlock blocks[64];
+    DictFooter footer = {0, DICT_MAGIC_SIZE, DICT_BLOCK_MAGIC};
+    char ok = fwrite(DICT_BLOCK_MAGIC, DICT_MAGIC_SIZE, 1, file) == 1;
+
+    for(size_t i = 0; i < num_words && ok; i += per_block) {
+        DictBlock* block = &blocks[footer.num_blocks++];
+        block->offset = footer.directory_offset;
+        block->raw_size = 0;
+        block->num_records = 0;
+        size_t len = 0;
+
+        for(size_t j = i; j < num_words && j < i + per_block; j++) { // First record of a block has no prev
+            const char* prev = j > i ? words[j - 1] : NULL;
+            len += dict_block_encode(data + len, prev, prev ? strlen(prev) : 0, words[j], strlen(words[j]), counts[j]);
+            block->raw_size += sizeof(size_t) + strlen(words[j]) + sizeof(unsigned long long);
+            block->num_records++;
+        }
+
+        block->size = len;
+        footer.directory_offset += len;
+        ok = fwrite(data, len, 1, file) == 1;
+    }
+
+    ok = ok && fwrite(blocks, sizeof(DictBlock), footer.num_blocks, file) == footer.num_blocks;
+    ok = ok && fwrite(&footer, sizeof(footer), 1, file) == 1;
+
+    return ok && fflush(file) == 0;
+}
+
+
+// Encode words, load them back on num_threads and compare with plain records
+static void check_dict_blocks(const char* name, const char** words, const unsigned long long* counts,
+                              size_t num_words, size_t per_block, int num_threads) {
+    FILE* file = tmpfile();
+    BlockDict* dict = file && write_dict_blocks(file, words, counts, num_words, per_block)
+                    ? block_dict_open(fileno(file)) : NULL;
+    char* raw = dict ? block_dict_load(dict, num_threads) : NULL;
+    char ok = raw != NULL;
+    size_t pos = 0;
+
+    for(size_t i = 0; i < num_words && ok; i++) { // Length, word bytes and count of each record
+        size_t len = strlen(words[i]);
+        unsigned long long count;
+        ok = !memcmp(raw + pos, &len, sizeof(len)) && !memcmp(raw + pos + sizeof(len), words[i], len);
+        memcpy(&count, raw + pos + sizeof(len) + len, sizeof(count));
+        ok = ok && count == counts[i];
+        pos += sizeof(len) + len + sizeof(count);
+    }
+
+    ok = ok && pos == dict->raw_size;
+    printf("Dict blocks %s on %d threads: %zu blocks, %s\n", name, num_threads,
+           dict ? dict->num_blocks : 0, ok ? "ok" : "FAILED");
+
+    free(raw);
+    block_dict_free(dict);
+
+    if(file)
+        fclose(file);
+}
+
 
 void test_tree() {
     Tree* tree = tree_create(compare_str);
@@ -76,11 +247,415 @@ void test_tree() {
     
     tree_iter_free(tree_it);
 
+    // Batches starting at a lower bound
+    tree_it = tree_iter_create(tree);
+    TreeEntry entries[4];
+    size_t len;
+    printf("\nBatches from \"ga\":\n");
+
+    if(tree_iter_seek(tree_it, "ga")) {
+        while((len = tree_iter_next_batch(tree_it, entries, 4)) > 0) {
+            for (size_t i = 0; i < len; ++i)
+                printf("%s ", (const char*)entries[i].key);
+            printf("\n");
+        }
+    }
+
+    tree_iter_free(tree_it);
+
     tree_free(tree);
 }
 
+void test_art() {
+    ArtTree* tree = art_create();
+
+    if (!tree) {
+        fprintf(stderr, "Failed to create tree.\n");
+        return;
+    }
+
+    // Shared prefixes split compressed paths, many first bytes grow nodes
+    const char* keys[] = {"https://a.com/x", "https://a.com/y", "https://b.org", "http", "https://a.com/x",
+                          "romane", "romanus", "romulus", "rubens", "ruber", "rubicon", "rubicundus", "a"};
+    size_t num_keys = sizeof(keys) / sizeof(keys[0]);
+
+    for (size_t i = 0; i < num_keys; ++i)
+        (*art_upsert(tree, (const unsigned char*)keys[i], strlen(keys[i]) + 1))++;
+
+    for (int c = 0; c < 256; ++c) {
+        unsigned char key[] = {'z', c ? c : 1, 0};
+        (*art_upsert(tree, key, sizeof(key)))++;
+    }
+
+    printf("ART size: %zu, memory: %zu\n", art_size(tree), art_memory(tree));
+
+    ArtIter* art_it = art_iter_create(tree);
+    const unsigned char* key;
+    size_t key_size;
+    uint64_t count;
+    printf("\nIterator:\n");
+
+    while(art_iter_next(art_it, &key, &key_size, &count)) {
+        if(key[0] != 'z')
+            printf("Key: %s, Value: %llu\n", (const char*)key, (unsigned long long)count);
+    }
+
+    art_iter_free(art_it);
+
+    art_free(tree);
+}
+
+void test_dict_block() {
+    // Empty dictionary, only magic, directory and footer
+    check_dict_blocks("empty", NULL, NULL, 0, 1, 2);
+
+    const char* one[] = {"a"};
+    unsigned long long one_count[] = {1};
+    check_dict_blocks("one record", one, one_count, 1, 1, 1);
+
+    // Long shared prefixes, ties broken near the end of the word
+    char prefixed[6][320];
+    const char* prefixed_words[6];
+    unsigned long long prefixed_counts[6];
+
+    for(int i = 0; i < 6; i++) {
+        memset(prefixed[i], 'p', 300);
+        snprintf(prefixed[i] + 300, 20, "%c%d", 'a' + i / 2, i);
+        prefixed_words[i] = prefixed[i];
+        prefixed_counts[i] = i + 1;
+    }
+
+    check_dict_blocks("long prefixes", prefixed_words, prefixed_counts, 6, 4, 1);
+    check_dict_blocks("long prefixes", prefixed_words, prefixed_counts, 6, 2, 3);
+
+    // Counts wider than 32 bits take longer varints
+    const char* wide[] = {"big", "bigger", "biggest"};
+    unsigned long long wide_counts[] = {(1ULL << 32) + 5, 1ULL << 40, 0xffffffffffffffffULL};
+    check_dict_blocks("wide counts", wide, wide_counts, 3, 2, 2);
+}
+
+void test_perfect_hash() {
+    // Keys of up to eight bytes compare by prefix alone, longer ones also compare the rest
+    const char* words[] = {"the", "a", "exactly8", "the", "stopwords-longer", "internationalization", "a"};
+    const char* members[] = {"the", "a", "exactly8", "stopwords-longer", "internationalization"};
+    const char* others[] = {"", "th", "then", "exactly7", "exactly89", "stopwords-longex", "stopwords-long",
+                            "internationalisation", "b"};
+    size_t num_members = sizeof(members) / sizeof(members[0]);
+    size_t num_others = sizeof(others) / sizeof(others[0]);
+
+    PerfectHash* hash = perfect_hash_create(words, sizeof(words) / sizeof(words[0]));
+    char ok = hash && perfect_hash_size(hash) == num_members; // Duplicates counted once
+
+    for(size_t i = 0; ok && i < num_members; i++)
+        ok = perfect_hash_contains(hash, members[i], strlen(members[i]));
+
+    for(size_t i = 0; ok && i < num_others; i++)
+        ok = !perfect_hash_contains(hash, others[i], strlen(others[i]));
+
+    printf("Perfect hash of %zu words: %zu keys, %s\n", sizeof(words) / sizeof(words[0]),
+           perfect_hash_size(hash), ok ? "ok" : "FAILED");
+    perfect_hash_free(hash);
+
+    // Empty list holds nothing
+    hash = perfect_hash_create(NULL, 0);
+    ok = hash && perfect_hash_size(hash) == 0 && !perfect_hash_contains(hash, "a", 1);
+    printf("Perfect hash of no words: %s\n", ok ? "ok" : "FAILED");
+    perfect_hash_free(hash);
+
+    // Enough keys for buckets to collide, members found and their neighbours rejected
+    static char many[1000][24];
+    const char* many_words[1000];
+
+    for(int i = 0; i < 1000; i++) {
+        snprintf(many[i], sizeof(many[i]), i % 2 ? "w%d" : "longer-word-%d", i);
+        many_words[i] = many[i];
+    }
+
+    hash = perfect_hash_create(many_words, 1000);
+    ok = hash && perfect_hash_size(hash) == 1000;
+
+    for(int i = 0; ok && i < 1000; i++) {
+        char other[24];
+        snprintf(other, sizeof(other), i % 2 ? "w%d" : "longer-word-%d", i + 1000);
+        ok = perfect_hash_contains(hash, many[i], strlen(many[i])) && !perfect_hash_contains(hash, other, strlen(other));
+    }
+
+    printf("Perfect hash of 1000 words: %s\n", ok ? "ok" : "FAILED");
+    perfect_hash_free(hash);
+}
+
+void test_result_cache() {
+    char dir[] = "/tmp/word_count_test_XXXXXX";
+
+    if(!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return;
+    }
+
+    char input[256], cache[256], path[4096];
+    snprintf(input, sizeof(input), "%s/input.txt", dir);
+    snprintf(cache, sizeof(cache), "%s/cache", dir);
+
+    // Same file gives the same key, rewritten content of the same size and mtime does not
+    char key[CACHE_KEY_SIZE], again[CACHE_KEY_SIZE], rewritten[CACHE_KEY_SIZE];
+    struct stat st;
+    char ok = write_file(input, "the quick brown fox\n") && !stat(input, &st) && cache_key(input, &st, key) &&
+              cache_key(input, &st, again) && !strcmp(key, again);
+
+    struct timespec times[2] = {st.st_atim, st.st_mtim};
+    ok = ok && write_file(input, "the quick brown cat\n") && !utimensat(AT_FDCWD, input, times, 0) &&
+         !stat(input, &st) && cache_key(input, &st, rewritten) && strcmp(key, rewritten);
+    printf("Cache key of rewritten input: %s\n", ok ? "ok" : "FAILED");
+
+    // Miss, then the stored file is fetched back
+    char src[256], dest[256];
+    snprintf(src, sizeof(src), "%s/src.dict", dir);
+    snprintf(dest, sizeof(dest), "%s/dest.dict", dir);
+    char fetched[64] = {0};
+    FILE* file;
+
+    ok = !cache_fetch(cache, key, dest) && write_file(src, "dictionary a") && cache_store(cache, key, src, 1000) &&
+         cache_fetch(cache, key, dest) && (file = fopen(dest, "r"));
+
+    if(ok) {
+        ok = fgets(fetched, sizeof(fetched), file) && !strcmp(fetched, "dictionary a");
+        fclose(file);
+    }
+
+    printf("Cache store and fetch: %s\n", ok ? "ok" : "FAILED");
+
+    // Entries a and b age, fetching a marks it used, so storing c evicts b
+    const char* keys[] = {"a", "b", "c"};
+    char padded[101];
+    memset(padded, 'x', 100);
+    padded[100] = '\0';
+    ok = write_file(src, padded);
+
+    for(int i = 0; ok && i < 2; i++) {
+        struct timespec used[2] = {{0, UTIME_OMIT}, {st.st_mtim.tv_sec - 100 + i, 0}};
+        snprintf(path, sizeof(path), "%s/%s.dict", cache, keys[i]);
+        ok = cache_store(cache, keys[i], src, 1000) && !utimensat(AT_FDCWD, path, used, 0);
+    }
+
+    snprintf(path, sizeof(path), "%s/%s.dict", cache, key);
+    unlink(path);
+
+    ok = ok && cache_fetch(cache, "a", dest) && cache_store(cache, "c", src, 250);
+    ok = ok && cache_fetch(cache, "a", dest) && !cache_fetch(cache, "b", dest) && cache_fetch(cache, "c", dest);
+    printf("Cache eviction of least recently used: %s\n", ok ? "ok" : "FAILED");
+
+    remove_dir(cache);
+    remove_dir(dir);
+}
+
+void test_checkpoint() {
+    char dir[] = "/tmp/word_count_test_XXXXXX";
+
+    if(!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return;
+    }
+
+    char cp_dir[256], tmp_path[256], path[4096];
+    snprintf(cp_dir, sizeof(cp_dir), "%s/checkpoint", dir);
+    snprintf(tmp_path, sizeof(tmp_path), "%s/segment.tmp", dir);
+
+    const char* words[3][2] = {{"a", "b"}, {"b", "c"}, {"a", NULL}};
+    unsigned long long counts[3][2] = {{1, 2}, {3, 1}, {4, 0}};
+    size_t num_words[3] = {2, 2, 1};
+
+    // First run saves two of the three segments before it stops
+    Checkpoint* cp = checkpoint_open(cp_dir, "key-a", 250, 100);
+    char ok = cp && cp->num_segments == 3 && cp->num_reused == 0;
+
+    for(size_t i = 0; ok && i < 2; i++)
+        ok = write_dict(tmp_path, words[i], counts[i], num_words[i]) && checkpoint_commit(cp, i, tmp_path);
+
+    checkpoint_free(cp);
+
+    // Rerun counts only the last, then merges all three
+    char merged[MERGED_SIZE] = "";
+    cp = ok ? checkpoint_open(cp_dir, "key-a", 250, 100) : NULL;
+    ok = cp && cp->num_reused == 2 && cp->segments[0].done && cp->segments[1].done && !cp->segments[2].done;
+    ok = ok && write_dict(tmp_path, words[2], counts[2], num_words[2]) && checkpoint_commit(cp, 2, tmp_path) &&
+         checkpoint_merge(cp, merged_sink, merged) && !strcmp(merged, "a:5 b:5 c:1 ");
+    printf("Checkpoint resume: %zu of 3 segments reused, %s\n", cp ? cp->num_reused : 0, ok ? "ok" : "FAILED");
+    checkpoint_free(cp);
+
+    // Listed segment whose file is gone is counted again
+    snprintf(path, sizeof(path), "%s/seg-100-200.dict", cp_dir);
+    cp = ok && !unlink(path) ? checkpoint_open(cp_dir, "key-a", 250, 100) : NULL;
+    ok = cp && cp->num_reused == 2 && !cp->segments[1].done;
+    printf("Checkpoint with a missing segment: %s\n", ok ? "ok" : "FAILED");
+    checkpoint_free(cp);
+
+    // Another input or segment size starts over and removes the listed segments
+    snprintf(path, sizeof(path), "%s/seg-0-100.dict", cp_dir);
+    cp = checkpoint_open(cp_dir, "key-a", 250, 50);
+    ok = cp && cp->num_reused == 0 && access(path, F_OK);
+    checkpoint_free(cp);
+
+    cp = checkpoint_open(cp_dir, "key-b", 250, 100);
+    ok = ok && cp && cp->num_reused == 0;
+    printf("Checkpoint of another input: %s\n", ok ? "ok" : "FAILED");
+    checkpoint_free(cp);
+
+    // Damaged manifest is ignored
+    snprintf(path, sizeof(path), "%s/%s", cp_dir, CHECKPOINT_MANIFEST);
+    cp = write_file(path, "word_count checkpoint 1\nkey key-b\nsegment_size") ?
+         checkpoint_open(cp_dir, "key-b", 250, 100) : NULL;
+    ok = cp && cp->num_reused == 0;
+    printf("Checkpoint with a damaged manifest: %s\n", ok ? "ok" : "FAILED");
+    checkpoint_free(cp);
+
+    remove_dir(cp_dir);
+    remove_dir(dir);
+}
+
+void test_follow() {
+    char dir[] = "/tmp/word_count_test_XXXXXX";
+
+    if(!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return;
+    }
+
+    char cp_dir[256], input[256], tmp_path[256], path[4096];
+    snprintf(cp_dir, sizeof(cp_dir), "%s/follow", dir);
+    snprintf(input, sizeof(input), "%s/growing.txt", dir);
+    snprintf(tmp_path, sizeof(tmp_path), "%s/segment.tmp", dir);
+
+    const char* first[] = {"a", "b"};
+    unsigned long long first_counts[] = {2, 1};
+    const char* appended[] = {"b", "c"};
+    unsigned long long appended_counts[] = {1, 1};
+
+    // First run counts the whole input
+    Checkpoint* cp = write_file(input, "a b a\n") ? checkpoint_follow(cp_dir, "follow-a", input, 6) : NULL;
+    char ok = cp && cp->num_reused == 0 && cp->num_segments == 1 && cp->segments[0].end == 6 &&
+              write_dict(tmp_path, first, first_counts, 2) && checkpoint_commit(cp, 0, tmp_path);
+    checkpoint_free(cp);
+
+    // Appended bytes become a second segment, the word still being written is left for later
+    char merged[MERGED_SIZE] = "";
+    cp = ok && write_file(input, "a b a\nb c\nc") ? checkpoint_follow(cp_dir, "follow-a", input, 11) : NULL;
+    ok = cp && cp->num_reused == 1 && cp->processed == 6 && cp->num_segments == 2 &&
+         cp->segments[1].start == 6 && cp->segments[1].end == 10 &&
+         write_dict(tmp_path, appended, appended_counts, 2) && checkpoint_commit(cp, 1, tmp_path) &&
+         checkpoint_merge(cp, merged_sink, merged) && !strcmp(merged, "a:2 b:2 c:1 ");
+
+    // Newer segment is over half the older, so the two are merged into one
+    merged[0] = '\0';
+    ok = ok && checkpoint_compact(cp) && cp->num_segments == 1 && cp->segments[0].end == 10 &&
+         checkpoint_merge(cp, merged_sink, merged) && !strcmp(merged, "a:2 b:2 c:1 ");
+    printf("Follow of appended input: %s\n", ok ? "ok" : "FAILED");
+    checkpoint_free(cp);
+
+    // Rewritten in place with the same size, the tail hash no longer matches
+    snprintf(path, sizeof(path), "%s/seg-0-10.dict", cp_dir);
+    cp = ok && write_file(input, "z b a\nb c\nc") ? checkpoint_follow(cp_dir, "follow-a", input, 11) : NULL;
+    ok = cp && cp->num_reused == 0 && cp->processed == 0 && cp->num_segments == 1 &&
+         cp->segments[0].start == 0 && cp->segments[0].end == 10 && access(path, F_OK);
+    printf("Follow of rewritten input: %s\n", ok ? "ok" : "FAILED");
+    checkpoint_free(cp);
+
+    remove_dir(cp_dir);
+    remove_dir(dir);
+}
+
+void test_serve() {
+    char dir[] = "/tmp/word_count_test_XXXXXX";
+
+    if(!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return;
+    }
+
+    char dict_path[256], socket_path[256];
+    snprintf(dict_path, sizeof(dict_path), "%s/data.bin", dir);
+    snprintf(socket_path, sizeof(socket_path), "%s/serve.sock", dir);
+
+    char* argv[] = {"serve", "--socket", socket_path, dict_path};
+    ServeRun run = {argv, -1};
+
+    // Missing and unsorted dictionaries are refused before listening
+    const char* unsorted[] = {"banana", "apple"};
+    unsigned long long unsorted_counts[] = {1, 1};
+    char ok = serve_main(4, argv) == 1 && write_dict(dict_path, unsorted, unsorted_counts, 2) &&
+              serve_main(4, argv) == 1 && access(socket_path, F_OK);
+    printf("Serve of an invalid dictionary: %s\n", ok ? "ok" : "FAILED");
+
+    const char* words[] = {"apple", "apply", "banana", "cherry"};
+    unsigned long long counts[] = {3, 1, 7, 2};
+
+    if(!write_dict(dict_path, words, counts, 4)) {
+        remove_dir(dir);
+        return;
+    }
+
+    // Server installs its own stop handlers, restored once it returns
+    struct sigaction old_int, old_term;
+    sigaction(SIGINT, NULL, &old_int);
+    sigaction(SIGTERM, NULL, &old_term);
+
+    pthread_t thread;
+
+    if(pthread_create(&thread, NULL, serve_thread, &run)) {
+        remove_dir(dir);
+        return;
+    }
+
+    int fd = -1;
+
+    for(int i = 0; fd < 0 && i < 250; i++) { // Wait for the socket
+        fd = serve_connect(socket_path);
+
+        if(fd < 0)
+            poll(NULL, 0, 20);
+    }
+
+    char out[MERGED_SIZE];
+    const char* found = fd >= 0 ? serve_words(fd, SERVE_LOOKUP, 0, "banana", out) : NULL;
+    ok = found && !strcmp(found, "banana:7 ");
+    found = ok ? serve_words(fd, SERVE_LOOKUP, 0, "ban", out) : NULL;
+    ok = found && !strcmp(found, "");
+    printf("Serve lookup: %s\n", ok ? "ok" : "FAILED");
+
+    found = ok ? serve_words(fd, SERVE_PREFIX, 0, "app", out) : NULL;
+    ok = found && !strcmp(found, "apple:3 apply:1 ");
+    found = ok ? serve_words(fd, SERVE_TOPK, 2, "", out) : NULL;
+    ok = found && !strcmp(found, "banana:7 apple:3 ");
+    printf("Serve prefix and top words: %s\n", ok ? "ok" : "FAILED");
+
+    ServeReply reply = {0};
+    ok = fd >= 0 && serve_query(fd, 9, 0, NULL, 0, &reply) && reply.status == SERVE_BAD_REQUEST;
+    printf("Serve unknown operation: %s\n", ok ? "ok" : "FAILED");
+    serve_reply_free(&reply);
+
+    if(fd >= 0)
+        close(fd);
+
+    // Interrupt stops the accept loop, which removes the socket
+    pthread_kill(thread, SIGINT);
+    pthread_join(thread, NULL);
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+
+    ok = run.status == 0 && access(socket_path, F_OK);
+    printf("Serve stop: %s\n", ok ? "ok" : "FAILED");
+
+    remove_dir(dir);
+}
+
 void test() {
     test_tree();
+    test_art();
+    test_dict_block();
+    test_perfect_hash();
+    test_result_cache();
+    test_checkpoint();
+    test_follow();
+    test_serve();
 }
 
 #endif
\ No newline at end of file